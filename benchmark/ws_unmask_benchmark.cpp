@@ -0,0 +1,121 @@
+//websocket unmask throughput, 16 B - 64 KB payloads.
+//byte: the plain key[i % 4] loop, u64: 8 byte words, vec16: sse2/neon, avx2: 32 bytes (when the cpu has it),
+//unmask: moon::ws::unmask as the server calls it.
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include "moon/core/network/ws_mask.hpp"
+
+using namespace moon::ws;
+
+using kernel_t = void(*)(uint8_t*, size_t, const uint8_t*);
+
+static void byte_loop(uint8_t* data, size_t size, const uint8_t* key)
+{
+    detail::xor_bytes(data, size, key);
+}
+
+static uint32_t load_key(const uint8_t* key)
+{
+    uint32_t k;
+    memcpy(&k, key, sizeof(k));
+    return k;
+}
+
+static void u64_loop(uint8_t* data, size_t size, const uint8_t* key)
+{
+    size_t i = detail::xor_u64(data, size, load_key(key));
+    detail::xor_bytes(data + i, size - i, key);
+}
+
+#if defined(MOON_WS_MASK_SSE2) || defined(MOON_WS_MASK_NEON)
+static void vec16_loop(uint8_t* data, size_t size, const uint8_t* key)
+{
+    size_t i = detail::xor_vec16(data, size, load_key(key));
+    detail::xor_bytes(data + i, size - i, key);
+}
+#endif
+
+#if defined(MOON_WS_MASK_AVX2)
+static void avx2_loop(uint8_t* data, size_t size, const uint8_t* key)
+{
+    size_t i = detail::xor_avx2(data, size, load_key(key));
+    detail::xor_bytes(data + i, size - i, key);
+}
+#endif
+
+struct kernel
+{
+    const char* name;
+    kernel_t fn;
+};
+
+//bytes xored per size and kernel, keeps each run around 0.1s
+static constexpr size_t TOTAL_BYTES = size_t{ 256 } << 20;
+
+int main()
+{
+    std::vector<kernel> kernels;
+    kernels.push_back({ "byte", byte_loop });
+    kernels.push_back({ "u64", u64_loop });
+#if defined(MOON_WS_MASK_SSE2) || defined(MOON_WS_MASK_NEON)
+    kernels.push_back({ "vec16", vec16_loop });
+#endif
+#if defined(MOON_WS_MASK_AVX2)
+    if (detail::has_avx2())
+    {
+        kernels.push_back({ "avx2", avx2_loop });
+    }
+#endif
+    kernels.push_back({ "unmask", unmask });
+
+    const uint8_t key[4] = { 0x12, 0x34, 0x56, 0x78 };
+    const size_t sizes[] = { 16, 64, 125, 256, 1024, 4096, 16384, 65536 };
+
+    std::vector<uint8_t> src(65536 + 1);
+    for (size_t i = 0; i < src.size(); ++i)
+    {
+        src[i] = static_cast<uint8_t>(i * 131 + 7);
+    }
+
+    printf("%8s", "size");
+    for (const auto& k : kernels)
+    {
+        printf("%12s", k.name);
+    }
+    printf("   (MB/s)\n");
+
+    for (size_t size : sizes)
+    {
+        std::vector<uint8_t> expect(src.begin() + 1, src.begin() + 1 + size);
+        byte_loop(expect.data(), size, key);
+
+        printf("%8zu", size);
+        for (const auto& k : kernels)
+        {
+            //+1: unaligned start, as payloads follow the frame header
+            std::vector<uint8_t> buf(src.begin(), src.begin() + size + 1);
+            uint8_t* data = buf.data() + 1;
+            k.fn(data, size, key);
+            if (memcmp(data, expect.data(), size) != 0)
+            {
+                printf("\n%s: wrong result at size %zu\n", k.name, size);
+                return 1;
+            }
+
+            //read through volatile so the calls are not inlined and merged, xoring twice is a no-op
+            kernel_t volatile fn = k.fn;
+            size_t rounds = TOTAL_BYTES / size;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < rounds; ++i)
+            {
+                fn(data, size, key);
+            }
+            std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+            printf("%12.0f", static_cast<double>(rounds * size) / (1024 * 1024) / dt.count());
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,241 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <atomic>
+#include <memory>
+#include <new>
+
+namespace moon
+{
+    struct block_pool_stat
+    {
+        //blocks handed out
+        uint64_t count = 0;
+        //blocks that had to come from operator new
+        uint64_t heap = 0;
+    };
+
+    //counters of current thread, shared by all block pools with the same Tag
+    template<class Tag>
+    block_pool_stat& block_pool_stat_of()
+    {
+        static thread_local block_pool_stat stat;
+        return stat;
+    }
+
+    /*
+        Fixed size block pool, one per thread.
+        A block freed by another thread goes back to the pool that allocated it through a lock-free
+        return list, the owner takes the whole list when its own free list runs out.
+        A pool lives until its thread exits and every block it gave out came back.
+    */
+    template<class Tag, size_t BlockSize>
+    class block_pool
+    {
+        static constexpr size_t MAX_FREE_BLOCKS = 4096;
+
+        struct alignas(16) block_t
+        {
+            block_pool* owner;
+            block_t* next;
+        };
+
+        struct holder
+        {
+            block_pool* pool = nullptr;
+
+            ~holder()
+            {
+                if (nullptr != pool)
+                {
+                    auto p = pool;
+                    pool = nullptr;
+                    p->release();
+                }
+            }
+        };
+
+        static holder& local()
+        {
+            static thread_local holder h;
+            return h;
+        }
+
+        block_pool() = default;
+
+        ~block_pool()
+        {
+            free_list(free_);
+            free_list(returned_.load(std::memory_order_acquire));
+        }
+    public:
+        block_pool(const block_pool&) = delete;
+        block_pool& operator=(const block_pool&) = delete;
+
+        static void* allocate()
+        {
+            auto& h = local();
+            if (nullptr == h.pool)
+            {
+                h.pool = new block_pool();
+            }
+            auto pool = h.pool;
+            auto& stat = block_pool_stat_of<Tag>();
+            ++stat.count;
+
+            block_t* b = pool->pop();
+            if (nullptr == b)
+            {
+                ++stat.heap;
+                b = static_cast<block_t*>(::operator new(sizeof(block_t) + BlockSize));
+            }
+            b->owner = pool;
+            pool->refs_.fetch_add(1, std::memory_order_relaxed);
+            return b + 1;
+        }
+
+        static void deallocate(void* p) noexcept
+        {
+            if (nullptr == p)
+            {
+                return;
+            }
+
+            block_t* b = static_cast<block_t*>(p) - 1;
+            block_pool* pool = b->owner;
+            if (pool == local().pool)
+            {
+                if (pool->nfree_ < MAX_FREE_BLOCKS)
+                {
+                    b->next = pool->free_;
+                    pool->free_ = b;
+                    ++pool->nfree_;
+                }
+                else
+                {
+                    ::operator delete(b);
+                }
+            }
+            else
+            {
+                block_t* head = pool->returned_.load(std::memory_order_relaxed);
+                do
+                {
+                    b->next = head;
+                } while (!pool->returned_.compare_exchange_weak(head, b, std::memory_order_release, std::memory_order_relaxed));
+            }
+            pool->release();
+        }
+
+    private:
+        block_t* pop()
+        {
+            if (nullptr == free_)
+            {
+                //take blocks other threads returned, keep at most MAX_FREE_BLOCKS
+                block_t* b = returned_.exchange(nullptr, std::memory_order_acquire);
+                while (nullptr != b)
+                {
+                    block_t* next = b->next;
+                    if (nfree_ < MAX_FREE_BLOCKS)
+                    {
+                        b->next = free_;
+                        free_ = b;
+                        ++nfree_;
+                    }
+                    else
+                    {
+                        ::operator delete(b);
+                    }
+                    b = next;
+                }
+            }
+
+            block_t* b = free_;
+            if (nullptr != b)
+            {
+                free_ = b->next;
+                --nfree_;
+            }
+            return b;
+        }
+
+        //one reference for the owner thread, one for each block given out
+        void release() noexcept
+        {
+            if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                delete this;
+            }
+        }
+
+        static void free_list(block_t* b) noexcept
+        {
+            while (nullptr != b)
+            {
+                block_t* next = b->next;
+                ::operator delete(b);
+                b = next;
+            }
+        }
+    private:
+        std::atomic<size_t> refs_ = 1;
+        block_t* free_ = nullptr;
+        size_t nfree_ = 0;
+        std::atomic<block_t*> returned_ = nullptr;
+    };
+
+    //allocator for std::allocate_shared and containers, one object per allocation uses block_pool
+    template<class T, class Tag = T>
+    class block_pool_allocator
+    {
+    public:
+        using value_type = T;
+
+        template<class U>
+        struct rebind
+        {
+            using other = block_pool_allocator<U, Tag>;
+        };
+
+        block_pool_allocator() noexcept = default;
+
+        template<class U>
+        block_pool_allocator(const block_pool_allocator<U, Tag>&) noexcept
+        {
+        }
+
+        T* allocate(size_t n)
+        {
+            static_assert(alignof(T) <= 16, "block_pool only supports 16 bytes alignment");
+            if (n == 1)
+            {
+                return static_cast<T*>(block_pool<Tag, sizeof(T)>::allocate());
+            }
+            return std::allocator<T>().allocate(n);
+        }
+
+        void deallocate(T* p, size_t n) noexcept
+        {
+            if (n == 1)
+            {
+                block_pool<Tag, sizeof(T)>::deallocate(p);
+                return;
+            }
+            std::allocator<T>().deallocate(p, n);
+        }
+
+        template<class U>
+        bool operator==(const block_pool_allocator<U, Tag>&) const noexcept
+        {
+            return true;
+        }
+
+        template<class U>
+        bool operator!=(const block_pool_allocator<U, Tag>&) const noexcept
+        {
+            return false;
+        }
+    };
+}
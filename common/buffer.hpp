@@ -7,6 +7,7 @@
 #include <string>
 #include <cstring>
 #include <iostream>
+#include "block_pool.hpp"
 
 namespace moon
 {
@@ -276,6 +277,19 @@ namespace moon
 
         buffer& operator=(buffer &&) = default;
 
+        //buffers are often freed by another thread, take them from per thread pools
+        static void* operator new(size_t size)
+        {
+            assert(size == sizeof(buffer));
+            (void)size;
+            return block_pool<buffer, sizeof(buffer)>::allocate();
+        }
+
+        static void operator delete(void* p) noexcept
+        {
+            block_pool<buffer, sizeof(buffer)>::deallocate(p);
+        }
+
         void init(size_t capacity = STACK_CAPACITY, uint32_t headreserved = 0)
         {
             readpos_ = headreserved;
@@ -471,7 +485,7 @@ namespace moon
                 size_t readable = size();
                 if (readable != 0)
                 {
-                    memcpy(data_() + headreserved_, data_() + readpos_, readable);
+                    memmove(data_() + headreserved_, data_() + readpos_, readable);
                 }
                 readpos_ = headreserved_;
                 writepos_ = readpos_ + readable;
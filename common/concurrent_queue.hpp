@@ -103,6 +103,29 @@ namespace moon
             return container_.size();
         }
 
+        //push [first, last) with one lock, return queue size after push
+        template<typename TIter>
+        size_t push_back(TIter first, TIter last)
+        {
+            raii_lock_t lck(mutex_);
+            for (; first != last; ++first)
+            {
+                if constexpr (std::is_same_v< typename block_full::type, std::true_type>)
+                {
+                    block_full::check(lck, [this] {
+                        return (container_.size() < max_size_) || exit_;
+                    });
+                }
+                container_.push_back(std::move(*first));
+            }
+
+            if constexpr (std::is_same_v< typename block_empty::type, std::true_type>)
+            {
+                block_empty::notify_one();
+            }
+            return container_.size();
+        }
+
         bool try_pop(T& t)
         {
             raii_lock_t lck(mutex_);
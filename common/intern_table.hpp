@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <cassert>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace moon
+{
+    /*
+        Append only string table, id starts from 1, 0 means not interned.
+        find is lock free, intern takes a lock. Strings are never removed,
+        so views returned by get stay valid for the lifetime of the table.
+    */
+    template<size_t Capacity>
+    class intern_table
+    {
+        static constexpr size_t SLOTS = Capacity * 2;
+    public:
+        intern_table() = default;
+
+        intern_table(const intern_table&) = delete;
+        intern_table& operator=(const intern_table&) = delete;
+
+        uint32_t find(std::string_view s) const
+        {
+            if (size_.load(std::memory_order_acquire) == 0)
+            {
+                return 0;
+            }
+
+            size_t h = std::hash<std::string_view>{}(s);
+            for (size_t i = 0; i < SLOTS; ++i)
+            {
+                uint32_t id = slots_[(h + i) % SLOTS].load(std::memory_order_acquire);
+                if (id == 0)
+                {
+                    return 0;
+                }
+                if (*strings_[id] == s)
+                {
+                    return id;
+                }
+            }
+            return 0;
+        }
+
+        //returns 0 when table is full
+        uint32_t intern(std::string_view s)
+        {
+            if (auto id = find(s); id != 0)
+            {
+                return id;
+            }
+
+            std::lock_guard lk(lock_);
+            if (auto id = find(s); id != 0)
+            {
+                return id;
+            }
+
+            uint32_t id = static_cast<uint32_t>(size_.load(std::memory_order_relaxed)) + 1;
+            if (id > Capacity)
+            {
+                return 0;
+            }
+
+            strings_[id] = std::make_unique<const std::string>(s);
+            size_t h = std::hash<std::string_view>{}(s);
+            for (size_t i = 0; i < SLOTS; ++i)
+            {
+                auto& slot = slots_[(h + i) % SLOTS];
+                if (slot.load(std::memory_order_relaxed) == 0)
+                {
+                    slot.store(id, std::memory_order_release);
+                    break;
+                }
+            }
+            size_.store(id, std::memory_order_release);
+            return id;
+        }
+
+        bool valid(uint32_t id) const
+        {
+            return id > 0 && id <= size_.load(std::memory_order_acquire);
+        }
+
+        std::string_view get(uint32_t id) const
+        {
+            assert(id > 0 && id <= size_.load(std::memory_order_acquire));
+            return *strings_[id];
+        }
+
+        size_t size() const
+        {
+            return size_.load(std::memory_order_acquire);
+        }
+    private:
+        std::atomic<size_t> size_ = 0;
+        std::atomic<uint32_t> slots_[SLOTS] = {};
+        std::unique_ptr<const std::string> strings_[Capacity + 1];
+        std::mutex lock_;
+    };
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <cassert>
+#include <type_traits>
+
+namespace moon
+{
+    //intrusive hook, element type of mpsc_queue must derive from it
+    struct mpsc_queue_hook
+    {
+        std::atomic<mpsc_queue_hook*> mpsc_next_ = nullptr;
+    };
+
+    /*
+        Vyukov intrusive multi-producer/single-consumer linked queue.
+        push_back is wait-free for producers (one atomic exchange, no lock, no allocation),
+        try_pop/swap must only be called from one consumer thread.
+        The interface mirrors concurrent_queue, so it can be used as worker mailbox.
+    */
+    template<class TPointer, template <typename Elem, typename = std::allocator<Elem>> class Container = std::vector>
+    class mpsc_queue
+    {
+    public:
+        using value_type = TPointer;
+        using element_type = typename TPointer::element_type;
+        using container_type = Container<value_type>;
+
+        mpsc_queue()
+            :head_(&stub_)
+            , tail_(&stub_)
+            , size_(0)
+        {
+        }
+
+        mpsc_queue(const mpsc_queue& t) = delete;
+        mpsc_queue& operator=(const mpsc_queue& t) = delete;
+
+        ~mpsc_queue()
+        {
+            value_type t;
+            while (size_.load(std::memory_order_acquire) != 0)
+            {
+                pop_one(t);
+                size_.fetch_sub(1, std::memory_order_release);
+                t.reset();
+            }
+        }
+
+        //return queue size after push, 1 means queue was empty
+        size_t push_back(value_type&& x)
+        {
+            static_assert(std::is_base_of_v<mpsc_queue_hook, element_type>, "element type must derive from mpsc_queue_hook");
+            mpsc_queue_hook* node = x.release();
+            push_node(node);
+            return size_.fetch_add(1, std::memory_order_acq_rel) + 1;
+        }
+
+        //link [first, last) as a chain and publish it with one exchange, return queue size after push
+        template<typename TIter>
+        size_t push_back(TIter first, TIter last)
+        {
+            static_assert(std::is_base_of_v<mpsc_queue_hook, element_type>, "element type must derive from mpsc_queue_hook");
+            if (first == last)
+            {
+                return size_.load(std::memory_order_acquire);
+            }
+
+            size_t n = 0;
+            mpsc_queue_hook* chain = nullptr;
+            mpsc_queue_hook* prev = nullptr;
+            for (; first != last; ++first, ++n)
+            {
+                mpsc_queue_hook* node = first->release();
+                node->mpsc_next_.store(nullptr, std::memory_order_relaxed);
+                if (nullptr == prev)
+                {
+                    chain = node;
+                }
+                else
+                {
+                    prev->mpsc_next_.store(node, std::memory_order_relaxed);
+                }
+                prev = node;
+            }
+
+            mpsc_queue_hook* old = head_.exchange(prev, std::memory_order_acq_rel);
+            old->mpsc_next_.store(chain, std::memory_order_release);
+            return size_.fetch_add(n, std::memory_order_acq_rel) + n;
+        }
+
+        bool try_pop(value_type& t)
+        {
+            if (size_.load(std::memory_order_acquire) == 0)
+            {
+                return false;
+            }
+            pop_one(t);
+            size_.fetch_sub(1, std::memory_order_acq_rel);
+            return true;
+        }
+
+        size_t size() const
+        {
+            return size_.load(std::memory_order_acquire);
+        }
+
+        //move all elements to other, keep the 'push_back returns 1 when empty' guarantee:
+        //the queue is only observed empty by producers after everything they pushed was taken.
+        void swap(container_type& other)
+        {
+            size_t n = size_.load(std::memory_order_acquire);
+            while (n != 0)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    value_type t;
+                    pop_one(t);
+                    other.push_back(std::move(t));
+                }
+                n = size_.fetch_sub(n, std::memory_order_acq_rel) - n;
+            }
+        }
+
+    private:
+        void push_node(mpsc_queue_hook* node)
+        {
+            node->mpsc_next_.store(nullptr, std::memory_order_relaxed);
+            mpsc_queue_hook* prev = head_.exchange(node, std::memory_order_acq_rel);
+            prev->mpsc_next_.store(node, std::memory_order_release);
+        }
+
+        //caller guarantees the queue holds at least one counted element
+        void pop_one(value_type& t)
+        {
+            int counter = 0;
+            mpsc_queue_hook* node = nullptr;
+            while (nullptr == (node = try_pop_node()))
+            {
+                //a producer is between exchange and link, it will finish soon
+                if (++counter > 100)
+                    std::this_thread::yield();
+            }
+            t.reset(static_cast<element_type*>(node));
+        }
+
+        mpsc_queue_hook* try_pop_node()
+        {
+            mpsc_queue_hook* tail = tail_;
+            mpsc_queue_hook* next = tail->mpsc_next_.load(std::memory_order_acquire);
+            if (tail == &stub_)
+            {
+                if (nullptr == next)
+                {
+                    return nullptr;
+                }
+                tail_ = next;
+                tail = next;
+                next = next->mpsc_next_.load(std::memory_order_acquire);
+            }
+
+            if (nullptr != next)
+            {
+                tail_ = next;
+                return tail;
+            }
+
+            if (tail != head_.load(std::memory_order_acquire))
+            {
+                return nullptr;
+            }
+
+            push_node(&stub_);
+
+            next = tail->mpsc_next_.load(std::memory_order_acquire);
+            if (nullptr != next)
+            {
+                tail_ = next;
+                return tail;
+            }
+            return nullptr;
+        }
+
+    private:
+        alignas(64) std::atomic<mpsc_queue_hook*> head_;
+        alignas(64) mpsc_queue_hook* tail_;
+        std::atomic<size_t> size_;
+        mpsc_queue_hook stub_;
+    };
+}
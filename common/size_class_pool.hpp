@@ -0,0 +1,361 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <array>
+#include <new>
+#include "platform_define.hpp"
+#include "noncopyable.hpp"
+
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+#include <malloc.h>
+#endif
+
+namespace moon
+{
+    /*
+        Size class allocator for one owner that is used by one thread at a time (a lua VM).
+        Blocks up to MAX_SMALL bytes are cut from per class pages, bigger ones come from malloc.
+        Pages are small so that a VM with little data holds little memory. They are cut one by one from
+        CHUNK_SIZE chunks, pages not cut yet are never touched. A page that becomes empty can be reused by any
+        class, a chunk whose pages are all empty goes back to the system.
+        Callers pass the block size back on free, as lua_Alloc does, so blocks have no header.
+    */
+    class size_class_pool : public noncopyable
+    {
+    public:
+        static constexpr size_t ALIGNMENT = 16;
+        static constexpr size_t MAX_SMALL = 256;
+        static constexpr size_t CLASS_COUNT = MAX_SMALL / ALIGNMENT;
+        static constexpr size_t PAGE_SIZE = 4096;
+        static constexpr size_t CHUNK_PAGES = 16;
+        static constexpr size_t CHUNK_SIZE = CHUNK_PAGES * PAGE_SIZE;
+
+        struct class_stat
+        {
+            size_t size = 0;
+            size_t pages = 0;
+            //blocks in use
+            size_t blocks = 0;
+        };
+
+        size_class_pool() = default;
+
+        ~size_class_pool()
+        {
+            while (nullptr != chunks_)
+            {
+                chunk* c = chunks_;
+                chunks_ = c->next;
+                free_chunk(c);
+            }
+        }
+
+        void* allocate(size_t size)
+        {
+            if (size > MAX_SMALL)
+            {
+                void* p = std::malloc(size);
+                if (nullptr != p)
+                {
+                    large_bytes_ += size;
+                }
+                return p;
+            }
+            size_t cls = class_of(size);
+            size_class& c = classes_[cls];
+            page* p = c.partial;
+            if (nullptr == p)
+            {
+                p = new_page(cls);
+                if (nullptr == p)
+                {
+                    return nullptr;
+                }
+                push(c.partial, p);
+            }
+            size_t bsize = block_size(cls);
+            void* b = p->free;
+            if (nullptr != b)
+            {
+                p->free = *static_cast<void**>(b);
+            }
+            else
+            {
+                b = reinterpret_cast<char*>(p) + p->bump;
+                p->bump += static_cast<uint32_t>(bsize);
+            }
+            ++p->used;
+            ++c.blocks;
+            if (is_full(p, bsize))
+            {
+                unlink(c.partial, p);
+                push(c.full, p);
+            }
+            return b;
+        }
+
+        void deallocate(void* ptr, size_t size)
+        {
+            if (nullptr == ptr)
+            {
+                return;
+            }
+            if (size > MAX_SMALL)
+            {
+                large_bytes_ -= size;
+                std::free(ptr);
+                return;
+            }
+            page* p = page_of(ptr);
+            size_class& c = classes_[p->cls];
+            if (is_full(p, block_size(p->cls)))
+            {
+                unlink(c.full, p);
+                push(c.partial, p);
+            }
+            *static_cast<void**>(ptr) = p->free;
+            p->free = ptr;
+            --p->used;
+            --c.blocks;
+            if (p->used == 0)
+            {
+                unlink(c.partial, p);
+                --c.pages;
+                release_page(p);
+            }
+        }
+
+        //nullptr when out of memory, ptr is still valid then
+        void* reallocate(void* ptr, size_t osize, size_t nsize)
+        {
+            if (nullptr == ptr)
+            {
+                return allocate(nsize);
+            }
+            if (osize > MAX_SMALL && nsize > MAX_SMALL)
+            {
+                void* p = std::realloc(ptr, nsize);
+                if (nullptr != p)
+                {
+                    large_bytes_ = large_bytes_ - osize + nsize;
+                }
+                return p;
+            }
+            if (osize <= MAX_SMALL && nsize <= MAX_SMALL && class_of(osize) == class_of(nsize))
+            {
+                return ptr;
+            }
+            void* p = allocate(nsize);
+            if (nullptr != p)
+            {
+                memcpy(p, ptr, (osize < nsize) ? osize : nsize);
+                deallocate(ptr, osize);
+            }
+            return p;
+        }
+
+        class_stat stat(size_t cls) const
+        {
+            class_stat s;
+            s.size = block_size(cls);
+            s.pages = classes_[cls].pages;
+            s.blocks = classes_[cls].blocks;
+            return s;
+        }
+
+        //bytes of pages cut from chunks, used or not
+        size_t page_bytes() const
+        {
+            return cut_pages_ * PAGE_SIZE;
+        }
+
+        size_t large_bytes() const
+        {
+            return large_bytes_;
+        }
+
+    private:
+        struct chunk;
+
+        struct page
+        {
+            page* prev;
+            page* next;
+            chunk* owner;
+            void* free;
+            uint32_t bump;
+            uint32_t used;
+            uint32_t cls;
+        };
+
+        struct chunk
+        {
+            chunk* prev;
+            chunk* next;
+            char* mem;
+            //pages cut so far
+            uint32_t cut;
+            //pages not empty
+            uint32_t used;
+        };
+
+        static constexpr size_t HEADER_SIZE = (sizeof(page) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+        struct size_class
+        {
+            //pages with free blocks
+            page* partial = nullptr;
+            page* full = nullptr;
+            size_t pages = 0;
+            size_t blocks = 0;
+        };
+
+        static size_t class_of(size_t size)
+        {
+            return (size == 0) ? 0 : (size - 1) / ALIGNMENT;
+        }
+
+        static size_t block_size(size_t cls)
+        {
+            return (cls + 1) * ALIGNMENT;
+        }
+
+        static page* page_of(void* ptr)
+        {
+            return reinterpret_cast<page*>(reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t{ PAGE_SIZE } - 1));
+        }
+
+        static bool is_full(const page* p, size_t bsize)
+        {
+            return nullptr == p->free && p->bump + bsize > PAGE_SIZE;
+        }
+
+        template<typename T>
+        static void push(T*& head, T* p)
+        {
+            p->prev = nullptr;
+            p->next = head;
+            if (nullptr != head)
+            {
+                head->prev = p;
+            }
+            head = p;
+        }
+
+        template<typename T>
+        static void unlink(T*& head, T* p)
+        {
+            if (nullptr != p->prev)
+            {
+                p->prev->next = p->next;
+            }
+            else
+            {
+                head = p->next;
+            }
+            if (nullptr != p->next)
+            {
+                p->next->prev = p->prev;
+            }
+            p->prev = p->next = nullptr;
+        }
+
+        page* new_page(size_t cls)
+        {
+            page* p = free_;
+            if (nullptr != p)
+            {
+                unlink(free_, p);
+            }
+            else
+            {
+                if (nullptr == current_ || current_->cut == CHUNK_PAGES)
+                {
+                    current_ = new_chunk();
+                    if (nullptr == current_)
+                    {
+                        return nullptr;
+                    }
+                }
+                p = reinterpret_cast<page*>(current_->mem + current_->cut * PAGE_SIZE);
+                p->owner = current_;
+                ++current_->cut;
+                ++cut_pages_;
+            }
+            ++p->owner->used;
+            p->prev = p->next = nullptr;
+            p->free = nullptr;
+            p->bump = static_cast<uint32_t>(HEADER_SIZE);
+            p->used = 0;
+            p->cls = static_cast<uint32_t>(cls);
+            ++classes_[cls].pages;
+            return p;
+        }
+
+        void release_page(page* p)
+        {
+            chunk* c = p->owner;
+            push(free_, p);
+            if (--c->used > 0 || c == current_)
+            {
+                return;
+            }
+            //all cut pages of this chunk are in free_
+            for (uint32_t i = 0; i < c->cut; ++i)
+            {
+                unlink(free_, reinterpret_cast<page*>(c->mem + i * PAGE_SIZE));
+            }
+            cut_pages_ -= c->cut;
+            unlink(chunks_, c);
+            free_chunk(c);
+        }
+
+        chunk* new_chunk()
+        {
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+            void* mem = _aligned_malloc(CHUNK_SIZE, PAGE_SIZE);
+#else
+            void* mem = std::aligned_alloc(PAGE_SIZE, CHUNK_SIZE);
+#endif
+            if (nullptr == mem)
+            {
+                return nullptr;
+            }
+            chunk* c = new (std::nothrow) chunk{ nullptr, nullptr, static_cast<char*>(mem), 0, 0 };
+            if (nullptr == c)
+            {
+                free_mem(mem);
+                return nullptr;
+            }
+            push(chunks_, c);
+            return c;
+        }
+
+        static void free_chunk(chunk* c)
+        {
+            free_mem(c->mem);
+            delete c;
+        }
+
+        static void free_mem(void* mem)
+        {
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+            _aligned_free(mem);
+#else
+            std::free(mem);
+#endif
+        }
+
+    private:
+        std::array<size_class, CLASS_COUNT> classes_;
+        chunk* chunks_ = nullptr;
+        //chunk new pages are cut from
+        chunk* current_ = nullptr;
+        //empty pages of all chunks
+        page* free_ = nullptr;
+        size_t cut_pages_ = 0;
+        size_t large_bytes_ = 0;
+    };
+}
@@ -4,13 +4,11 @@
 #include <functional>
 #include <cassert>
 #include <chrono>
-#include <vector>
-#include <unordered_map>
-#include <list>
+#include <deque>
 
 namespace moon
 {
-    using timer_id_t = uint32_t;
+    using timer_id_t = uint64_t;
 
     namespace detail
     {
@@ -18,79 +16,79 @@ namespace moon
         {
             return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
         }
-
-        template<typename TContainer, uint8_t Size>
-        class timer_wheel
-        {
-            using container_t = TContainer;
-        public:
-            timer_wheel()
-                :head_(0)
-            {
-            }
-
-            container_t& operator[](uint8_t pos)
-            {
-                assert(pos < Size);
-                return array_[pos];
-            }
-
-            container_t& front()
-            {
-                assert(head_ < Size);
-                return array_[head_];
-            }
-
-            void pop_front() noexcept
-            {
-                auto tmp = ++head_;
-                head_ = tmp % Size;
-            }
-
-            bool round() const noexcept
-            {
-                return head_ == 0;
-            }
-
-            uint8_t size() const noexcept
-            {
-                return Size;
-            }
-
-            size_t next_slot() const noexcept
-            {
-                return head_;
-            }
-        private:
-            container_t 	array_[Size];
-            uint32_t	head_;
-        };
     }
 
-    template<class TChild>
+    /*
+        Hierarchical timing wheel: one near wheel of 256 slots and 4 level wheels of 64 slots,
+        driven by a 32bit tick counter.
+        Timer nodes are pooled and linked into slots by index, so add and remove do not allocate
+        once the pool is warm, and remove unlinks the node at once.
+        Timer id is node index + generation, a stale id never matches a reused node: the generation
+        takes 2^31 reuses of one node to wrap.
+        TContext is the per timer payload, child must implement:
+            void on_timer(timer_id_t id, TContext& ctx, bool last)
+    */
+    template<class TChild, class TContext>
     class base_timer
     {
-        //every wheel size max 255
-        static constexpr int  WHEEL_SIZE = 255;
-
-        static constexpr int TIMERID_SHIT = 32;
+        static constexpr int NEAR_SHIFT = 8;
+        static constexpr uint32_t NEAR_SIZE = 1 << NEAR_SHIFT;
+        static constexpr uint32_t NEAR_MASK = NEAR_SIZE - 1;
+        static constexpr int LEVEL_SHIFT = 6;
+        static constexpr uint32_t LEVEL_SIZE = 1 << LEVEL_SHIFT;
+        static constexpr uint32_t LEVEL_MASK = LEVEL_SIZE - 1;
+        static constexpr int LEVEL_NUM = 4;
+
+        // timer id: 31bit(generation) 32bit(node index), fits a lua integer
+        static constexpr int INDEX_BITS = 32;
+        static constexpr uint32_t GENERATION_MAX = 0x7FFFFFFF;
+        static constexpr uint32_t NIL = 0xFFFFFFFF;
 
-        using timer_wheel_t = detail::timer_wheel<std::list<uint64_t>, WHEEL_SIZE>;
         using child_t = TChild;
+
+        enum class node_state :uint8_t
+        {
+            free,
+            linked,
+            firing,
+            removed
+        };
+
+        struct slot_t
+        {
+            uint32_t head = NIL;
+            uint32_t tail = NIL;
+        };
+
+        struct node_t
+        {
+            uint32_t prev = NIL;
+            uint32_t next = NIL;
+            slot_t* slot = nullptr;
+            uint32_t expire = 0;
+            int32_t duration = 0;
+            //0 means infinite
+            int32_t times = 0;
+            uint32_t generation = 1;
+            node_state state = node_state::free;
+            TContext ctx{};
+        };
     public:
-        //precision ms
-        static const int32_t PRECISION = 10;
+        static constexpr uint32_t MAX_TIMER_NUM = NIL;
+
+        //default precision ms
+        static constexpr int32_t PRECISION = 10;
 
         base_timer()
             : stop_(false)
+            , precision_(PRECISION)
+            , current_(0)
+            , free_(NIL)
+            , size_(0)
             , tick_(0)
             , previous_tick_(0)
             , now_(detail::millseconds)
         {
-            wheels_.emplace_back();
-            wheels_.emplace_back();
-            wheels_.emplace_back();
-            wheels_.emplace_back();
         }
 
         base_timer(const base_timer&) = delete;
@@ -112,46 +110,19 @@ namespace moon
 
             auto old_tick = tick_;
 
-            auto& wheels = wheels_;
-            while (tick_ >= PRECISION)
+            while (tick_ >= precision_)
             {
-                tick_ -= PRECISION;
-                if (stop_)
-                    continue;
-                {
-                    auto& timers = wheels[0].front();
-                    wheels[0].pop_front();
-                    if (!timers.empty())
-                    {
-                        expired(timers);
-                    }
-                }
-
-                int i = 0;
-                for (auto wheel = wheels.begin(); wheel != wheels.end(); ++wheel, ++i)
+                if (size_ == 0)
                 {
-                    auto next_wheel = wheel;
-                    if (wheels.end() == (++next_wheel))
-                        break;
-
-                    if (wheel->round())
-                    {
-                        auto& timers = next_wheel->front();
-                        while (!timers.empty())
-                        {
-                            auto key = timers.front();
-                            timers.pop_front();
-                            auto slot = get_slot(key, i);
-                            (*wheel)[slot].push_front(key);
-                            //printf("update timer id %u add to wheel [%d] slot [%d]\r\n", (key>>32), i+1, slot);
-                        }
-                        next_wheel->pop_front();
-                    }
-                    else
-                    {
-                        break;
-                    }
+                    //nothing to expire, skip the idle ticks
+                    tick_ %= precision_;
+                    break;
                 }
+                tick_ -= precision_;
+                if (stop_)
+                    continue;
+                shift();
+                execute();
             }
             return old_tick;
         }
@@ -172,234 +143,344 @@ namespace moon
             now_ = (f);
         }
 
-    protected:
-        // slots:      8bit(notuse) 8bit(wheel3_slot)  8bit(wheel2_slot)  8bit(wheel1_slot)  
-        uint64_t make_key(timer_id_t id, uint32_t slots)
+        //tick length in ms, only takes effect while there is no timer
+        void set_precision(int32_t v)
+        {
+            assert(v > 0);
+            if (size_ == 0 && v > 0)
+            {
+                precision_ = v;
+            }
+        }
+
+        int32_t precision() const noexcept
         {
-            return ((static_cast<uint64_t>(id) << TIMERID_SHIT) | slots);
+            return precision_;
         }
 
-        inline uint8_t get_slot(uint64_t  key, int which_queue)
+        size_t size() const noexcept
         {
-            return (key >> (which_queue * 8)) & 0xFF;
+            return size_;
         }
 
-        void insert_timer(int32_t duration, timer_id_t id)
+        //times <= 0 means infinite
+        timer_id_t add(int32_t duration, int32_t times, TContext ctx)
         {
-            auto diff = duration;
-            auto offset = diff % PRECISION;
-            if (offset > 0)
+            if (duration < precision_)
             {
-                diff += PRECISION;
+                duration = precision_;
             }
-            size_t slot_count = diff / PRECISION;
-            slot_count = (slot_count > 0) ? slot_count : 1;
-            uint64_t key = 0;
-            int i = 0;
-            uint32_t slots = 0;
-            for (auto it = wheels_.begin(); it != wheels_.end(); ++it, ++i)
+
+            uint32_t index = free_;
+            if (index != NIL)
             {
-                auto& wheel = *it;
-                slot_count += wheel.next_slot();
-                uint8_t slot = (slot_count - 1) % (wheel.size());
-                slot_count -= slot;
-                slots |= (static_cast<uint32_t>(slot) << (i * 8));
-                key = make_key(id, slots);
-                //printf("process timer id %u wheel[%d] slot[%d]\r\n", t->id(), i+1, slot);
-                if (slot_count < wheel.size())
-                {
-                    //printf("timer id %u add to wheel [%d] slot [%d]\r\n",t->id(),  i + 1, slot);
-                    wheel[slot].push_back(key);
-                    break;
-                }
-                slot_count /= wheel.size();
+                free_ = nodes_[index].next;
             }
-        }
-
-        void expired(std::list<uint64_t>& expires)
-        {
-            while (!expires.empty())
+            else
             {
-                auto key = expires.front();
-                expires.pop_front();
-                timer_id_t id = static_cast<timer_id_t>(key >> TIMERID_SHIT);
-                child_t* child = static_cast<child_t*>(this);
-                int32_t duration = child->on_timer(id);
-                if (duration != 0)
+                if (nodes_.size() >= MAX_TIMER_NUM)
                 {
-                    insert_timer(duration, id);
+                    return 0;
                 }
+                index = static_cast<uint32_t>(nodes_.size());
+                nodes_.emplace_back();
             }
-        }
-    private:
-        bool stop_;
-        int64_t tick_;
-        int64_t previous_tick_;
-        std::function<int64_t()> now_;
-        std::vector <timer_wheel_t> wheels_;
-    };
 
-    class timer_context
-    {
-    public:
-        static constexpr int32_t times_mask = 0xFFFFFFF;
+            auto& n = nodes_[index];
+            n.duration = duration;
+            n.times = (times > 0) ? times : 0;
+            n.ctx = std::move(ctx);
+            n.state = node_state::linked;
+            n.expire = current_ + ticks(align_duration(duration));
+            link(index);
+            ++size_;
+            return make_id(index, n.generation);
+        }
 
-        enum flag
+        //O(1), returns false if the timer already expired or removed
+        bool remove(timer_id_t id)
         {
-            removed = 1 << 29,
-            infinite = 1 << 30,
-        };
+            node_t* p = find_node(id);
+            if (nullptr == p)
+            {
+                return false;
+            }
 
-        timer_context(int32_t duration, int32_t times)
-            :duration_(duration)
-            , times_(times)
-        {
+            auto& n = *p;
+            uint32_t index = static_cast<uint32_t>(id);
+            switch (n.state)
+            {
+            case node_state::linked:
+                unlink(index);
+                release(index);
+                return true;
+            case node_state::firing:
+                //released after the handler returns
+                n.state = node_state::removed;
+                return true;
+            default:
+                return false;
+            }
         }
 
-        ~timer_context()
+        //context of a timer not expired or removed yet, nullptr otherwise
+        const TContext* context(timer_id_t id)
         {
+            node_t* p = find_node(id);
+            if (nullptr == p || (p->state != node_state::linked && p->state != node_state::firing))
+            {
+                return nullptr;
+            }
+            return &p->ctx;
         }
 
-        int32_t duration()  const noexcept
+        //slow path, scans all timer nodes
+        template<typename TFunc>
+        bool any_of(TFunc&& f) const
         {
-            return duration_;
+            for (auto& n : nodes_)
+            {
+                if ((n.state == node_state::linked || n.state == node_state::firing) && f(n.ctx))
+                {
+                    return true;
+                }
+            }
+            return false;
         }
 
-        bool times(int32_t value) noexcept
+        //milliseconds until next update() has work to do, -1 means no timer.
+        //when near wheel has no timer, returns the time of next cascade from level wheels.
+        int64_t wait_time()
         {
-            times_ = value;
-            return (times_& times_mask) > 0;
+            if (size_ == 0)
+            {
+                return -1;
+            }
+
+            uint32_t n = NEAR_SIZE - (current_ & NEAR_MASK);
+            for (uint32_t i = 1; i < n; ++i)
+            {
+                if (near_[(current_ + i) & NEAR_MASK].head != NIL)
+                {
+                    n = i;
+                    break;
+                }
+            }
+            auto v = static_cast<int64_t>(n) * precision_ - tick_ - (now_() - previous_tick_);
+            return (v > 0) ? v : 0;
         }
 
-        int32_t times()  const noexcept
+    protected:
+        //timers are placed relative to last processed tick, count the time since then,
+        //so a timer added after wheels idle for a while does not expire early.
+        int32_t align_duration(int32_t duration)
         {
-            return times_;
+            auto now_tick = now_();
+            if (previous_tick_ == 0 || size_ == 0)
+            {
+                //wheels are empty, restart counting from now
+                previous_tick_ = now_tick;
+                tick_ = 0;
+                return duration;
+            }
+            return duration + static_cast<int32_t>(now_tick - previous_tick_ + tick_);
         }
 
-        void set_flag(flag v) noexcept
+    private:
+        static timer_id_t make_id(uint32_t index, uint32_t generation)
         {
-            times_ |= static_cast<int32_t>(v);
+            return (static_cast<timer_id_t>(generation) << INDEX_BITS) | index;
         }
 
-        bool has_flag(flag v) const noexcept
+        node_t* find_node(timer_id_t id)
         {
-            return ((times_& static_cast<int32_t>(v)) != 0);
+            uint32_t index = static_cast<uint32_t>(id);
+            if (index >= nodes_.size() || nodes_[index].generation != (id >> INDEX_BITS))
+            {
+                return nullptr;
+            }
+            return &nodes_[index];
         }
 
-        void clear_flag(flag v) noexcept
+        uint32_t ticks(int32_t duration) const
         {
-            times_ &= ~static_cast<int32_t>(v);
+            uint32_t n = static_cast<uint32_t>((duration + precision_ - 1) / precision_);
+            return (n > 0) ? n : 1;
         }
-    private:
-        int32_t	duration_;
-        int32_t	times_;
-    };
-
-    class timer :public base_timer<timer>
-    {
-        static constexpr int MAX_TIMER_NUM = (1 << 24) - 1;
-
-        using timer_handler_t = std::function<void(timer_id_t)>;
 
-        friend class base_timer<timer>;
-
-        class context :public timer_context
+        void link(uint32_t index)
         {
-        public:
-            context(int32_t duration, int32_t times, timer_handler_t handler)
-                :timer_context(duration, times)
-                , handler_(std::forward<timer_handler_t>(handler))
+            auto& n = nodes_[index];
+            uint32_t expire = n.expire;
+            slot_t* slot = nullptr;
+            if ((expire | NEAR_MASK) == (current_ | NEAR_MASK))
             {
+                slot = &near_[expire & NEAR_MASK];
             }
-
-            ~context()
+            else
             {
+                int i = 0;
+                uint32_t mask = NEAR_SIZE << LEVEL_SHIFT;
+                for (; i < LEVEL_NUM - 1; ++i)
+                {
+                    if ((expire | (mask - 1)) == (current_ | (mask - 1)))
+                    {
+                        break;
+                    }
+                    mask <<= LEVEL_SHIFT;
+                }
+                slot = &level_[i][(expire >> (NEAR_SHIFT + i * LEVEL_SHIFT)) & LEVEL_MASK];
             }
 
-            void  expired(timer_id_t id)
+            n.slot = slot;
+            n.next = NIL;
+            n.prev = slot->tail;
+            if (slot->tail != NIL)
             {
-                assert(nullptr != handler_);
-                handler_(id);
+                nodes_[slot->tail].next = index;
             }
-        private:
-            timer_handler_t handler_;
-        };
+            else
+            {
+                slot->head = index;
+            }
+            slot->tail = index;
+        }
 
-    public:
-        timer_id_t repeat(int32_t duration, int32_t times, timer_handler_t hander)
+        void unlink(uint32_t index)
         {
-            if (duration < PRECISION)
+            auto& n = nodes_[index];
+            slot_t* slot = n.slot;
+            if (n.prev != NIL)
             {
-                duration = PRECISION;
+                nodes_[n.prev].next = n.next;
             }
-
-            assert(times < timer_context::times_mask);
-
-            if (uuid_ == 0 || uuid_ == MAX_TIMER_NUM)
-                uuid_ = 1;
-
-            while (timers_.find(uuid_) != timers_.end())
+            else
             {
-                ++uuid_;
+                slot->head = n.next;
             }
 
-            if (times <= 0)
+            if (n.next != NIL)
             {
-                times = (0 | timer_context::infinite);
+                nodes_[n.next].prev = n.prev;
             }
+            else
+            {
+                slot->tail = n.prev;
+            }
+            n.prev = NIL;
+            n.next = NIL;
+            n.slot = nullptr;
+        }
 
-            timer_id_t id = uuid_;
-            insert_timer(duration, id);
-            timers_.emplace(id, context{ duration,times, hander });
-            return id;
+        void release(uint32_t index)
+        {
+            auto& n = nodes_[index];
+            n.state = node_state::free;
+            n.ctx = TContext{};
+            n.generation = (n.generation == GENERATION_MAX) ? 1 : n.generation + 1;
+            n.next = free_;
+            free_ = index;
+            --size_;
         }
 
-        void remove(timer_id_t timerid)
+        //move timers of a level slot down to lower wheels
+        void cascade(int level, uint32_t idx)
         {
-            auto iter = timers_.find(timerid);
-            if (iter != timers_.end())
+            auto& slot = level_[level][idx];
+            uint32_t index = slot.head;
+            slot.head = NIL;
+            slot.tail = NIL;
+            while (index != NIL)
             {
-                iter->second.set_flag(timer_context::removed);
-                return;
+                uint32_t next = nodes_[index].next;
+                link(index);
+                index = next;
             }
         }
 
-    private:
-        timer_id_t create_timerid()
+        void shift()
         {
-            if (uuid_ == 0 || uuid_ == MAX_TIMER_NUM)
-                uuid_ = 1;
-            while (timers_.find(uuid_) != timers_.end())
+            uint32_t mask = NEAR_SIZE;
+            uint32_t ct = ++current_;
+            if (ct == 0)
             {
-                ++uuid_;
+                cascade(LEVEL_NUM - 1, 0);
+                return;
             }
-            return uuid_;
-        }
 
-        int32_t on_timer(timer_id_t id)
-        {
-            auto iter = timers_.find(id);
-            if (iter == timers_.end())
+            uint32_t time = ct >> NEAR_SHIFT;
+            int i = 0;
+            while ((ct & (mask - 1)) == 0)
             {
-                return 0;
+                uint32_t idx = time & LEVEL_MASK;
+                if (idx != 0)
+                {
+                    cascade(i, idx);
+                    break;
+                }
+                mask <<= LEVEL_SHIFT;
+                time >>= LEVEL_SHIFT;
+                ++i;
             }
+        }
 
-            auto&ctx = iter->second;
-            if (!ctx.has_flag(timer_context::removed))
+        void execute()
+        {
+            //handlers never add timers to the slot being executed, expire is at least one tick later
+            auto& slot = near_[current_ & NEAR_MASK];
+            while (slot.head != NIL)
             {
-                ctx.expired(id);
-                if (ctx.has_flag(timer_context::infinite) || ctx.times(ctx.times() - 1))
+                uint32_t index = slot.head;
+                unlink(index);
+
+                //deque keeps node address when handler adds timers
+                auto& n = nodes_[index];
+                n.state = node_state::firing;
+                bool last = (n.times > 0 && --n.times == 0);
+                static_cast<child_t*>(this)->on_timer(make_id(index, n.generation), n.ctx, last);
+
+                if (last || n.state == node_state::removed)
+                {
+                    release(index);
+                }
+                else
                 {
-                    return ctx.duration();
+                    n.state = node_state::linked;
+                    n.expire = current_ + ticks(n.duration);
+                    link(index);
                 }
             }
-            timers_.erase(iter);
-            return 0;
+        }
+    private:
+        bool stop_;
+        int32_t precision_;
+        uint32_t current_;
+        uint32_t free_;
+        size_t size_;
+        int64_t tick_;
+        int64_t previous_tick_;
+        std::function<int64_t()> now_;
+        std::deque<node_t> nodes_;
+        slot_t near_[NEAR_SIZE];
+        slot_t level_[LEVEL_NUM][LEVEL_SIZE];
+    };
+
+    class timer :public base_timer<timer, std::function<void(timer_id_t)>>
+    {
+        using timer_handler_t = std::function<void(timer_id_t)>;
+
+        friend class base_timer<timer, timer_handler_t>;
+    public:
+        timer_id_t repeat(int32_t duration, int32_t times, timer_handler_t hander)
+        {
+            return add(duration, times, std::move(hander));
         }
 
     private:
-        uint32_t uuid_ = 0;
-        std::unordered_map<uint32_t, context> timers_;
+        void on_timer(timer_id_t id, timer_handler_t& handler, bool)
+        {
+            assert(nullptr != handler);
+            handler(id);
+        }
     };
 }
-
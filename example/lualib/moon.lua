@@ -12,6 +12,7 @@ local seri = require("seri")
 
 local pairs = pairs
 local type = type
+local math_type = math.type
 local setmetatable = setmetatable
 local jencode = json.encode
 local co_create = coroutine.create
@@ -20,6 +21,7 @@ local _co_resume = coroutine.resume
 local co_yield = coroutine.yield
 local table_remove = table.remove
 local _send = core.send
+local _send_id = core.send_id
 
 local PTYPE_SYSTEM = 1
 local PTYPE_TEXT = 2
@@ -90,7 +92,10 @@ local function co_resume(co, ...)
 end
 
 ---make map<coroutine,sessionid>
-local function make_response(receiver)
+--- sessions resumed with a buffer_view of the response instead of its unpacked values
+local session_view = {}
+
+local function make_response(receiver, view)
     repeat
         uuid = uuid + 1
         if uuid == 0xFFFFFFF then
@@ -107,12 +112,16 @@ local function make_response(receiver)
 
     local co = co_running()
     session_id_coroutine[uuid] = co
+    if view then
+        session_view[uuid] = true
+    end
     return uuid
 end
 
 --- 取消等待session的回应
 function moon.cancel_session(sessionid)
     session_id_coroutine[sessionid] = false
+    session_view[sessionid] = nil
 end
 
 moon.make_response = make_response
@@ -156,6 +165,11 @@ local function _default_dispatch(msg, PTYPE)
         local co = session_id_coroutine[sessionid]
         if co then
             session_id_coroutine[sessionid] = nil
+            if session_view[sessionid] then
+                session_view[sessionid] = nil
+                co_resume(co, msg:view())
+                return
+            end
             --print(coroutine.status(co))
             co_resume(co, p.unpack(msg))
             --print(coroutine.status(co))
@@ -177,11 +191,11 @@ core.set_cb('m', _default_dispatch)
 ---向指定服务发送消息,消息内容会根据协议类型进行打包<br>
 ---param PTYPE:协议类型<br>
 ---param receiver:接收者服务id<br>
----param header:message header<br>
+---param header:message header, 或 moon.intern_header 返回的id<br>
 ---param ...:消息内容<br>
 ---@param PTYPE string
 ---@param receiver int
----@param header string
+---@param header string|int
 ---@return boolean
 function moon.send(PTYPE, receiver, header, ...)
     local p = protocol[PTYPE]
@@ -192,6 +206,10 @@ function moon.send(PTYPE, receiver, header, ...)
     if services_exited[receiver] then
         return false,"send to a exited service"
     end
+    if math_type(header) == "integer" then
+        _send_id(sid_, receiver, p.pack(...), header, 0, p.PTYPE)
+        return true
+    end
     header = header or ''
     _send(sid_, receiver, p.pack(...), header, 0, p.PTYPE)
     return true
@@ -204,7 +222,7 @@ end
 ---param data 消息内容 string 类型<br>
 ---@param PTYPE string 协议类型
 ---@param receiver int 接收者服务id
----@param header string message header
+---@param header string|int message header, 或 moon.intern_header 返回的id
 ---@param data string|userdata 消息内容
 ---@param sessionid int
 ---@return boolean
@@ -217,12 +235,49 @@ function moon.raw_send(PTYPE, receiver, header, data, sessionid)
     if services_exited[receiver] then
         return false,"moon.raw_send send to dead service"
 	end
-    header = header or ''
     sessionid = sessionid or 0
+    if math_type(header) == "integer" then
+        _send_id(sid_, receiver, data, header, sessionid, p.PTYPE)
+        return true
+    end
+    header = header or ''
     _send(sid_, receiver, data, header, sessionid, p.PTYPE)
 	return true
 end
 
+---向订阅了group的所有服务发送消息, 消息内容只打包一次, 所有接收者共享(只读)<br>
+---param group:广播组id, 使用 moon.subscribe(group) 订阅<br>
+---param header:message header<br>
+---param ...:消息内容<br>
+---@param group int
+---@param PTYPE string
+---@param header string
+function moon.publish(group, PTYPE, header, ...)
+    local p = protocol[PTYPE]
+    if not p then
+        error(string.format("moon publish unknown PTYPE[%s] message", PTYPE))
+    end
+    header = header or ''
+    core.publish(sid_, group, p.pack(...), header, p.PTYPE)
+end
+
+---向多个服务发送消息, 消息内容只打包一次, 所有接收者共享(只读)<br>
+---同一worker上的接收者只入队一次, 只唤醒一次<br>
+---param receivers:接收者服务id数组<br>
+---param header:message header<br>
+---param ...:消息内容<br>
+---@param PTYPE string
+---@param receivers int[]
+---@param header string
+function moon.send_many(PTYPE, receivers, header, ...)
+    local p = protocol[PTYPE]
+    if not p then
+        error(string.format("moon send_many unknown PTYPE[%s] message", PTYPE))
+    end
+    header = header or ''
+    core.send_many(sid_, receivers, p.pack(...), header, p.PTYPE)
+end
+
 ---获取当前的服务id
 ---@return int
 function moon.sid()
@@ -384,6 +439,17 @@ core.set_cb('t',
 )
 
 local _repeated = moon.repeated
+local _remove_timer = core.remove_timer
+
+---@param timerid int
+function moon.remove_timer(timerid)
+    --not ours or already expired
+    if not timer_cb[timerid] then
+        return false
+    end
+    timer_cb[timerid] = nil
+    return _remove_timer(timerid)
+end
 
 ---@param mills int
 ---@return int
@@ -489,7 +555,8 @@ reg_protocol {
     pack = seri.pack,
     unpack = function(arg)
         if arg.buffer then
-            return unpack(arg:buffer())
+            --msg:buffer() would copy a shared payload
+            return unpack(arg:data())
         else
             return unpack(arg)
         end
@@ -538,6 +605,7 @@ reg_protocol {
         local co = session_id_coroutine[sessionid]
         if co then
             session_id_coroutine[sessionid] = nil
+            session_view[sessionid] = nil
             co_resume(co, false, topic..data)
             return
         end
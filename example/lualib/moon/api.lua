@@ -11,7 +11,7 @@ local ignore_param = print
 
 core = {}
 
----Remove a timer.<br>
+---Remove a timer of this service. Returns false when the timer is not owned by this service, already expired or removed.<br>
 ---@param timerid int
 function core.remove_timer(timerid)
     ignore_param(timerid)
@@ -35,6 +35,15 @@ function core.microsecond()
     -- body
 end
 
+---进程内注册消息header, 返回整数id, 表满时返回0<br>
+---moon.send/moon.raw_send 的header传这个id时消息只带id, 不复制和查找字符串. 接收方用 msg:header_id() 取得id,<br>
+---以字符串发送的header在接收方调用 msg:header_id() 时查表<br>
+---@param header string
+---@return int
+function core.intern_header(header)
+    ignore_param(header)
+end
+
 ---offset[+,-] server time(millsecond)<br>
 function core.time_offset()
     -- body
@@ -73,15 +82,63 @@ function core.send_prefab(receiver, prefabid, header, sessionid, type)
     ignore_param(receiver, prefabid, header, sessionid, type)
 end
 
+---订阅广播组, group 不能为 0
+---@param group int
+---@return boolean
+function core.subscribe(group)
+    ignore_param(group)
+end
+
+---取消订阅广播组
+---@param group int
+---@return boolean
+function core.unsubscribe(group)
+    ignore_param(group)
+end
+
+---同moon.raw_send, header是core.intern_header返回的id
+---@param sender int
+---@param receiver int
+---@param buf userdata
+---@param header_id int
+---@param sessionid int
+---@param type int
+function core.send_id(sender, receiver, buf, header_id, sessionid, type)
+    ignore_param(sender, receiver, buf, header_id, sessionid, type)
+end
+
+---向多个服务发送同一消息, 按worker分组, 每个worker只入队一次, 所有接收者共享消息内容(只读)
+---@param sender int
+---@param receivers int[]
+---@param buf userdata
+---@param header string
+---@param type int
+function core.send_many(sender, receivers, buf, header, type)
+    ignore_param(sender, receivers, buf, header, type)
+end
+
+---设置当前服务邮箱水位, 堆积消息数达到high后按policy处理, 降到low后恢复. high为0表示不限制<br>
+---policy: "none" 只告警, "drop_oldest" 丢弃最旧的请求, "reject" 拒绝新请求(call返回错误),<br>
+---"throttle" 暂停读取该服务拥有的socket连接. 回应消息和系统消息不会被丢弃
+---@param high int
+---@param low int
+---@param policy string
+function core.set_mailbox_limit(high, low, policy)
+    ignore_param(high, low, policy)
+end
+
 ---@param name string
 function core.remove_component(name)
     ignore_param(name)
 end
 
 ---获取lua虚拟机占用的内存(单位byte)
----@return int
-function core.memory_use()
-    -- body
+---param detail 为true时返回分配器详情: {total = 内存, page_bytes = 小对象页占用, large_bytes = 大对象(>256字节)占用,
+---classes = {{size = 块大小, pages = 页数, blocks = 使用中的块数}, ...}}
+---@param detail bool
+---@return int|table
+function core.memory_use(detail)
+    ignore_param(detail)
 end
 
 ---获取worker线程数
@@ -153,6 +210,7 @@ end
 ---local socket_recv = 3
 ---local socket_close =4
 ---local socket_error = 5
+---local socket_send_queue = 6
 ---@return int
 function message:subtype()
     ignore_param(self)
@@ -186,12 +244,102 @@ function message:substr(pos, count)
     ignore_param(self, pos, count)
 end
 
----返回消息数据的lightuserdata指针(moon::buffer*)
+---返回消息数据的lightuserdata指针(moon::buffer*), 用于moon.buffer写入。<br>
+---数据被其它消息(publish、send_many)或视图共享时先复制一份, 写入不影响其它持有者。只读时用msg:data()
 ---@return userdata
 function message:buffer()
     ignore_param(self)
 end
 
+---返回消息数据的只读视图(buffer_view),不拷贝数据。视图持有消息数据的引用,消息处理完后依然有效。
+---之后通过msg:buffer()写入时会先复制数据, 视图内容不变。
+---@return buffer_view
+function message:view()
+    ignore_param(self)
+end
+
+---消息数据的只读视图,位置从1开始,可以为负数(同string库)。可以直接传给seri.unpack。
+---@class buffer_view
+local buffer_view = {}
+ignore_param(buffer_view)
+
+---数据长度,同#view
+---@return int
+function buffer_view:size()
+    ignore_param(self)
+end
+
+---同string.byte
+---@param i int
+---@param j int
+---@return int
+function buffer_view:byte(i, j)
+    ignore_param(self, i, j)
+end
+
+---同string.sub,拷贝[i,j]返回string
+---@param i int
+---@param j int
+---@return string
+function buffer_view:sub(i, j)
+    ignore_param(self, i, j)
+end
+
+---返回[i,j]的视图,不拷贝数据
+---@param i int
+---@param j int
+---@return buffer_view
+function buffer_view:slice(i, j)
+    ignore_param(self, i, j)
+end
+
+---查找字符串(不支持pattern),返回开始和结束位置,找不到返回nil
+---@param str string
+---@param init int
+---@return int,int
+function buffer_view:find(str, init)
+    ignore_param(self, str, init)
+end
+
+---读取pos开始n(1-8)个字节的有符号整数,默认小端
+---@param pos int
+---@param n int
+---@param bigendian boolean
+---@return int
+function buffer_view:int(pos, n, bigendian)
+    ignore_param(self, pos, n, bigendian)
+end
+
+---读取pos开始n(1-8)个字节的无符号整数,默认小端
+---@param pos int
+---@param n int
+---@param bigendian boolean
+---@return int
+function buffer_view:uint(pos, n, bigendian)
+    ignore_param(self, pos, n, bigendian)
+end
+
+---@param pos int
+---@param bigendian boolean
+---@return number
+function buffer_view:float(pos, bigendian)
+    ignore_param(self, pos, bigendian)
+end
+
+---@param pos int
+---@param bigendian boolean
+---@return number
+function buffer_view:double(pos, bigendian)
+    ignore_param(self, pos, bigendian)
+end
+
+---同string.unpack,不支持对齐('!'),整数最多8字节。返回读取的值和下一个位置
+---@param fmt string
+---@param pos int
+function buffer_view:unpack(fmt, pos)
+    ignore_param(self, fmt, pos)
+end
+
 ---更改消息的接收者服务id,框架底层负责把消息转发。同时可以设置消息的header.
 ---@param header string
 ---@param receiver int
@@ -281,16 +429,117 @@ function fs.stem(fp)
     ignore_param(fp)
 end
 
+---@class sharetable
+---进程内共享的只读配置表, 加载一次, 所有lua服务通过 query 得到的代理userdata读取, 不会在每个VM中复制。
+---代理支持 t.k、#t、pairs(t), 写入会报错。同名重新加载后, 已经 query 到的代理仍然读取旧数据, 需要重新 query。
+---local sharetable = require("sharetable")
+---sharetable.loadfile("item", "config/item.json")
+---local item = sharetable.query("item")
+---print(item[1001].name)
+local sharetable = {}
+ignore_param(sharetable)
+
+---加载json文件, 根节点必须是object或array, json null 视为 nil
+---@param name string
+---@param path string
+---@return bool, string @失败时返回 false, 错误信息
+function sharetable.loadfile(name, path)
+    ignore_param(name, path)
+end
+
+---@param name string
+---@param json string
+---@return bool, string
+function sharetable.loadstring(name, json)
+    ignore_param(name, json)
+end
+
+---把lua表(只支持整数或字符串key, 值为 boolean/number/string/table)转换为共享表
+---@param name string
+---@param t table
+---@return bool, string
+function sharetable.loadtable(name, t)
+    ignore_param(name, t)
+end
+
+---@param name string
+---@return userdata @不存在时返回 nil
+function sharetable.query(name)
+    ignore_param(name)
+end
+
+---@param name string
+---@return bool
+function sharetable.remove(name)
+    ignore_param(name)
+end
+
+---深拷贝为普通lua表
+---@param t userdata @query 返回的代理或其子表
+---@return table
+function sharetable.copy(t)
+    ignore_param(t)
+end
+
+---@return table @{count = 表数量, memory = 占用字节数(估算)}
+function sharetable.stats()
+end
+
+---@class codecache
+local codecache = {}
+ignore_param(codecache)
+
+---lua文件字节码缓存统计
+---@return table @{hit = 命中次数, miss = 未命中次数, files = 缓存的文件数, memory = 缓存占用字节数}
+function codecache.stats()
+end
+
 ---@class socketcore
 local socketcore = {}
 ignore_param(socketcore)
 
 ---param protocol moon.PTYPE_TEXT、moon.PTYPE_SOCKET、moon.PTYPE_SOCKET_WS、
+---param opt 可选, 对accept的连接生效. frame_length: PTYPE_SOCKET 长度头格式,<br>
+---"u16"(默认, 2字节大端), "u32"(4字节大端), "varint"(7bit变长, 低位在前), 后两种单个消息最大64M, 不需要分包<br>
+---reuseport: 开启SO_REUSEPORT, 不同worker上的服务可以监听同一端口, 由内核分配连接, 连接在accept它的worker上处理,<br>
+---不支持SO_REUSEPORT的平台上监听失败返回0. 每个worker一个监听服务用 socket.co_listen_workers 创建<br>
+---send_queue_limit: 连接未发送字节数上限, 默认8M<br>
+---send_queue_policy: 达到上限时的处理, "close"(默认) 关闭连接, "drop" 丢弃 socket.write_droppable 发送的数据(先丢最旧的), 仍超限则关闭,<br>
+---"notify" 给服务发送 socket_send_queue 消息(socket.on("send_queue")), header为"high", 降到一半以下时再发送一次"low", 超过4倍上限关闭<br>
+---deflate: PTYPE_SOCKET_WS 开启permessage-deflate压缩(需要以 ws-deflate 选项编译), true 或 { window_bits = 9-15(默认15),<br>
+---context_takeover = bool(默认true, false时每个消息单独压缩), threshold = 字节数(默认256, 更小的消息不压缩) }<br>
+---fragment: PTYPE_SOCKET_WS 发送的消息超过这个字节数时分片发送, 默认0不分片<br>
+---path: socket.connect PTYPE_SOCKET_WS 时握手请求的路径, 默认"/". 握手完成后收到 socket.wson("connect"), 之前写入的消息在握手后发送
 ---@param host string
 ---@param port int
 ---@param protocol int
-function socketcore.listen(host, port, protocol)
-    ignore_param(host, port, protocol)
+---@param opt table
+function socketcore.listen(host, port, protocol, opt)
+    ignore_param(host, port, protocol, opt)
+end
+
+---创建UDP socket, 收到的数据报以 PTYPE_SOCKET socket_recv 消息交给 socket.on("message"),<br>
+---msg:header() 是对端地址 "ip:port", msg:sender() 是udp fd. 失败返回0<br>
+---param opt 可选. arq: 为每个对端提供可靠有序传输(确认重传), 重传超时后收到 socket_error 消息<br>
+---peer_timeout: arq对端无数据往来超过这个毫秒数后被清除, 默认60000<br>
+---max_peers: arq最多同时保存的对端数量, 超过时丢弃新对端的数据报, 向新对端sendto返回false, 默认1024<br>
+---loss: 发送时随机丢弃的百分比, 用于测试
+---@param host string
+---@param port int
+---@param opt table
+---@return int
+function socketcore.udp(host, port, opt)
+    ignore_param(host, port, opt)
+end
+
+---向 addr("ip:port") 发送一个数据报, 单个最大4K
+---param T string 、 moon.buffer
+---@param fd int
+---@param addr string
+---@param data T
+---@return bool
+function socketcore.sendto(fd, addr, data)
+    ignore_param(fd, addr, data)
 end
 
 ---param T string 、 moon.buffer
@@ -308,6 +557,24 @@ function socketcore.write_message(fd, m)
     ignore_param(fd, m)
 end
 
+---向多个websocket连接发送同一个消息, 每种压缩参数只编码一次帧, 所有连接共享. 只发送当前worker的连接<br>
+---返回发送的连接数
+---param T string 、 moon.buffer
+---@param fds int[]
+---@param data T
+---@param text bool
+---@return int
+function socketcore.broadcast_ws(fds, data, text)
+    ignore_param(fds, data, text)
+end
+
+---连接未发送的字节数, 包括正在发送的数据. fd不是当前worker的连接时返回0
+---@param fd int
+---@return int
+function socketcore.queued_bytes(fd)
+    ignore_param(fd)
+end
+
 ---param t 秒。0不检测超时，默认是0。
 ---@param fd int
 ---@param t int
@@ -316,6 +583,22 @@ function socketcore.settimeout(fd, t)
     ignore_param(fd, t)
 end
 
+---param ms 毫秒, 超过ms没有收到数据则关闭连接, 0不检测. 精度10ms
+---@param fd int
+---@param ms int
+---@return bool
+function socketcore.set_read_timeout(fd, ms)
+    ignore_param(fd, ms)
+end
+
+---param ms 毫秒, 一次发送超过ms没有完成(对端不接收)则关闭连接, 0不检测. 精度10ms
+---@param fd int
+---@param ms int
+---@return bool
+function socketcore.set_write_timeout(fd, ms)
+    ignore_param(fd, ms)
+end
+
 ---@param fd int
 ---@return bool
 function socketcore.setnodelay(fd)
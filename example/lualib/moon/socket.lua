@@ -24,6 +24,7 @@ linedelim['\n'] = 3
 
 local close_flag = moon.buffer_flag.close
 local ws_text_flag = moon.buffer_flag.ws_text
+local droppable_flag = moon.buffer_flag.droppable
 
 ---@class socket : socketcore
 local socket = {}
@@ -45,17 +46,63 @@ function socket.start(listenfd)
     accept(listenfd,0,id)
 end
 
+--- async
+--- SO_REUSEPORT sharded listen: creates one lua service from conf on each selected worker. Each one calls
+--- socket.listen(host, port, protocol, {reuseport = true}) in its script, which pins it to its worker, and
+--- handles the connections the kernel gives to that worker. A script must raise an error when listen returns 0.
+--- workers: n (workers 1..n) or a list of worker ids, default all workers.
+--- Returns the service ids, or nil and an error after removing the services already created.
+---@param conf table
+---@param workers int|int[]
+---@return int[]
+function socket.co_listen_workers(conf, workers)
+    local num = moon.workernum()
+    workers = workers or num
+    if type(workers) == "number" then
+        local n = workers
+        workers = {}
+        for i = 1, n do
+            workers[i] = i
+        end
+    end
+
+    local services = {}
+    local function fail(err)
+        for _, sid in ipairs(services) do
+            moon.co_remove_service(sid)
+        end
+        return nil, err
+    end
+
+    for _, w in ipairs(workers) do
+        if math.type(w) ~= "integer" or w < 1 or w > num then
+            return fail("listen_workers: worker " .. tostring(w) .. " out of range 1-" .. num)
+        end
+        local sid = moon.co_new_service("lua", conf, false, w)
+        if not sid or sid == 0 then
+            return fail("listen_workers: service on worker " .. w .. " failed to start")
+        end
+        services[#services + 1] = sid
+        if (sid >> 24) ~= w then
+            return fail("listen_workers: service " .. sid .. " runs on worker " .. (sid >> 24) .. ", not " .. w)
+        end
+    end
+    return services
+end
+
 --- async
 --- param protocol moon.PTYPE_TEXT、moon.PTYPE_SOCKET、moon.PTYPE_SOCKET_WS、
 --- timeout millseconds
+--- opt 同 socket.listen
 ---@param host string
 ---@param port int
 ---@param protocol int
 ---@param timeout int
-function socket.connect(host, port, protocol, timeout)
+---@param opt table
+function socket.connect(host, port, protocol, timeout, opt)
     timeout = timeout or 0
     local sessionid = make_response()
-    connect(host, port, sessionid, id, protocol, timeout)
+    connect(host, port, sessionid, id, protocol, timeout, opt)
     local fd,err = yield()
     if not fd then
         return nil,err
@@ -63,8 +110,8 @@ function socket.connect(host, port, protocol, timeout)
     return tonumber(fd)
 end
 
-function socket.sync_connect(host, port, type)
-    local fd = connect(host, port, 0, id, type, 0)
+function socket.sync_connect(host, port, type, opt)
+    local fd = connect(host, port, 0, id, type, 0, opt)
     if fd == 0 then
         return nil,"connect failed"
     end
@@ -90,10 +137,34 @@ function socket.readline(fd, delim, limit)
     return yield()
 end
 
+--- async, as socket.read, returns buffer_view instead of string
+function socket.read_view(fd, len)
+    local sessionid = make_response(nil, true)
+    read(fd, id, len, 0, sessionid)
+    return yield()
+end
+
+--- async, as socket.readline, returns buffer_view instead of string
+function socket.readline_view(fd, delim, limit)
+    delim = linedelim[delim]
+    if not delim  then
+        return nil,"unsupported read delim "..tostring(delim)
+    end
+    limit= limit or 0
+    local sessionid = make_response(nil, true)
+    read(fd, id, limit, delim, sessionid)
+    return yield()
+end
+
 function socket.write_then_close(fd, data)
     write_with_flag(fd ,data, close_flag)
 end
 
+--- data may be discarded when connection's send_queue_policy is "drop" and send queue is over limit
+function socket.write_droppable(fd, data)
+    write_with_flag(fd, data, droppable_flag)
+end
+
 --- only for websocket
 function socket.write_text(fd, data)
     write_with_flag(fd ,data, ws_text_flag)
@@ -104,14 +175,15 @@ local socket_data_type = {
     accept = 2,
     message = 3,
     close = 4,
-    error = 5
+    error = 5,
+    send_queue = 6
 }
 
 --- tow bytes len protocol callbacks
-local callbacks = table.new(0,6)
+local callbacks = table.new(0,7)
 
 --- websocket protocol wscallbacks
-local wscallbacks = table.new(0,6)
+local wscallbacks = table.new(0,7)
 
 moon.dispatch(
     "socket",
@@ -0,0 +1,123 @@
+local moon = require("moon")
+
+---fan-in benchmark for worker mailbox: N producer services on other workers
+---send to one hub service. Build with and without premake option '--mpsc-mailbox'
+---to compare spin_lock + vector swap and lock-free mpsc queue.
+
+local conf = ...
+
+local microsecond = moon.microsecond
+local raw_send = moon.raw_send
+
+local function percentile(hist, total, p)
+    local keys = {}
+    for k,_ in pairs(hist) do
+        keys[#keys+1] = k
+    end
+    table.sort(keys)
+    local limit = total * p
+    local n = 0
+    for _,k in ipairs(keys) do
+        n = n + hist[k]
+        if n >= limit then
+            return k
+        end
+    end
+    return 0
+end
+
+local function run_producer()
+    local hist = {}
+    local payload = string.rep("x", 32)
+
+    local command = {}
+
+    command.RUN = function(hub, count)
+        for _=1,count do
+            local t = microsecond()
+            raw_send("text", hub, "", payload)
+            t = microsecond() - t
+            hist[t] = (hist[t] or 0) + 1
+        end
+    end
+
+    command.RESULT = function(sender, sessionid)
+        moon.response("lua", sender, sessionid, hist)
+        hist = {}
+    end
+
+    moon.dispatch("lua",function(msg, p)
+        local header = msg:header()
+        if header == "RUN" then
+            command.RUN(p.unpack(msg))
+        else
+            command.RESULT(msg:sender(), msg:sessionid())
+        end
+    end)
+end
+
+local function run_hub()
+    local producer_nums = conf.producers or {1, 2, 4, 8, 16, 32}
+    local count = conf.count or 100000
+    local received = 0
+    local total = 0
+    local finish_time = 0
+
+    moon.dispatch("text",function()
+        received = received + 1
+        if received == total then
+            finish_time = microsecond()
+        end
+    end)
+
+    moon.async(function()
+        local workernum = moon.workernum()
+        print(string.format("mailbox benchmark: %d messages per producer, %d workers", count, workernum))
+        print("producers    throughput(msg/s)    p99 enqueue(us)    max enqueue(us)")
+        for _,n in ipairs(producer_nums) do
+            local producers = {}
+            for i=1,n do
+                local workerid = 1
+                if workernum > 1 then
+                    workerid = (i - 1) % (workernum - 1) + 2
+                end
+                local sid = moon.co_new_service("lua", {name="producer", file="mailbox_benchmark.lua"}, false, workerid)
+                producers[#producers+1] = sid
+            end
+
+            received = 0
+            total = n * count
+            finish_time = 0
+            local start_time = microsecond()
+            for _,sid in ipairs(producers) do
+                moon.send("lua", sid, "RUN", moon.sid(), count)
+            end
+
+            local hist = {}
+            for _,sid in ipairs(producers) do
+                local h = moon.co_call("lua", sid)
+                for k,v in pairs(h) do
+                    hist[k] = (hist[k] or 0) + v
+                end
+            end
+
+            while received < total do
+                moon.co_wait(10)
+            end
+
+            local cost = (finish_time - start_time)/1000000
+            print(string.format("%-12d %-20.0f %-18d %d", n, total/cost, percentile(hist, total, 0.99), percentile(hist, total, 1)))
+
+            for _,sid in ipairs(producers) do
+                moon.remove_service(sid)
+            end
+        end
+        moon.abort()
+    end)
+end
+
+if conf.master then
+    run_hub()
+else
+    run_producer()
+end
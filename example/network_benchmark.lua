@@ -5,6 +5,16 @@ local conf = ...
 
 local function run_slave()
     local count = 0
+    if conf.reuseport then
+        --every slave listens on the same port, kernel spreads connections, no accept hop
+        local listenfd = socket.listen(conf.host, conf.port, moon.PTYPE_SOCKET, {reuseport = true})
+        assert(listenfd ~= 0, "listen failed")
+        socket.start(listenfd)
+        moon.destroy(function()
+            socket.close(listenfd)
+        end)
+    end
+
     do
         socket.on("accept",function(fd, msg)
             --print("accept ", fd, msg:bytes())
@@ -35,6 +45,21 @@ end
 
 
 local function run_master()
+    if conf.reuseport then
+        print(string.format([[
+
+        network benchmark run at %s %d with SO_REUSEPORT, one slave per worker.
+    ]], conf.host, conf.port))
+        moon.async(function()
+            local slaves, err = socket.co_listen_workers({name="slave",file="network_benchmark.lua",host=conf.host,port=conf.port,reuseport=true})
+            if not slaves then
+                print(err)
+                moon.abort()
+            end
+        end)
+        return
+    end
+
     local listenfd  = socket.listen(conf.host,conf.port,moon.PTYPE_SOCKET)
 
     print(string.format([[
@@ -0,0 +1,57 @@
+local moon = require("moon")
+local seri = require("seri")
+
+---seri benchmark: packs/unpack of typical messages, seri.packs (tagged elements) against
+---seri.packs_typed (typed arrays). Reports ops/s and encoded bytes.
+
+local conf = ...
+
+local count = conf.count or 20000
+
+local millsecond = moon.millsecond
+
+local function range(n, f)
+    local t = {}
+    for i = 1, n do
+        t[i] = f(i)
+    end
+    return t
+end
+
+local cases = {
+    {"small record", {id = 10001, name = "player", level = 30, online = true}},
+    {"records", range(100, function(i)
+        return {id = i, name = "player" .. i, items = range(16, function(j) return i * j end), pos = {x = i / 2, y = -i / 2}}
+    end)},
+    {"int array", range(1000, function(i) return i * 1000 end)},
+    {"real array", range(1000, function(i) return i / 7 end)},
+    {"string array", range(1000, function(i) return "name" .. i end)},
+}
+
+local function bench(packs, v)
+    local data = packs(v)
+    local t = millsecond()
+    for _ = 1, count do
+        packs(v)
+    end
+    local tpack = math.max(1, millsecond() - t)
+    t = millsecond()
+    for _ = 1, count do
+        seri.unpack(data)
+    end
+    local tunpack = math.max(1, millsecond() - t)
+    return #data, count * 1000 / tpack, count * 1000 / tunpack
+end
+
+moon.start(function()
+    print(string.format("seri benchmark: %d times per case", count))
+    print(string.format("%-14s %-7s %8s %12s %12s", "case", "packer", "bytes", "pack/s", "unpack/s"))
+    for _, case in ipairs(cases) do
+        local name, v = case[1], case[2]
+        for _, packer in ipairs({{"plain", seri.packs}, {"typed", seri.packs_typed}}) do
+            local bytes, p, u = bench(packer[2], v)
+            print(string.format("%-14s %-7s %8d %12.0f %12.0f", name, packer[1], bytes, p, u))
+        end
+    end
+    moon.abort()
+end)
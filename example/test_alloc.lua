@@ -0,0 +1,77 @@
+local moon = require("moon")
+local json = require("json")
+local test_assert = require("test_assert")
+
+---pooled message and buffer: after warm up, messages between workers come from pools,
+---the receiver's worker gives them back to the sender's pool.
+
+local conf = ...
+
+if conf.echo then
+    moon.dispatch("lua", function(msg, p)
+        moon.send("lua", msg:sender(), "ECHO", p.unpack(msg))
+    end)
+    return
+end
+
+if conf.sender then
+    --at most WINDOW messages in flight, so pools warmed by the first round cover the second
+    local WINDOW = 100
+    local received = 0
+    local sent = 0
+    local total = 0
+    local echo
+    local caller, callid
+    moon.dispatch("lua", function(msg, p)
+        if msg:sessionid() ~= 0 then
+            local count
+            echo, count = p.unpack(msg)
+            caller, callid = msg:sender(), msg:sessionid()
+            received = 0
+            total = count
+            for i = 1, math.min(WINDOW, count) do
+                moon.send("lua", echo, "PING", i, "payload")
+            end
+            sent = math.min(WINDOW, count)
+            return
+        end
+        received = received + 1
+        if sent < total then
+            sent = sent + 1
+            moon.send("lua", echo, "PING", sent, "payload")
+        end
+        if received == total then
+            moon.response("lua", caller, callid, received)
+        end
+    end)
+    return
+end
+
+local count = 2000
+
+moon.start(function()
+    moon.async(function()
+        local echo = moon.co_new_service("lua", {name = "test_alloc_echo", file = "test_alloc.lua", echo = true}, false, 3)
+        local sender = moon.co_new_service("lua", {name = "test_alloc_sender", file = "test_alloc.lua", sender = true}, false, 2)
+
+        --warm up pools
+        test_assert.equal(moon.co_call("lua", sender, echo, count), count)
+
+        local before = json.decode(moon.co_runcmd("worker.2.alloc"))
+        test_assert.equal(moon.co_call("lua", sender, echo, count), count)
+        local after = json.decode(moon.co_runcmd("worker.2.alloc"))
+
+        local messages = after.message - before.message
+        local buffers = after.buffer - before.buffer
+        test_assert.less_equal(count, messages)
+        test_assert.less_equal(after.message_heap - before.message_heap, messages // 100)
+        test_assert.less_equal(after.buffer_heap - before.buffer_heap, buffers // 100)
+        print(string.format("heap allocations per message: message %.4f, buffer %.4f",
+            (after.message_heap - before.message_heap) / messages,
+            (after.buffer_heap - before.buffer_heap) / messages))
+
+        moon.co_remove_service(echo)
+        moon.co_remove_service(sender)
+        test_assert.success()
+    end)
+end)
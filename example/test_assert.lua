@@ -78,6 +78,16 @@ local assert = function(cond, msg)
     end
 end
 
+--polls f every 10ms until it returns true or timeout(ms, default 5000) passed, call it in a coroutine
+local wait = function(f, timeout)
+    local n = (timeout or 5000) // 10
+    local i = 0
+    while not f() and i < n do
+        moon.co_wait(10)
+        i = i + 1
+    end
+end
+
 return {
     equal = equal,
     less = less,
@@ -86,5 +96,6 @@ return {
     greater_equal = greater_equal,
     success = send_success,
     assert = assert,
+    wait = wait,
     linear_table_equal = linear_table_equal
 }
@@ -0,0 +1,126 @@
+local moon = require("moon")
+local json = require("json")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---mailbox watermarks: reject answers calls with an error, drop_oldest keeps the newest requests,
+---throttle pauses socket reads of the congested service and resumes them after it drains.
+
+local HOST = "127.0.0.1"
+local PORT = 30005
+
+local conf = ...
+
+if conf.slow then
+    local received = {}
+    local hello = false
+    moon.dispatch("lua", function(msg, p)
+        local cmd, v = p.unpack(msg)
+        if cmd == "SLEEP" then
+            --block the worker, messages pile up in mailbox
+            moon.sleep(v)
+        elseif cmd == "PUSH" then
+            received[#received + 1] = v
+        elseif cmd == "CALL" then
+            moon.response("lua", msg:sender(), msg:sessionid(), v)
+        elseif cmd == "GET" then
+            moon.response("lua", msg:sender(), msg:sessionid(), received, hello)
+        end
+    end)
+
+    if conf.policy == "throttle" then
+        local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET)
+        socket.start(listenfd)
+        socket.on("message", function(_, msg)
+            hello = (msg:bytes() == "hello")
+        end)
+    end
+
+    moon.start(function()
+        moon.set_mailbox_limit(10, 5, conf.policy)
+    end)
+    return
+end
+
+local function mailbox_of(workerid, serviceid)
+    for _, v in ipairs(json.decode(moon.co_runcmd("worker." .. workerid .. ".mailbox"))) do
+        if v.serviceid == serviceid then
+            return v
+        end
+    end
+end
+
+moon.start(function()
+    moon.async(function()
+        --slow services run on another worker, sleeping must not block this one
+        local workerid = (moon.id() >> 24) % moon.workernum() + 1
+        local count = 50
+
+        do
+            local slow = moon.co_new_service("lua", {name = "test_backpressure_reject", file = "test_backpressure.lua", slow = true, policy = "reject"}, false, workerid)
+            moon.send("lua", slow, "", "SLEEP", 300)
+            moon.co_wait(50)
+            local ok, failed, finished = 0, 0, 0
+            for i = 1, count do
+                moon.async(function()
+                    local res, err = moon.co_call("lua", slow, "CALL", i)
+                    if res == i then
+                        ok = ok + 1
+                    else
+                        test_assert.equal(res, false)
+                        test_assert.assert(err:find("mailbox full"))
+                        failed = failed + 1
+                    end
+                    finished = finished + 1
+                end)
+            end
+            while finished < count do
+                moon.co_wait(50)
+            end
+            test_assert.equal(ok, 10)
+            test_assert.equal(failed, count - 10)
+            local mb = mailbox_of(workerid, slow)
+            test_assert.equal(mb.dropped, count - 10)
+            test_assert.equal(mb.congested, false)
+            moon.co_remove_service(slow)
+        end
+
+        do
+            local slow = moon.co_new_service("lua", {name = "test_backpressure_drop", file = "test_backpressure.lua", slow = true, policy = "drop_oldest"}, false, workerid)
+            moon.send("lua", slow, "", "SLEEP", 300)
+            moon.co_wait(50)
+            for i = 1, count do
+                moon.send("lua", slow, "", "PUSH", i)
+            end
+            moon.co_wait(500)
+            local expect = {}
+            for i = count - 9, count do
+                expect[#expect + 1] = i
+            end
+            test_assert.linear_table_equal(moon.co_call("lua", slow, "GET"), expect)
+            test_assert.equal(mailbox_of(workerid, slow).dropped, count - 10)
+            moon.co_remove_service(slow)
+        end
+
+        do
+            local slow = moon.co_new_service("lua", {name = "test_backpressure_throttle", file = "test_backpressure.lua", slow = true, policy = "throttle"}, false, workerid)
+            local fd = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+            test_assert.assert(fd)
+            moon.send("lua", slow, "", "SLEEP", 300)
+            moon.co_wait(50)
+            for i = 1, 200 do
+                moon.send("lua", slow, "", "PUSH", i)
+            end
+            socket.write(fd, string.pack(">H", 5) .. "hello")
+            moon.co_wait(500)
+            local received, hello = moon.co_call("lua", slow, "GET")
+            test_assert.equal(#received, 200)
+            test_assert.equal(hello, true)
+            test_assert.equal(mailbox_of(workerid, slow).dropped, 0)
+            socket.close(fd)
+            moon.co_remove_service(slow)
+        end
+
+        test_assert.success()
+    end)
+end)
@@ -0,0 +1,101 @@
+local moon = require("moon")
+local test_assert = require("test_assert")
+
+---group broadcast: only subscribers receive, sender excluded, unsubscribe stops delivery.
+---Subscribers on different workers changing the one shared payload each change their own copy.
+
+local GROUP = 7
+
+local conf = ...
+
+if conf.subscriber ~= nil then
+    local received = {}
+    local edited = {}
+    moon.dispatch("lua", function(msg, p)
+        if msg:header() == "EDIT" then
+            local view = msg:view()
+            local before = msg:bytes()
+            local buf = msg:buffer()
+            local prefix = tostring(moon.id()) .. ":"
+            moon.buffer.write_front(buf, prefix)
+            moon.buffer.write_back(buf, ":tail")
+            edited.before = before
+            edited.after = msg:bytes()
+            edited.view = view:sub(1)
+            moon.buffer.seek(buf, #prefix, moon.seek_origin.current)
+            edited.seek = msg:bytes()
+            return
+        end
+        if msg:sessionid() ~= 0 then
+            local cmd = p.unpack(msg)
+            if cmd == "UNSUB" then
+                moon.unsubscribe(GROUP)
+            elseif cmd == "EDITED" then
+                moon.response("lua", msg:sender(), msg:sessionid(), edited)
+                return
+            end
+            moon.response("lua", msg:sender(), msg:sessionid(), received)
+            return
+        end
+        test_assert.equal(msg:header(), "PUB")
+        test_assert.equal(msg:receiver(), moon.id())
+        received[#received + 1] = p.unpack(msg)
+    end)
+
+    moon.start(function()
+        if conf.subscriber then
+            moon.subscribe(GROUP)
+        end
+    end)
+    return
+end
+
+moon.dispatch("lua", function()
+    --publisher is also subscribed, must not receive its own message
+    test_assert.assert(false)
+end)
+
+moon.start(function()
+    moon.async(function()
+        test_assert.equal(moon.subscribe(GROUP), true)
+        test_assert.equal(moon.subscribe(GROUP), false)
+
+        local subscribers = {}
+        for i = 1, moon.workernum() do
+            subscribers[#subscribers + 1] = moon.co_new_service("lua", {name = "test_broadcast_sub", file = "test_broadcast.lua", subscriber = true}, false, i)
+        end
+        local other = moon.co_new_service("lua", {name = "test_broadcast_other", file = "test_broadcast.lua", subscriber = false})
+
+        moon.publish(GROUP, "lua", "PUB", "world state 1")
+        moon.publish(GROUP, "lua", "PUB", "world state 2")
+
+        for _, sid in ipairs(subscribers) do
+            test_assert.linear_table_equal(moon.co_call("lua", sid), {"world state 1", "world state 2"})
+        end
+        test_assert.linear_table_equal(moon.co_call("lua", other), {})
+
+        --every subscriber writes to the same published payload
+        local seri = require("seri")
+        local payload = seri.packs("shared payload")
+        moon.publish(GROUP, "lua", "EDIT", "shared payload")
+        for _, sid in ipairs(subscribers) do
+            local e = moon.co_call("lua", sid, "EDITED")
+            test_assert.equal(e.before, payload)
+            test_assert.equal(e.after, tostring(sid) .. ":" .. payload .. ":tail")
+            test_assert.equal(e.view, payload)
+            test_assert.equal(e.seek, payload .. ":tail")
+        end
+
+        moon.co_call("lua", subscribers[1], "UNSUB")
+        moon.publish(GROUP, "lua", "PUB", "world state 3")
+        test_assert.linear_table_equal(moon.co_call("lua", subscribers[1]), {"world state 1", "world state 2"})
+        test_assert.linear_table_equal(moon.co_call("lua", subscribers[#subscribers]), {"world state 1", "world state 2", "world state 3"})
+
+        moon.unsubscribe(GROUP)
+        for _, sid in ipairs(subscribers) do
+            moon.co_remove_service(sid)
+        end
+        moon.co_remove_service(other)
+        test_assert.success()
+    end)
+end)
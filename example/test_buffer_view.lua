@@ -0,0 +1,113 @@
+local moon = require("moon")
+local seri = require("seri")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---buffer_view: msg:view() reads payload memory without copying, results match the string library,
+---seri.unpack accepts views, views stay valid after dispatch and after more reads on the connection.
+
+local HOST = "127.0.0.1"
+local PORT = 30018
+
+local FMT = "<bBhHi3I5jJfdzs2x>I4"
+local data = string.pack(FMT, -5, 200, -30000, 60000, -700000, 0x123456789A, math.mininteger, -1,
+    1.5, 1 / 3, "zero", "prefixed", 0xDEADBEEF)
+
+local retained
+local step = 0
+
+local function check_string_api(v, s)
+    test_assert.equal(#v, #s)
+    test_assert.equal(v:size(), #s)
+    for _, r in ipairs({{1, -1}, {2, 5}, {-4, -1}, {-100, 3}, {5, 2}, {#s, #s + 10}, {0, 0}}) do
+        test_assert.equal(v:sub(r[1], r[2]), s:sub(r[1], r[2]))
+        test_assert.equal(v:slice(r[1], r[2]):sub(), s:sub(r[1], r[2]))
+        test_assert.linear_table_equal({v:byte(r[1], r[2])}, {s:byte(r[1], r[2])})
+    end
+    test_assert.equal(v:byte(), s:byte())
+    test_assert.equal(v:byte(-1), s:byte(-1))
+    for _, p in ipairs({"zero", "prefixed", "\0", "none", ""}) do
+        for _, init in ipairs({1, 10, -8, #s + 1, #s + 2}) do
+            test_assert.linear_table_equal({v:find(p, init)}, {s:find(p, init, true)})
+        end
+    end
+end
+
+moon.dispatch("lua", function(msg)
+    step = step + 1
+    local v = msg:view()
+    local a, b, c = seri.unpack(v)
+    test_assert.equal(a, "view")
+    test_assert.equal(b[3], 3)
+    test_assert.equal(c.name, "seri")
+    test_assert.equal(#v, msg:size())
+    retained = v
+end)
+
+moon.dispatch("text", function(msg)
+    step = step + 1
+    local v = msg:view()
+    check_string_api(v, data)
+    test_assert.linear_table_equal({v:unpack(FMT)}, {string.unpack(FMT, data)})
+    test_assert.linear_table_equal({v:unpack("<i2z", 4)}, {string.unpack("<i2z", data, 4)})
+    test_assert.equal(v:int(1, 1), -5)
+    test_assert.equal(v:uint(2, 1), 200)
+    test_assert.equal(v:int(3, 2), -30000)
+    test_assert.equal(v:uint(5, 2), 60000)
+    test_assert.equal(v:int(7, 3), -700000)
+    test_assert.equal(v:uint(10, 5), 0x123456789A)
+    test_assert.equal(v:int(15, 8), math.mininteger)
+    test_assert.equal(v:uint(23, 8), -1)
+    test_assert.equal(v:float(31), 1.5)
+    test_assert.equal(v:double(35), 1 / 3)
+    test_assert.equal(v:uint(-4, 4, true), 0xDEADBEEF)
+    test_assert.assert(not pcall(v.int, v, #data, 2))
+    test_assert.assert(not pcall(v.unpack, v, "<I4", #data - 2))
+    test_assert.assert(not pcall(v.unpack, v, "i9"))
+end)
+
+moon.start(function()
+    moon.async(function()
+        moon.send("lua", moon.sid(), "", "view", {1, 2, 3}, {name = "seri"})
+        moon.send("text", moon.sid(), "", data)
+        while step < 2 do
+            moon.co_wait(10)
+        end
+        --still valid after the message is gone
+        collectgarbage("collect")
+        test_assert.equal(select(3, seri.unpack(retained)).name, "seri")
+
+        local listenfd = socket.listen(HOST, PORT, moon.PTYPE_TEXT)
+        local server
+        moon.async(function()
+            server = socket.accept(listenfd, moon.sid())
+        end)
+        local fd = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+        test_assert.assert(fd)
+        while not server do
+            moon.co_wait(10)
+        end
+
+        socket.write(server, "first line\r\nsecond\r\n" .. data .. string.rep("x", 100000))
+        local first = socket.readline_view(fd, "\r\n")
+        test_assert.equal(first:sub(), "first line")
+        local second = socket.readline(fd, "\r\n")
+        test_assert.equal(second, "second")
+        local v = socket.read_view(fd, #data)
+        check_string_api(v, data)
+        --more reads reuse the connection buffer, retained views keep their bytes
+        test_assert.equal(socket.read(fd, 100000), string.rep("x", 100000))
+        socket.write(server, string.rep("y", 50000))
+        test_assert.equal(#socket.read_view(fd, 50000), 50000)
+        test_assert.equal(first:sub(), "first line")
+        test_assert.equal(v:sub(), data)
+
+        socket.close(server)
+        local ok, err = socket.read_view(fd, 10)
+        test_assert.assert(not ok and err)
+
+        socket.close(fd)
+        socket.close(listenfd)
+        test_assert.success()
+    end)
+end)
@@ -0,0 +1,109 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---connection deadlines: read timeout closes an idle connection in milliseconds and is kept
+---alive by incoming data, write timeout closes a connection whose peer does not read.
+
+local HOST = "127.0.0.1"
+local PORT = 30013
+
+local conf = ...
+
+if conf.peer then
+    local fd
+    moon.dispatch("lua", function(msg, p)
+        local cmd, v = p.unpack(msg)
+        if cmd == "CONNECT" then
+            fd = socket.sync_connect(HOST, PORT, moon.PTYPE_TEXT)
+            moon.response("lua", msg:sender(), msg:sessionid(), fd)
+        elseif cmd == "SLEEP" then
+            --block the worker, connection stops reading
+            moon.sleep(v)
+            socket.close(fd)
+        end
+    end)
+    return
+end
+
+local on_accept
+local closed = {}
+
+socket.on("accept", function(fd)
+    on_accept(fd)
+end)
+
+socket.on("error", function(fd, msg)
+    closed[fd] = {moon.now(), msg:bytes()}
+end)
+
+local function accept(f)
+    local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET)
+    socket.start(listenfd)
+    local server
+    on_accept = function(fd)
+        server = fd
+        f(fd)
+    end
+    local fd = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+    test_assert.assert(fd)
+    test_assert.wait(function() return server ~= nil end)
+    return listenfd, fd, server
+end
+
+moon.start(function()
+    moon.async(function()
+        --idle connection
+        local start
+        local listenfd, fd, server = accept(function(s)
+            start = moon.now()
+            test_assert.assert(socket.set_read_timeout(s, 100))
+        end)
+        test_assert.wait(function() return closed[server] end)
+        local elapsed = closed[server][1] - start
+        test_assert.assert(elapsed >= 90 and elapsed < 1000, elapsed)
+        test_assert.assert(string.find(closed[server][2], '"logic_errcode":3', 1, true))
+        socket.close(fd)
+        socket.close(listenfd)
+
+        --data keeps connection open
+        listenfd, fd, server = accept(function(s)
+            socket.set_read_timeout(s, 100)
+        end)
+        for _ = 1, 10 do
+            socket.write(fd, "\0\1x")
+            moon.co_wait(50)
+        end
+        test_assert.equal(closed[server], nil)
+        test_assert.wait(function() return closed[server] end)
+        test_assert.assert(closed[server])
+        socket.close(fd)
+        socket.close(listenfd)
+
+        --peer does not read
+        local chunk = string.rep("x", 30000)
+        local workerid = (moon.id() >> 24) % moon.workernum() + 1
+        local peer = moon.co_new_service("lua", {name = "test_conn_timeout_peer", file = "test_conn_timeout.lua", peer = true}, false, workerid)
+        listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET, {send_queue_limit = 256 * 1024 * 1024})
+        socket.start(listenfd)
+        server = nil
+        on_accept = function(s)
+            server = s
+        end
+        test_assert.assert(moon.co_call("lua", peer, "CONNECT") > 0)
+        test_assert.wait(function() return server ~= nil end)
+        moon.send("lua", peer, "", "SLEEP", 2000)
+        moon.co_wait(50)
+        socket.set_write_timeout(server, 200)
+        --more than loopback socket buffers can hold
+        for _ = 1, 2000 do
+            socket.write(server, chunk)
+        end
+        test_assert.wait(function() return closed[server] end)
+        test_assert.assert(string.find(closed[server][2], '"logic_errcode":5', 1, true))
+        socket.close(listenfd)
+        moon.co_remove_service(peer)
+
+        test_assert.success()
+    end)
+end)
@@ -0,0 +1,100 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---wide frame length: 32 bit and varint length prefix, large messages arrive as one frame.
+
+local HOST = "127.0.0.1"
+local PORT = 30008
+
+local sizes = {0, 1, 127, 128, 16383, 16384, 40000, 3 * 1024 * 1024}
+
+local function packet(n)
+    return string.rep(string.char(65 + n % 26), n)
+end
+
+local function varint(n)
+    local t = {}
+    repeat
+        local b = n & 0x7F
+        n = n >> 7
+        if n ~= 0 then
+            b = b | 0x80
+        end
+        t[#t + 1] = string.char(b)
+    until n == 0
+    return table.concat(t)
+end
+
+local received = {}
+local client_fd
+
+socket.on("message", function(fd, msg)
+    local data = msg:bytes()
+    received[#received + 1] = #data
+    if fd ~= client_fd then
+        --echo back with the same length format
+        socket.write(fd, data)
+    end
+end)
+
+moon.start(function()
+    moon.async(function()
+        for _, length in ipairs({"u32", "varint"}) do
+            local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET, {frame_length = length})
+            socket.start(listenfd)
+
+            local fd = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+            test_assert.assert(fd)
+            received = {}
+            local t = {}
+            for _, n in ipairs(sizes) do
+                local head = (length == "u32") and string.pack(">I4", n) or varint(n)
+                t[#t + 1] = head .. packet(n)
+            end
+            socket.write(fd, table.concat(t))
+
+            local expect = {}
+            for _, n in ipairs(sizes) do
+                --empty frames are not delivered
+                if n > 0 then
+                    expect[#expect + 1] = n
+                    local len
+                    if length == "u32" then
+                        len = string.unpack(">I4", socket.read(fd, 4))
+                    else
+                        len = 0
+                        local shift = 0
+                        repeat
+                            local b = string.byte(socket.read(fd, 1))
+                            len = len | ((b & 0x7F) << shift)
+                            shift = shift + 7
+                        until b & 0x80 == 0
+                    end
+                    test_assert.equal(len, expect[#expect])
+                    test_assert.equal(socket.read(fd, len), packet(len))
+                end
+            end
+            test_assert.linear_table_equal(received, expect)
+            socket.close(fd)
+            socket.close(listenfd)
+        end
+
+        --client side option
+        local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET, {frame_length = "u32"})
+        socket.start(listenfd)
+        local fd = socket.connect(HOST, PORT, moon.PTYPE_SOCKET, 0, {frame_length = "u32"})
+        test_assert.assert(fd)
+        client_fd = fd
+        received = {}
+        socket.write(fd, packet(100000))
+        while #received < 2 do
+            moon.co_wait(10)
+        end
+        --server echo and client receive, both one frame
+        test_assert.linear_table_equal(received, {100000, 100000})
+        socket.close(fd)
+        socket.close(listenfd)
+        test_assert.success()
+    end)
+end)
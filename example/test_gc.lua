@@ -0,0 +1,103 @@
+local moon = require("moon")
+local json = require("json")
+local test_assert = require("test_assert")
+
+---gc policy: gcmode "idle" services are collected by their worker when it has no messages,
+---garbage left after the last message goes away without more messages. gc time and steps
+---of each service, in dispatch or idle, are reported by worker.N.gc. Modes lua 5.3 does not
+---have are init errors.
+
+local WORKER = 3
+
+local conf = ...
+
+if conf.peer then
+    local garbage
+    moon.dispatch("lua", function(msg, p)
+        local cmd = p.unpack(msg)
+        if cmd == "ALLOC" then
+            garbage = {}
+            for i = 1, 200000 do
+                garbage[i] = {i, tostring(i)}
+            end
+        elseif cmd == "DROP" then
+            garbage = nil
+        elseif cmd == "GCERR" then
+            --the finalizer error is raised out of the collector step
+            setmetatable({}, {__gc = function() error("test_gc finalizer error") end})
+            local ok = pcall(collectgarbage, "collect")
+            assert(not ok)
+        elseif cmd == "STEP" then
+            collectgarbage("step")
+        end
+        moon.response("lua", msg:sender(), msg:sessionid(), moon.memory_use())
+    end)
+    return
+end
+
+local function gc_stat(serviceid)
+    for _, v in ipairs(json.decode(moon.co_runcmd("worker." .. WORKER .. ".gc"))) do
+        if v.serviceid == serviceid then
+            return v
+        end
+    end
+end
+
+local function new_peer(name, opt)
+    opt.name = name
+    opt.file = "test_gc.lua"
+    opt.peer = true
+    return moon.co_new_service("lua", opt, false, WORKER)
+end
+
+moon.start(function()
+    moon.async(function()
+        local idle = new_peer("test_gc_idle", {gcmode = "idle", gcpause = 400})
+        local normal = new_peer("test_gc_normal", {gcpause = 400, gcstepmul = 400})
+        test_assert.assert(idle > 0 and normal > 0)
+        test_assert.equal(new_peer("test_gc_generational", {gcmode = "generational"}), 0)
+        test_assert.equal(new_peer("test_gc_unknown", {gcmode = "unknown"}), 0)
+
+        local peak = moon.co_call("lua", idle, "ALLOC")
+        moon.co_call("lua", normal, "ALLOC")
+        test_assert.assert(peak > 10 * 1024 * 1024)
+        moon.co_call("lua", idle, "DROP")
+        moon.co_call("lua", normal, "DROP")
+
+        local stat
+        for _ = 1, 100 do
+            moon.co_wait(20)
+            stat = gc_stat(idle)
+            if stat.memory < peak / 2 and stat.gc_cycles > 0 then
+                break
+            end
+        end
+        test_assert.equal(stat.name, "test_gc_idle")
+        test_assert.equal(stat.idle_gc, true)
+        test_assert.assert(stat.memory < peak / 2)
+        test_assert.assert(stat.gc_steps > 0 and stat.gc_cycles > 0 and stat.gc_time_us >= 0)
+
+        --steps taken by the collector while handling ALLOC are counted, after DROP no messages, nothing collects it
+        local nstat = gc_stat(normal)
+        test_assert.equal(nstat.idle_gc, false)
+        test_assert.assert(nstat.gc_steps > 0 and nstat.gc_time_us > 0)
+        test_assert.assert(nstat.memory > peak / 2)
+        moon.co_wait(50)
+        test_assert.equal(gc_stat(normal).gc_steps, nstat.gc_steps)
+
+        --after a finished cycle an idle service is left alone until it has new garbage
+        local steps = stat.gc_steps
+        moon.co_wait(100)
+        test_assert.equal(gc_stat(idle).gc_steps, steps)
+
+        --a __gc error leaves step timing working
+        moon.co_call("lua", normal, "GCERR")
+        steps = gc_stat(normal).gc_steps
+        moon.co_call("lua", normal, "STEP")
+        test_assert.assert(gc_stat(normal).gc_steps > steps, "gc steps stopped after a __gc error")
+
+        moon.co_remove_service(idle)
+        moon.co_remove_service(normal)
+        test_assert.success()
+    end)
+end)
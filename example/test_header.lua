@@ -0,0 +1,55 @@
+local moon = require("moon")
+local seri = require("seri")
+local test_assert = require("test_assert")
+
+---interned message header: send by id, dispatch on integer id. Headers sent as string are found by
+---header_id() on the receiver, ad-hoc and long headers keep working.
+
+local LOGIN = moon.intern_header("LOGIN")
+local LOGOUT = moon.intern_header("LOGOUT")
+local long_header = string.rep("h", 100)
+
+local expect = {
+    {LOGIN, "LOGIN"},
+    {LOGOUT, "LOGOUT"},
+    {0, "adhoc"},
+    {0, long_header},
+    {LOGIN, "LOGIN"},
+    {LOGIN, "LOGIN"},
+    {LOGOUT, "LOGOUT"},
+}
+
+local handlers = {
+    [LOGIN] = function(v) test_assert.equal(v, 1) end,
+    [LOGOUT] = function(v) test_assert.equal(v, 2) end,
+}
+
+local n = 0
+moon.dispatch("lua", function(msg, p)
+    n = n + 1
+    local id, header = table.unpack(expect[n])
+    test_assert.equal(msg:header_id(), id)
+    test_assert.equal(msg:header(), header)
+    local f = handlers[msg:header_id()]
+    if f then
+        f(p.unpack(msg))
+    end
+    if n == #expect then
+        test_assert.success()
+    end
+end)
+
+moon.start(function()
+    test_assert.less(0, LOGIN)
+    test_assert.equal(moon.intern_header("LOGIN"), LOGIN)
+    test_assert.assert(LOGOUT ~= LOGIN)
+
+    moon.send("lua", moon.id(), "LOGIN", 1)
+    moon.send("lua", moon.id(), "LOGOUT", 2)
+    moon.send("lua", moon.id(), "adhoc", 3)
+    moon.send("lua", moon.id(), long_header, 4)
+    moon.send("lua", moon.id(), "LOGIN", 1)
+    moon.send("lua", moon.id(), LOGIN, 1)
+    moon.raw_send("lua", moon.id(), LOGOUT, seri.pack(2))
+    test_assert.assert(not pcall(moon.send, "lua", moon.id(), 60000, 0))
+end)
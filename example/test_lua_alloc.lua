@@ -0,0 +1,134 @@
+local moon = require("moon")
+local test_assert = require("test_assert")
+
+---lua VM allocator: small blocks come from size class pages that are given back after the
+---objects are collected, big blocks are counted apart, memlimit accounting is unchanged.
+---An idle service holds few pages, RSS per service stays close to its heap size.
+
+local conf = ...
+
+if conf.limited then
+    moon.dispatch("lua", function(msg)
+        local ok = pcall(function()
+            local t = {}
+            for i = 1, 1000000 do
+                t[i] = {i}
+            end
+        end)
+        collectgarbage("collect")
+        moon.response("lua", msg:sender(), msg:sessionid(), ok, moon.memory_use())
+    end)
+    return
+end
+
+if conf.idle then
+    moon.dispatch("lua", function(msg)
+        moon.response("lua", msg:sender(), msg:sessionid(), moon.memory_use(true))
+    end)
+    return
+end
+
+--nil when /proc is not there
+local function rss()
+    local f = io.open("/proc/self/statm")
+    if not f then
+        return nil
+    end
+    local _, resident = f:read("a"):match("(%d+)%s+(%d+)")
+    f:close()
+    return tonumber(resident) * 4096
+end
+
+local function pages(detail, size)
+    for _, c in ipairs(detail.classes) do
+        if c.size == size then
+            return c.pages, c.blocks
+        end
+    end
+    return 0, 0
+end
+
+moon.start(function()
+    moon.async(function()
+        local N = 100
+        local ids = {}
+        local rss_before = rss()
+        for i = 1, N do
+            ids[i] = moon.co_new_service("lua", {name = "test_lua_alloc_idle" .. i, file = "test_lua_alloc.lua", idle = true})
+            test_assert.assert(ids[i] > 0)
+        end
+        local rss_after = rss()
+        local fresh = moon.co_call("lua", ids[N])
+        --partly used pages cost less than the data in them
+        test_assert.assert(fresh.page_bytes < 2 * (fresh.total - fresh.large_bytes))
+        if rss_before then
+            --about 130K with plain malloc
+            test_assert.less_equal((rss_after - rss_before) / N, 200 * 1024)
+        end
+        for i = 1, N do
+            moon.co_remove_service(ids[i])
+        end
+
+        collectgarbage("collect")
+        local base = moon.memory_use(true)
+        test_assert.equal(math.type(moon.memory_use()), "integer")
+        test_assert.assert(base.total > 0 and base.page_bytes > 0)
+        local total_blocks = 0
+        for _, c in ipairs(base.classes) do
+            test_assert.assert(c.size % 16 == 0 and c.size <= 256)
+            test_assert.assert(c.pages > 0)
+            total_blocks = total_blocks + c.blocks
+        end
+        test_assert.assert(total_blocks > 0)
+
+        --a spike of small objects
+        local t = {}
+        for i = 1, 200000 do
+            t[i] = {i, i + 1}
+        end
+        local spike = moon.memory_use(true)
+        test_assert.assert(spike.page_bytes > base.page_bytes + 8 * 1024 * 1024)
+        --the array part of t is a big block
+        test_assert.assert(spike.large_bytes > base.large_bytes + 200000 * 16)
+        local p = pages(spike, 32)
+        test_assert.assert(p > pages(base, 32))
+
+        t = nil
+        collectgarbage("collect")
+        collectgarbage("collect")
+        local after = moon.memory_use(true)
+        --pages are given back
+        test_assert.assert(after.page_bytes < base.page_bytes + 1024 * 1024)
+        test_assert.assert(after.large_bytes < base.large_bytes + 1024 * 1024)
+        test_assert.assert(math.abs(after.total - base.total) < 1024 * 1024)
+
+        --strings and reallocs across classes keep their content
+        local s = {}
+        for i = 1, 600 do
+            s[i] = string.rep(string.char(65 + i % 26), i)
+        end
+        for i = 1, 600 do
+            test_assert.equal(#s[i], i)
+            test_assert.equal(s[i]:byte(i), 65 + i % 26)
+        end
+        local grow = {}
+        for i = 1, 10000 do
+            grow[i] = i
+            grow["k" .. i] = i
+        end
+        for i = 1, 10000 do
+            test_assert.equal(grow[i], i)
+            test_assert.equal(grow["k" .. i], i)
+        end
+
+        --memlimit still stops a service
+        local limited = moon.co_new_service("lua", {name = "test_lua_alloc_limited", file = "test_lua_alloc.lua", limited = true, memlimit = 4 * 1024 * 1024})
+        test_assert.assert(limited > 0)
+        local ok, used = moon.co_call("lua", limited, "ALLOC")
+        test_assert.equal(ok, false)
+        test_assert.assert(used < 4 * 1024 * 1024)
+        moon.co_remove_service(limited)
+
+        test_assert.success()
+    end)
+end)
@@ -0,0 +1,67 @@
+local moon = require("moon")
+local json = require("json")
+local test_assert = require("test_assert")
+
+---per-service mailbox: a flooding sender must not delay other services on the same worker
+---more than one turn budget.
+
+local conf = ...
+
+if conf.flood then
+    local n = 0
+    moon.dispatch("lua", function(msg, p)
+        local sender, total = p.unpack(msg)
+        n = n + 1
+        if n == total then
+            moon.send("lua", sender, "DONE")
+        end
+    end)
+    return
+end
+
+if conf.ping then
+    moon.dispatch("lua", function(msg)
+        moon.response("lua", msg:sender(), msg:sessionid(), "PONG")
+    end)
+    return
+end
+
+local count = 5000
+local done = false
+
+moon.dispatch("lua", function(msg)
+    if msg:header() == "DONE" then
+        done = true
+    end
+end)
+
+moon.start(function()
+    moon.async(function()
+        local workerid = moon.workernum()
+        local flood = moon.co_new_service("lua", {name = "test_mailbox_flood", file = "test_mailbox.lua", flood = true}, false, workerid)
+        local ping = moon.co_new_service("lua", {name = "test_mailbox_ping", file = "test_mailbox.lua", ping = true}, false, workerid)
+
+        for _ = 1, count do
+            moon.send("lua", flood, "", moon.id(), count)
+        end
+
+        test_assert.equal(moon.co_call("lua", ping), "PONG")
+        --ping got its turn before flood service handled all messages
+        test_assert.equal(done, false)
+
+        local stat = json.decode(moon.co_runcmd("worker." .. workerid .. ".mailbox"))
+        test_assert.equal(type(stat), "table")
+        for _, v in ipairs(stat) do
+            test_assert.equal(type(v.depth), "number")
+            test_assert.equal(type(v.max_wait_us), "number")
+        end
+
+        while not done do
+            moon.co_wait(10)
+        end
+
+        moon.co_remove_service(flood)
+        moon.co_remove_service(ping)
+        test_assert.success()
+    end)
+end)
@@ -46,6 +46,121 @@ local test_case =
         name = "test_http",
         file = "test_http.lua"
     }
+    ,
+    {
+        name = "test_steal",
+        file = "test_steal.lua"
+    }
+    ,
+    {
+        name = "test_mailbox",
+        file = "test_mailbox.lua"
+    }
+    ,
+    {
+        name = "test_timer",
+        file = "test_timer.lua"
+    }
+    ,
+    {
+        name = "test_broadcast",
+        file = "test_broadcast.lua"
+    }
+    ,
+    {
+        name = "test_alloc",
+        file = "test_alloc.lua"
+    }
+    ,
+    {
+        name = "test_header",
+        file = "test_header.lua"
+    }
+    ,
+    {
+        name = "test_send_many",
+        file = "test_send_many.lua"
+    }
+    ,
+    {
+        name = "test_backpressure",
+        file = "test_backpressure.lua"
+    }
+    ,
+    {
+        name = "test_send_coalesce",
+        file = "test_send_coalesce.lua"
+    }
+    ,
+    {
+        name = "test_recv_frames",
+        file = "test_recv_frames.lua"
+    }
+    ,
+    {
+        name = "test_frame_length",
+        file = "test_frame_length.lua"
+    }
+    ,
+    {
+        name = "test_reuseport",
+        file = "test_reuseport.lua"
+    }
+    ,
+    {
+        name = "test_udp",
+        file = "test_udp.lua"
+    }
+    ,
+    {
+        name = "test_send_queue",
+        file = "test_send_queue.lua"
+    }
+    ,
+    {
+        name = "test_conn_timeout",
+        file = "test_conn_timeout.lua"
+    }
+    ,
+    {
+        name = "test_ws_deflate",
+        file = "test_ws_deflate.lua"
+    }
+    ,
+    {
+        name = "test_ws_frames",
+        file = "test_ws_frames.lua"
+    }
+    ,
+    {
+        name = "test_ws_client",
+        file = "test_ws_client.lua"
+    }
+    ,
+    {
+        name = "test_seri",
+        file = "test_seri.lua"
+    }
+    ,
+    {
+        name = "test_buffer_view",
+        file = "test_buffer_view.lua"
+    }
+    ,
+    {
+        name = "test_sharetable",
+        file = "test_sharetable.lua"
+    }
+    ,
+    {
+        name = "test_lua_alloc",
+        file = "test_lua_alloc.lua"
+    }
+    ,
+    {
+        name = "test_gc",
+        file = "test_gc.lua"
+    }
 }
 
 local next_case = function ()
@@ -0,0 +1,61 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---receive path: many frames in one read, frames split across reads and continued frames
+---must be delivered complete and in order.
+
+local HOST = "127.0.0.1"
+local PORT = 30007
+local COUNT = 500
+
+local function packet(i)
+    if i % 7 == 0 then
+        return string.rep(string.char(65 + i % 26), 9000)
+    end
+    return string.format("%d:", i) .. string.rep("x", 20 + i % 60)
+end
+
+local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET)
+socket.start(listenfd)
+
+local received = 0
+local big = string.rep("b", 40000)
+
+socket.on("accept", function(fd)
+    socket.set_enable_frame(fd, "r")
+end)
+
+socket.on("message", function(fd, msg)
+    received = received + 1
+    if received <= COUNT then
+        test_assert.equal(msg:bytes(), packet(received))
+    else
+        --continued frames joined into one message
+        test_assert.equal(msg:bytes(), big)
+        socket.close(fd)
+    end
+end)
+
+moon.start(function()
+    moon.async(function()
+        local fd = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+        test_assert.assert(fd)
+        local t = {}
+        for i = 1, COUNT do
+            local p = packet(i)
+            t[#t + 1] = string.pack(">H", #p) .. p
+        end
+        --continued frames: high bit of length marks more to come
+        t[#t + 1] = string.pack(">H", 0x8000 | 30000) .. big:sub(1, 30000)
+        t[#t + 1] = string.pack(">H", 10000) .. big:sub(30001)
+        socket.write(fd, table.concat(t))
+
+        while received <= COUNT do
+            moon.co_wait(10)
+        end
+        test_assert.equal(received, COUNT + 1)
+        socket.close(listenfd)
+        test_assert.success()
+    end)
+end)
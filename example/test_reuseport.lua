@@ -0,0 +1,88 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---SO_REUSEPORT listen: socket.co_listen_workers starts one acceptor service per selected worker on the
+---same port, every connection is handled by the worker whose acceptor took it.
+
+local HOST = "127.0.0.1"
+local PORT = 30009
+local COUNT = 200
+
+local conf = ...
+
+if conf.acceptor then
+    if conf.fail_on == (moon.id() >> 24) then
+        error("test_reuseport acceptor refuses to start")
+    end
+
+    local accepted = 0
+    local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET, {reuseport = true})
+    assert(listenfd ~= 0, "listen failed")
+    socket.start(listenfd)
+
+    socket.on("accept", function(fd)
+        --fd carries id of the worker that owns the connection
+        test_assert.equal(fd >> 16, moon.id() >> 24)
+        accepted = accepted + 1
+    end)
+
+    moon.dispatch("lua", function(msg, p)
+        moon.response("lua", msg:sender(), msg:sessionid(), accepted)
+    end)
+
+    moon.destroy(function()
+        socket.close(listenfd)
+    end)
+    return
+end
+
+local function acceptor_conf(fail_on)
+    return {name = "test_reuseport_acceptor", file = "test_reuseport.lua", acceptor = true, fail_on = fail_on}
+end
+
+moon.start(function()
+    moon.async(function()
+        local num = moon.workernum()
+
+        --bad worker lists and a failing acceptor leave no services behind
+        local res, err = socket.co_listen_workers(acceptor_conf(), {num + 1})
+        test_assert.assert(not res and err)
+        res, err = socket.co_listen_workers(acceptor_conf(2), {1, 2})
+        test_assert.assert(not res and err)
+
+        local acceptors = socket.co_listen_workers(acceptor_conf())
+        test_assert.equal(#acceptors, num)
+        for i, sid in ipairs(acceptors) do
+            test_assert.equal(sid >> 24, i)
+        end
+
+        local fds = {}
+        for i = 1, COUNT do
+            fds[i] = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+            test_assert.assert(fds[i])
+        end
+        moon.co_wait(100)
+
+        local total, used = 0, 0
+        for _, sid in ipairs(acceptors) do
+            local n = moon.co_call("lua", sid)
+            total = total + n
+            if n > 0 then
+                used = used + 1
+            end
+        end
+        --only connections to these acceptors, the one left on worker 1 by the failed call was removed
+        test_assert.equal(total, COUNT)
+        --kernel hashes the 4-tuple, some spread is expected
+        test_assert.less_equal(2, used)
+
+        for _, fd in ipairs(fds) do
+            socket.close(fd)
+        end
+        for _, sid in ipairs(acceptors) do
+            moon.co_remove_service(sid)
+        end
+        test_assert.success()
+    end)
+end)
@@ -0,0 +1,42 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---send path: a burst of small packets coalesced in connection send arena,
+---interleaved with large packets written by reference, must arrive complete and in order.
+
+local HOST = "127.0.0.1"
+local PORT = 30006
+local COUNT = 190
+
+local function packet(i)
+    if i % 7 == 0 then
+        return string.rep(string.char(65 + i % 26), 2000)
+    end
+    return string.format("%d:", i) .. string.rep("x", 20 + i % 60)
+end
+
+local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET)
+socket.start(listenfd)
+
+socket.on("accept", function(fd)
+    for i = 1, COUNT do
+        socket.write(fd, packet(i))
+    end
+end)
+
+moon.start(function()
+    moon.async(function()
+        local fd = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+        test_assert.assert(fd)
+        for i = 1, COUNT do
+            local data = socket.read(fd, 2)
+            local len = string.unpack(">H", data)
+            data = socket.read(fd, len)
+            test_assert.equal(data, packet(i))
+        end
+        socket.close(fd)
+        socket.close(listenfd)
+        test_assert.success()
+    end)
+end)
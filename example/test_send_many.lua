@@ -0,0 +1,52 @@
+local moon = require("moon")
+local test_assert = require("test_assert")
+
+---send_many: receivers on every worker get every message once, in send order, with shared payload.
+
+local conf = ...
+
+if conf.receiver then
+    local received = {}
+    moon.dispatch("lua", function(msg, p)
+        if msg:sessionid() ~= 0 then
+            moon.response("lua", msg:sender(), msg:sessionid(), received)
+            return
+        end
+        test_assert.equal(msg:header(), "MANY")
+        test_assert.equal(msg:receiver(), moon.id())
+        local n, payload = p.unpack(msg)
+        test_assert.equal(payload, string.rep("x", 100))
+        received[#received + 1] = n
+    end)
+    return
+end
+
+local count = 100
+
+moon.start(function()
+    moon.async(function()
+        local receivers = {}
+        for i = 1, moon.workernum() do
+            for _ = 1, 2 do
+                receivers[#receivers + 1] = moon.co_new_service("lua", {name = "test_send_many_recv", file = "test_send_many.lua", receiver = true}, false, i)
+            end
+        end
+
+        local expect = {}
+        for i = 1, count do
+            moon.send_many("lua", receivers, "MANY", i, string.rep("x", 100))
+            expect[i] = i
+        end
+
+        for _, sid in ipairs(receivers) do
+            test_assert.linear_table_equal(moon.co_call("lua", sid), expect)
+        end
+
+        moon.send_many("lua", {}, "MANY", 0)
+
+        for _, sid in ipairs(receivers) do
+            moon.co_remove_service(sid)
+        end
+        test_assert.success()
+    end)
+end)
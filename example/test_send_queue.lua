@@ -0,0 +1,107 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---send queue limit by bytes: "close" closes a slow connection, "drop" discards droppable buffers
+---and keeps the rest in order, "notify" reports high and low to the owner.
+
+local HOST = "127.0.0.1"
+local PORT = 30012
+local LIMIT = 64 * 1024
+local CHUNK = string.rep("x", 4000)
+
+local server = {}
+local received = {}
+local events = {}
+local writer
+
+socket.on("accept", function(fd)
+    server[fd] = true
+    writer(fd)
+end)
+
+socket.on("message", function(fd, msg)
+    if not server[fd] then
+        received[#received + 1] = msg:bytes()
+    end
+end)
+
+socket.on("error", function(fd, msg)
+    if server[fd] then
+        events[#events + 1] = msg:bytes()
+    end
+end)
+
+socket.on("send_queue", function(fd, msg)
+    test_assert.assert(server[fd])
+    events[#events + 1] = msg:header()
+end)
+
+local function run(policy, f, check)
+    local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET, {send_queue_limit = LIMIT, send_queue_policy = policy})
+    socket.start(listenfd)
+    received = {}
+    events = {}
+    writer = f
+    local fd = socket.connect(HOST, PORT, moon.PTYPE_SOCKET)
+    test_assert.assert(fd)
+    check(fd)
+    socket.close(fd)
+    socket.close(listenfd)
+end
+
+moon.start(function()
+    moon.async(function()
+        --client does not read fast enough to matter, queue grows in one callback
+        run("close", function(fd)
+            for _ = 1, 100 do
+                if not socket.write(fd, CHUNK) then
+                    break
+                end
+            end
+        end, function()
+            test_assert.wait(function() return #events > 0 end)
+            test_assert.assert(string.find(events[1], '"logic_errcode":4', 1, true))
+        end)
+
+        run("drop", function(fd)
+            for i = 1, 100 do
+                if i % 10 == 0 then
+                    socket.write(fd, "critical" .. i)
+                else
+                    socket.write_droppable(fd, CHUNK)
+                end
+            end
+            test_assert.less(socket.queued_bytes(fd), LIMIT)
+            socket.write(fd, "end")
+        end, function()
+            test_assert.wait(function() return received[#received] == "end" end)
+            local critical = {}
+            for _, v in ipairs(received) do
+                if v ~= CHUNK then
+                    critical[#critical + 1] = v
+                end
+            end
+            test_assert.equal(#critical, 11)
+            for i = 1, 10 do
+                test_assert.equal(critical[i], "critical" .. (i * 10))
+            end
+            test_assert.less(#received, 100)
+            test_assert.equal(#events, 0)
+        end)
+
+        run("notify", function(fd)
+            for _ = 1, 30 do
+                test_assert.assert(socket.write(fd, CHUNK))
+            end
+            test_assert.less_equal(LIMIT, socket.queued_bytes(fd))
+        end, function()
+            test_assert.wait(function() return #events == 2 end)
+            test_assert.linear_table_equal(events, {"high", "low"})
+            test_assert.wait(function() return #received == 30 end)
+            test_assert.equal(#received, 30)
+        end)
+
+        test_assert.success()
+    end)
+end)
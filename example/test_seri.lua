@@ -0,0 +1,116 @@
+local moon = require("moon")
+local seri = require("seri")
+local test_assert = require("test_assert")
+
+---seri: pack/packs keep the tagged encoding older peers read. pack_typed/packs_typed write arrays of
+---one element type as typed arrays. Round trips must give back equal values for both, unpack reads both.
+
+local function deep_equal(a, b)
+    if type(a) ~= type(b) then
+        return false
+    end
+    if type(a) ~= "table" then
+        if a ~= a and b ~= b then
+            return true
+        end
+        return a == b and math.type(a) == math.type(b)
+    end
+    for k, v in pairs(a) do
+        if not deep_equal(v, b[k]) then
+            return false
+        end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then
+            return false
+        end
+    end
+    return true
+end
+
+local function roundtrip(...)
+    local n = select("#", ...)
+    local args = {...}
+    for _, packs in ipairs({seri.packs, seri.packs_typed}) do
+        local res = table.pack(seri.unpack(packs(...)))
+        test_assert.equal(res.n, n)
+        for i = 1, n do
+            test_assert.assert(deep_equal(res[i], args[i]))
+        end
+    end
+end
+
+local function range(n, f)
+    local t = {}
+    for i = 1, n do
+        t[i] = f(i)
+    end
+    return t
+end
+
+moon.start(function()
+    local bytes = range(100, function(i) return i % 256 end)
+    local words = range(100, function(i) return i * 600 end)
+    local dwords = range(100, function(i) return i * 100000 - 5000000 end)
+    local qwords = range(100, function(i) return i * 0x100000000 end)
+    local reals = range(100, function(i) return i / 3 end)
+    local shorts = range(100, function(i) return string.rep("s", i) end)
+    local longs = range(10, function(i) return string.rep("l", 250 + i * 10) end)
+
+    roundtrip(bytes, words, dwords, qwords, reals, shorts, longs)
+    roundtrip({math.maxinteger, math.mininteger, 0, -1, 255, 256, 65535, 65536, 0x7FFFFFFF, -0x80000000})
+    roundtrip(range(10, function() return 0.0 end), {1/0, -1/0, 0.5, 1, 2, 3, 4, 5, 6, 7})
+    roundtrip(range(10, function() return "" end), range(40, function(i) return i end))
+
+    --typed arrays are smaller than tagged elements
+    test_assert.assert(#seri.packs_typed(words) < #seri.packs(words))
+    test_assert.assert(#seri.packs_typed(dwords) < #seri.packs(dwords))
+    test_assert.assert(#seri.packs_typed(reals) < #seri.packs(reals))
+
+    --not typed: mixed, sparse, with hash part, short, integer and float mixed
+    local mixed = range(20, function(i) return (i % 2 == 0) and i or tostring(i) end)
+    local sparse = range(20, function(i) return i end)
+    sparse[10] = nil
+    local hashed = range(20, function(i) return i end)
+    hashed.name = "hashed"
+    local numbers = range(20, function(i) return i end)
+    numbers[5] = 5.5
+    roundtrip(mixed, sparse, hashed, {1, 2, 3}, numbers, {})
+    test_assert.equal(#seri.packs_typed(mixed), #seri.packs(mixed))
+
+    --nested records with typed array fields
+    local records = range(50, function(i)
+        return {id = i, name = "player" .. i, items = range(16, function(j) return i * j end), pos = {x = i / 2, y = -i / 2}}
+    end)
+    roundtrip(records, {records = records, ok = true}, nil, false, "tail")
+    --many small typed arrays
+    roundtrip(range(300, function(i) return range(10, function(j) return i * j end) end))
+
+    --__pairs tables are packed through __pairs
+    local proxy = setmetatable({}, {__pairs = function()
+        return next, bytes, nil
+    end})
+    test_assert.assert(deep_equal(seri.unpack(seri.packs_typed(proxy)), bytes))
+    local r1, r2 = seri.unpack(seri.packs_typed({proxy, dwords}, reals))
+    test_assert.assert(deep_equal(r1, {bytes, dwords}))
+    test_assert.assert(deep_equal(r2, reals))
+
+    --truncated typed array must not be readable
+    local data = seri.packs_typed(dwords)
+    test_assert.assert(not pcall(seri.unpack, data:sub(1, #data - 1)))
+
+    --seri.pack and seri.pack_typed buffers through messages
+    moon.send("lua", moon.sid(), "", records, shorts)
+    moon.raw_send("lua", moon.sid(), "", seri.pack_typed(records, shorts))
+end)
+
+local received = 0
+moon.dispatch("lua", function(msg, p)
+    local r, s = p.unpack(msg)
+    test_assert.assert(deep_equal(r[50].items, range(16, function(j) return 50 * j end)))
+    test_assert.equal(s[100], string.rep("s", 100))
+    received = received + 1
+    if received == 2 then
+        test_assert.success()
+    end
+end)
@@ -0,0 +1,193 @@
+local moon = require("moon")
+local json = require("json")
+local sharetable = require("sharetable")
+local codecache = require("codecache")
+local test_assert = require("test_assert")
+
+---sharetable: tables loaded once in one service are read by other services through read only proxies,
+---proxies behave like the original table for index, #, pairs and copy. Reloading a name does not
+---change proxies already queried.
+
+local conf = ...
+
+local function deep_equal(a, b)
+    if type(a) ~= type(b) then
+        return false
+    end
+    if type(a) ~= "table" then
+        return a == b and math.type(a) == math.type(b)
+    end
+    for k, v in pairs(a) do
+        if not deep_equal(v, b[k]) then
+            return false
+        end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then
+            return false
+        end
+    end
+    return true
+end
+
+local function proxy_pairs(t)
+    local r = {}
+    for k, v in pairs(t) do
+        r[k] = (type(v) == "userdata") and sharetable.copy(v) or v
+    end
+    return r
+end
+
+if conf.peer then
+    moon.dispatch("lua", function(msg, p)
+        local name = p.unpack(msg)
+        local t = sharetable.query(name)
+        local res = {}
+        if t then
+            res.copy = sharetable.copy(t)
+            res.pairs = proxy_pairs(t)
+            res.len = #t
+        end
+        moon.response("lua", msg:sender(), msg:sessionid(), res)
+    end)
+    return
+end
+
+local items = {}
+for i = 1, 100 do
+    items[i] = {id = 1000 + i, name = "item" .. i, price = i * 1.5, tags = {"a", "b", i}}
+end
+
+local source = {
+    items = items,
+    [-1] = "negative",
+    [0] = "zero",
+    [1000000] = "far",
+    enabled = true,
+    disabled = false,
+    nested = {a = {b = {c = {d = "deep"}}}},
+    [1] = "first",
+    [2] = "second",
+}
+
+local jsonstr = [=[
+{
+    "name": "config",
+    "version": 3,
+    "ratio": 0.25,
+    "big": 9007199254740993,
+    "list": [1, 2.5, "three", null, {"k": "v"}, [true, false]],
+    "skip": null,
+    "unicode": "中文"
+}
+]=]
+
+moon.start(function()
+    moon.async(function()
+        test_assert.assert(sharetable.loadtable("test_sharetable_lua", source))
+        test_assert.assert(sharetable.loadstring("test_sharetable_json", jsonstr))
+        test_assert.assert(sharetable.loadfile("test_sharetable_file", "config.json"))
+
+        --errors are returned, not raised
+        local ok, err = sharetable.loadstring("test_sharetable_bad", "{\"a\":")
+        test_assert.assert(not ok and err)
+        ok, err = sharetable.loadstring("test_sharetable_bad", "1")
+        test_assert.assert(not ok and err)
+        ok, err = sharetable.loadtable("test_sharetable_bad", {f = print})
+        test_assert.assert(not ok and err)
+        ok, err = sharetable.loadtable("test_sharetable_bad", {[1.5] = 1})
+        test_assert.assert(not ok and err)
+        ok, err = sharetable.loadfile("test_sharetable_bad", "not_exist.json")
+        test_assert.assert(not ok and err)
+        test_assert.equal(sharetable.query("test_sharetable_bad"), nil)
+
+        local t = sharetable.query("test_sharetable_lua")
+        test_assert.equal(#t, 2)
+        test_assert.equal(t[1], "first")
+        test_assert.equal(t[2.0], "second")
+        test_assert.equal(t[-1], "negative")
+        test_assert.equal(t[0], "zero")
+        test_assert.equal(t[1000000], "far")
+        test_assert.equal(t.enabled, true)
+        test_assert.equal(t.disabled, false)
+        test_assert.equal(t.none, nil)
+        test_assert.equal(t[3], nil)
+        test_assert.equal(t.nested.a.b.c.d, "deep")
+        test_assert.equal(t.items, t.items)
+        test_assert.equal(#t.items, 100)
+        test_assert.equal(t.items[50].name, "item50")
+        test_assert.equal(math.type(t.items[50].id), "integer")
+        test_assert.equal(t.items[3].price, 4.5)
+        test_assert.equal(t.items[100].tags[3], 100)
+        test_assert.assert(deep_equal(sharetable.copy(t), source))
+        test_assert.assert(deep_equal(proxy_pairs(t), source))
+        test_assert.assert(not pcall(function() t.enabled = false end))
+        local n = 0
+        for i, v in ipairs(t.items) do
+            n = n + 1
+            test_assert.equal(v.id, 1000 + i)
+        end
+        test_assert.equal(n, 100)
+
+        local j = sharetable.query("test_sharetable_json")
+        local decoded = json.decode(jsonstr)
+        test_assert.equal(j.name, "config")
+        test_assert.equal(math.type(j.version), "integer")
+        test_assert.equal(j.big, 9007199254740993)
+        test_assert.equal(j.ratio, 0.25)
+        test_assert.equal(j.unicode, decoded.unicode)
+        test_assert.equal(j.skip, nil)
+        test_assert.equal(#j.list, 6)
+        test_assert.equal(j.list[4], nil)
+        test_assert.equal(j.list[5].k, "v")
+        test_assert.equal(j.list[6][2], false)
+        local keys = 0
+        for _ in pairs(j.list) do
+            keys = keys + 1
+        end
+        test_assert.equal(keys, 5)
+
+        local f = sharetable.query("test_sharetable_file")
+        test_assert.equal(f[1].sid, 1)
+
+        --another service reads the same data
+        local stats = codecache.stats()
+        local peer = moon.co_new_service("lua", {name = "test_sharetable_peer", file = "test_sharetable.lua", peer = true})
+        test_assert.assert(peer > 0)
+        local res = moon.co_call("lua", peer, "test_sharetable_lua")
+        test_assert.equal(res.len, 2)
+        test_assert.assert(deep_equal(res.copy, source))
+        test_assert.assert(deep_equal(res.pairs, source))
+        res = moon.co_call("lua", peer, "test_sharetable_json")
+        test_assert.assert(deep_equal(res.copy, sharetable.copy(j)))
+        res = moon.co_call("lua", peer, "test_sharetable_none")
+        test_assert.equal(res.len, nil)
+
+        --peer's files come from the code cache
+        local now = codecache.stats()
+        if codecache.mode() == "ON" then
+            test_assert.assert(now.hit > stats.hit)
+            test_assert.assert(now.files > 0 and now.memory > 0)
+        end
+
+        --reload keeps old proxies on their snapshot
+        test_assert.assert(sharetable.loadtable("test_sharetable_lua", {version = 2}))
+        test_assert.equal(t[1], "first")
+        test_assert.equal(t.items[1].name, "item1")
+        test_assert.equal(sharetable.query("test_sharetable_lua").version, 2)
+        res = moon.co_call("lua", peer, "test_sharetable_lua")
+        test_assert.assert(deep_equal(res.copy, {version = 2}))
+
+        local st = sharetable.stats()
+        test_assert.assert(st.count >= 3 and st.memory > 0)
+        test_assert.assert(sharetable.remove("test_sharetable_lua"))
+        test_assert.assert(not sharetable.remove("test_sharetable_lua"))
+        test_assert.equal(sharetable.query("test_sharetable_lua"), nil)
+        test_assert.equal(t.nested.a.b.c.d, "deep")
+        sharetable.remove("test_sharetable_json")
+        sharetable.remove("test_sharetable_file")
+
+        moon.co_remove_service(peer)
+        test_assert.success()
+    end)
+end)
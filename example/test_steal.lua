@@ -0,0 +1,110 @@
+local moon = require("moon")
+local json = require("json")
+local test_assert = require("test_assert")
+
+---work stealing: busy services move to idle workers, message order of each service must keep.
+---server config need "steal": true, otherwise services never move. Only receivers of one worker
+---get messages, the other workers are idle, so some of them must move.
+
+local conf = ...
+
+if conf.receiver then
+    local expect = 1
+    local sum = 0
+    moon.dispatch("lua", function(msg, p)
+        if msg:sessionid() ~= 0 then
+            moon.response("lua", msg:sender(), msg:sessionid(), expect - 1, sum)
+            return
+        end
+        local n = p.unpack(msg)
+        test_assert.equal(n, expect)
+        expect = expect + 1
+        --make receiver busy
+        for i = 1, 1000 do
+            sum = sum + i
+        end
+    end)
+    return
+end
+
+local count = 2000
+
+local function steal_stat(workernum)
+    local steal, stolen = {}, {}
+    for i = 1, workernum do
+        local res = json.decode(moon.co_runcmd("worker." .. i .. ".worktime"))
+        steal[i], stolen[i] = res.steal, res.stolen
+    end
+    return steal, stolen
+end
+
+local function worker_of(workernum, sid)
+    for i = 1, workernum do
+        for id in moon.co_runcmd("worker." .. i .. ".services"):gmatch([["serviceid":(%d+)]]) do
+            if tonumber(id) == sid then
+                return i
+            end
+        end
+    end
+end
+
+moon.start(function()
+    moon.async(function()
+        local workernum = moon.workernum()
+        local steal0, stolen0 = steal_stat(workernum)
+        --services given a worker are pinned, let the router place them and keep the ones on one worker
+        local placed = {}
+        for _ = 1, workernum * 3 do
+            placed[#placed + 1] = moon.co_new_service("lua", {name = "test_steal_receiver", file = "test_steal.lua", receiver = true})
+        end
+        local home = placed[1] >> 24
+        local receivers = {}
+        for _, sid in ipairs(placed) do
+            if (sid >> 24) == home then
+                receivers[#receivers + 1] = sid
+            else
+                moon.co_remove_service(sid)
+            end
+        end
+        test_assert.assert(#receivers > 1)
+
+        for i = 1, count do
+            for _, sid in ipairs(receivers) do
+                moon.send("lua", sid, "SEQ", i)
+            end
+            if i % 100 == 0 then
+                moon.co_wait(1)
+            end
+        end
+
+        --every receiver got all messages in order, moved ones included
+        local moved = 0
+        for _, sid in ipairs(receivers) do
+            local n = moon.co_call("lua", sid)
+            test_assert.equal(n, count)
+            local w = worker_of(workernum, sid)
+            test_assert.assert(w, "receiver not found on any worker")
+            if w ~= home then
+                moved = moved + 1
+            end
+        end
+
+        --all moves are from home, each one counted once by both sides
+        local steal1, stolen1 = steal_stat(workernum)
+        local steal = 0
+        for i = 1, workernum do
+            steal = steal + steal1[i] - steal0[i]
+            if i ~= home then
+                test_assert.equal(stolen1[i], stolen0[i])
+            end
+        end
+        test_assert.assert(steal > 0, "no service was moved")
+        test_assert.equal(stolen1[home] - stolen0[home], steal)
+        test_assert.equal(moved, steal)
+
+        for _, sid in ipairs(receivers) do
+            moon.co_remove_service(sid)
+        end
+        test_assert.success()
+    end)
+end)
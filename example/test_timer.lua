@@ -0,0 +1,84 @@
+local moon = require("moon")
+local core = require("moon.api")
+local test_assert = require("test_assert")
+
+---timer wheel: fire order across wheel levels, remove before fire and inside callback,
+---stale timer id must not remove the timer that reuses its node, a service can not remove
+---another service's timer on the same worker.
+
+local conf = ...
+
+if conf.peer then
+    local fired = false
+    moon.dispatch("lua", function(msg, p)
+        local cmd = p.unpack(msg)
+        local res
+        if cmd == "START" then
+            res = moon.repeated(200, 1, function()
+                fired = true
+            end)
+        else
+            res = fired
+        end
+        moon.response("lua", msg:sender(), msg:sessionid(), res)
+    end)
+    return
+end
+
+moon.start(function()
+    moon.async(function()
+        local start = moon.millsecond()
+        local fired = {}
+        --more than 256 ticks goes to level wheels and cascades back
+        for _, v in ipairs({3000, 20, 700, 2600, 100}) do
+            moon.repeated(v, 1, function()
+                test_assert.less_equal(v, moon.millsecond() - start + 10)
+                fired[#fired + 1] = v
+            end)
+        end
+
+        local removed = moon.repeated(50, 1, function()
+            test_assert.assert(false)
+        end)
+        moon.remove_timer(removed)
+
+        local self_remove = 0
+        moon.repeated(10, -1, function(timerid)
+            self_remove = self_remove + 1
+            if self_remove == 3 then
+                moon.remove_timer(timerid)
+            end
+        end)
+
+        local times = 0
+        moon.repeated(10, 5, function()
+            times = times + 1
+        end)
+
+        local stale = moon.repeated(10, 1, function() end)
+        moon.co_wait(50)
+        local reused = false
+        moon.repeated(10, 1, function()
+            reused = true
+        end)
+        moon.remove_timer(stale)
+        test_assert.equal(core.remove_timer(stale), false)
+
+        local peer = moon.co_new_service("lua", {name = "test_timer_peer", file = "test_timer.lua", peer = true}, false, moon.id() >> 24)
+        test_assert.assert(peer > 0)
+        local other = moon.co_call("lua", peer, "START")
+        test_assert.equal(core.remove_timer(other), false)
+        test_assert.equal(moon.remove_timer(other), false)
+        moon.co_wait(300)
+        test_assert.equal(moon.co_call("lua", peer, "CHECK"), true)
+        moon.co_remove_service(peer)
+
+        moon.co_wait(3100)
+
+        test_assert.linear_table_equal(fired, {20, 100, 700, 2600, 3000})
+        test_assert.equal(self_remove, 3)
+        test_assert.equal(times, 5)
+        test_assert.equal(reused, true)
+        test_assert.success()
+    end)
+end)
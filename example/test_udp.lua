@@ -0,0 +1,109 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---udp: plain datagrams between two sockets, then arq channel with 30% loss on both sides,
+---every message arrives once and in order. A restarted sender starts a new session and is heard again,
+---a receiver at max_peers takes a new peer only after an idle one expires.
+
+local HOST = "127.0.0.1"
+local PORT = 30010
+
+local COUNT = 500
+
+local received = {}
+local errors = 0
+
+socket.on("message", function(fd, msg)
+    received[#received + 1] = {fd, msg:header(), msg:bytes()}
+end)
+
+socket.on("error", function()
+    errors = errors + 1
+end)
+
+local function wait(n)
+    test_assert.wait(function() return #received >= n end, 15000)
+end
+
+moon.start(function()
+    moon.async(function()
+        local addr_a = HOST .. ":" .. PORT
+        local addr_b = HOST .. ":" .. (PORT + 1)
+
+        local a = socket.udp(HOST, PORT)
+        local b = socket.udp(HOST, PORT + 1)
+        test_assert.assert(a > 0 and b > 0)
+
+        for i = 1, 10 do
+            test_assert.assert(socket.sendto(b, addr_a, "hello" .. i))
+        end
+        test_assert.equal(socket.sendto(b, addr_a, string.rep("x", 8000)), false)
+        wait(10)
+        test_assert.equal(#received, 10)
+        for i, v in ipairs(received) do
+            test_assert.equal(v[1], a)
+            test_assert.equal(v[2], addr_b)
+            test_assert.equal(v[3], "hello" .. i)
+        end
+        socket.close(a)
+        socket.close(b)
+        test_assert.equal(socket.sendto(b, addr_a, "closed"), false)
+
+        received = {}
+        a = socket.udp(HOST, PORT, {arq = true, loss = 30})
+        b = socket.udp(HOST, PORT + 1, {arq = true, loss = 30})
+        for i = 1, COUNT do
+            socket.sendto(b, addr_a, tostring(i))
+        end
+        wait(COUNT)
+        test_assert.equal(#received, COUNT)
+        for i, v in ipairs(received) do
+            test_assert.equal(v[1], a)
+            test_assert.equal(v[3], tostring(i))
+        end
+        --no duplicates delivered late
+        moon.co_wait(200)
+        test_assert.equal(#received, COUNT)
+        test_assert.equal(errors, 0)
+
+        --sender restarts, its sequences start from 0 again
+        socket.close(b)
+        received = {}
+        b = socket.udp(HOST, PORT + 1, {arq = true})
+        for i = 1, 10 do
+            socket.sendto(b, addr_a, "again" .. i)
+        end
+        wait(10)
+        test_assert.equal(#received, 10)
+        for i, v in ipairs(received) do
+            test_assert.equal(v[3], "again" .. i)
+        end
+        --a's acks are lossy, b may still be resending, start both over
+        socket.close(a)
+        socket.close(b)
+
+        --one peer at a time, b must expire before c is heard
+        local addr_c = HOST .. ":" .. (PORT + 2)
+        received = {}
+        a = socket.udp(HOST, PORT, {arq = true, max_peers = 1, peer_timeout = 100})
+        b = socket.udp(HOST, PORT + 1, {arq = true})
+        local c = socket.udp(HOST, PORT + 2, {arq = true})
+        socket.sendto(b, addr_a, "from b")
+        wait(1)
+        local start = moon.millsecond()
+        socket.sendto(c, addr_a, "from c")
+        wait(2)
+        test_assert.equal(#received, 2)
+        test_assert.equal(received[1][2], addr_b)
+        test_assert.equal(received[2][2], addr_c)
+        test_assert.equal(received[2][3], "from c")
+        test_assert.assert(moon.millsecond() - start >= 50)
+        test_assert.equal(socket.sendto(a, HOST .. ":" .. (PORT + 3), "full"), false)
+        test_assert.equal(errors, 0)
+        socket.close(a)
+        socket.close(b)
+        socket.close(c)
+        test_assert.success()
+    end)
+end)
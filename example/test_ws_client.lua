@@ -0,0 +1,141 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---websocket client: socket.connect with PTYPE_SOCKET_WS upgrades, masks and fragments its frames,
+---messages written before the handshake completes are sent after it. Server side fragments
+---large replies and joins fragmented requests. Many clients echo against one listener.
+
+local HOST = "127.0.0.1"
+local PORT = 30017
+local CLIENTS = 50
+local ROUNDS = 20
+
+local server = {}
+local accepted = {}
+local client = {}
+local connected = 0
+
+socket.wson("accept", function(fd)
+    server[fd] = true
+    accepted[#accepted + 1] = fd
+end)
+
+socket.wson("connect", function(fd)
+    test_assert.assert(not server[fd])
+    connected = connected + 1
+end)
+
+socket.wson("message", function(fd, msg)
+    if server[fd] then
+        socket.write(fd, msg:bytes())
+    else
+        local t = client[fd]
+        t[#t + 1] = msg:bytes()
+    end
+end)
+
+local function payload(size, seed)
+    local t = {}
+    local v = seed
+    for i = 1, size do
+        v = (v * 1103515245 + 12345) & 0x7FFFFFFF
+        t[i] = string.char((v >> 16) & 0xFF)
+    end
+    return table.concat(t)
+end
+
+local function raw_handshake(fd)
+    socket.write(fd, table.concat({
+        "GET / HTTP/1.1",
+        "Host: " .. HOST,
+        "Upgrade: websocket",
+        "Connection: Upgrade",
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==",
+        "Sec-WebSocket-Version: 13",
+    }, "\r\n") .. "\r\n\r\n")
+    test_assert.assert(socket.readline(fd, "\r\n\r\n"))
+end
+
+moon.start(function()
+    moon.async(function()
+        local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET_WS, {deflate = {threshold = 64}, fragment = 1000})
+        socket.start(listenfd)
+
+        local messages = {"hello", string.rep("compressible ", 500), payload(5000, 7), payload(65536, 9)}
+
+        local fd = socket.connect(HOST, PORT, moon.PTYPE_SOCKET_WS, 1000, {deflate = true, fragment = 500, path = "/chat"})
+        test_assert.assert(fd)
+        client[fd] = {}
+        --queued until server accepts the upgrade
+        for _, v in ipairs(messages) do
+            test_assert.assert(socket.write(fd, v))
+        end
+        test_assert.wait(function() return #client[fd] == #messages end, 10000)
+        test_assert.equal(connected, 1)
+        test_assert.equal(#client[fd], #messages)
+        for i, v in ipairs(messages) do
+            test_assert.equal(client[fd][i], v)
+        end
+
+        --server fragments a 2500 bytes reply to 1000 bytes frames
+        local raw = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+        raw_handshake(raw)
+        test_assert.wait(function() return #accepted == 2 end, 10000)
+        local rawserver = accepted[2]
+        local data = payload(2500, 3)
+        socket.write(rawserver, data)
+        local ops = {}
+        local got = {}
+        repeat
+            local b1, b2 = string.unpack(">BB", socket.read(raw, 2))
+            test_assert.equal(b2 & 0x80, 0)
+            local len = b2 & 0x7F
+            if len == 126 then
+                len = string.unpack(">I2", socket.read(raw, 2))
+            end
+            ops[#ops + 1] = b1
+            got[#got + 1] = socket.read(raw, len)
+        until (b1 & 0x80) ~= 0
+        test_assert.linear_table_equal(ops, {0x02, 0x00, 0x80})
+        test_assert.equal(table.concat(got), data)
+        socket.close(raw)
+
+        --many clients on one worker
+        local fds = {}
+        for i = 1, CLIENTS do
+            moon.async(function()
+                local c = socket.connect(HOST, PORT, moon.PTYPE_SOCKET_WS)
+                test_assert.assert(c)
+                client[c] = {}
+                fds[i] = c
+                for j = 1, ROUNDS do
+                    socket.write(c, "msg" .. j)
+                end
+            end)
+        end
+        test_assert.wait(function()
+            if #fds ~= CLIENTS then
+                return false
+            end
+            for _, c in ipairs(fds) do
+                if #client[c] ~= ROUNDS then
+                    return false
+                end
+            end
+            return true
+        end, 10000)
+        test_assert.equal(connected, CLIENTS + 1)
+        for _, c in ipairs(fds) do
+            test_assert.equal(#client[c], ROUNDS)
+            for j = 1, ROUNDS do
+                test_assert.equal(client[c][j], "msg" .. j)
+            end
+            socket.close(c)
+        end
+
+        socket.close(fd)
+        socket.close(listenfd)
+        test_assert.success()
+    end)
+end)
@@ -0,0 +1,171 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---websocket permessage-deflate: handshake negotiation, compressed frames from client are inflated,
+---large replies are compressed, small ones are not, broadcast_ws shares one frame per compression parameters.
+---Raw PTYPE_TEXT connections play the client. Without ws-deflate build option the server does not
+---answer the offer and only the uncompressed paths are checked.
+
+local HOST = "127.0.0.1"
+local PORT = 30014
+local THRESHOLD = 64
+local BIG = string.rep("moon websocket ", 200)
+
+local server = {}
+local inbox = {}
+
+socket.wson("accept", function(fd)
+    server[#server + 1] = fd
+end)
+
+socket.wson("message", function(fd, msg)
+    local data = msg:bytes()
+    inbox[#inbox + 1] = data
+    socket.write_text(fd, data)
+end)
+
+local function handshake(fd, extensions)
+    local req = {
+        "GET / HTTP/1.1",
+        "Host: " .. HOST,
+        "Upgrade: websocket",
+        "Connection: Upgrade",
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==",
+        "Sec-WebSocket-Version: 13",
+    }
+    if extensions then
+        req[#req + 1] = "Sec-WebSocket-Extensions: " .. extensions
+    end
+    socket.write(fd, table.concat(req, "\r\n") .. "\r\n\r\n")
+    local res = socket.readline(fd, "\r\n\r\n")
+    test_assert.assert(res and string.find(res, "101", 1, true))
+    return string.match(res, "Sec%-WebSocket%-Extensions: ([^\r\n]*)")
+end
+
+---client frames are masked, mask 0 keeps payload as is
+local function write_frame(fd, payload, rsv1)
+    local b1 = 0x81 | (rsv1 and 0x40 or 0)
+    local head
+    if #payload < 126 then
+        head = string.pack(">BB", b1, 0x80 | #payload)
+    else
+        head = string.pack(">BBI2", b1, 0x80 | 126, #payload)
+    end
+    socket.write(fd, head .. string.pack(">I4", 0) .. payload)
+end
+
+local function read_frame(fd)
+    local b1, b2 = string.unpack(">BB", socket.read(fd, 2))
+    local len = b2 & 0x7F
+    if len == 126 then
+        len = string.unpack(">I2", socket.read(fd, 2))
+    elseif len == 127 then
+        len = string.unpack(">I8", socket.read(fd, 8))
+    end
+    return {
+        fin = (b1 & 0x80) ~= 0,
+        rsv1 = (b1 & 0x40) ~= 0,
+        opcode = b1 & 0x0F,
+        payload = socket.read(fd, len)
+    }
+end
+
+---raw deflate stored block followed by the header of an empty stored block,
+---whose 00 00 ff ff tail is removed as RFC 7692 requires
+local function stored_deflate(s)
+    return string.pack("<BI2I2", 0, #s, (~#s) & 0xFFFF) .. s .. "\0"
+end
+
+local function connect(extensions)
+    local n = #server
+    local fd = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+    test_assert.assert(fd)
+    local res = handshake(fd, extensions)
+    test_assert.wait(function() return #server > n end)
+    return fd, res
+end
+
+moon.start(function()
+    moon.async(function()
+        local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET_WS, {deflate = {threshold = THRESHOLD}})
+        socket.start(listenfd)
+
+        --unsupported parameter makes the first offer rejected, second one is accepted
+        local fd, ext = connect("permessage-deflate; foo=1, permessage-deflate; server_max_window_bits=10; client_max_window_bits")
+        local deflate = ext ~= nil
+        if deflate then
+            test_assert.equal(ext, "permessage-deflate; server_max_window_bits=10")
+
+            write_frame(fd, stored_deflate("hello deflate"), true)
+            test_assert.wait(function() return #inbox == 1 end)
+            test_assert.equal(inbox[1], "hello deflate")
+            local f = read_frame(fd)
+            test_assert.assert(not f.rsv1)
+            test_assert.equal(f.payload, "hello deflate")
+
+            --large echo is compressed, second one refers back to the first
+            write_frame(fd, BIG, false)
+            local f1 = read_frame(fd)
+            test_assert.assert(f1.rsv1 and f1.fin)
+            test_assert.equal(f1.opcode, 1)
+            test_assert.less(#f1.payload, #BIG // 4)
+            write_frame(fd, BIG, false)
+            local f2 = read_frame(fd)
+            test_assert.assert(f2.rsv1)
+            test_assert.less(#f2.payload, #f1.payload)
+        end
+
+        --small message stays uncompressed
+        write_frame(fd, "tiny", false)
+        local f = read_frame(fd)
+        test_assert.assert(not f.rsv1)
+        test_assert.equal(f.payload, "tiny")
+
+        --no offer, no extension
+        local plain, noext = connect()
+        test_assert.assert(not noext)
+
+        --no_context_takeover client
+        local fd2, ext2 = connect("permessage-deflate; server_no_context_takeover; client_no_context_takeover")
+        if deflate then
+            test_assert.equal(ext2, "permessage-deflate; server_no_context_takeover; client_no_context_takeover")
+            --same message compressed alone twice gives the same bytes
+            write_frame(fd2, BIG, false)
+            local a = read_frame(fd2)
+            write_frame(fd2, BIG, false)
+            local b = read_frame(fd2)
+            test_assert.assert(a.rsv1)
+            test_assert.equal(a.payload, b.payload)
+        end
+
+        inbox = {}
+        local n = socket.broadcast_ws(server, BIG, true)
+        test_assert.equal(n, #server)
+
+        local p = read_frame(plain)
+        test_assert.assert(not p.rsv1)
+        test_assert.equal(p.payload, BIG)
+
+        local b1 = read_frame(fd)
+        local b2 = read_frame(fd2)
+        test_assert.equal(b1.rsv1, deflate)
+        test_assert.equal(b2.rsv1, deflate)
+        if deflate then
+            --window of 10 bits and 15 bits give different frames, both compressed alone
+            test_assert.less(#b1.payload, #BIG // 4)
+            test_assert.less(#b2.payload, #BIG // 4)
+            --shared frame reset takeover connection's deflater, next reply is still valid for the client
+            write_frame(fd, BIG, false)
+            local after = read_frame(fd)
+            test_assert.assert(after.rsv1)
+            test_assert.equal(after.payload, b1.payload)
+        end
+
+        socket.close(fd)
+        socket.close(fd2)
+        socket.close(plain)
+        socket.close(listenfd)
+        test_assert.success()
+    end)
+end)
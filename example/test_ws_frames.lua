@@ -0,0 +1,106 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+local test_assert = require("test_assert")
+
+---websocket frames: many masked frames of odd sizes in one write are all unmasked and delivered,
+---a frame split across writes is joined, replies use 7, 16 and 64 bit lengths.
+
+local HOST = "127.0.0.1"
+local PORT = 30016
+local SIZES = {0, 1, 3, 7, 15, 16, 17, 31, 32, 33, 63, 65, 125, 126, 127, 1000, 65535, 65536, 70001}
+
+local server
+local inbox = {}
+
+socket.wson("accept", function(fd)
+    server = fd
+end)
+
+socket.wson("message", function(_, msg)
+    inbox[#inbox + 1] = msg:bytes()
+end)
+
+local function payload(size, seed)
+    local t = {}
+    for i = 1, size do
+        t[i] = string.char((i * 7 + seed) & 0xFF)
+    end
+    return table.concat(t)
+end
+
+local function masked_frame(data, key)
+    local size = #data
+    local head
+    if size < 126 then
+        head = string.pack(">BB", 0x82, 0x80 | size)
+    elseif size < 65536 then
+        head = string.pack(">BBI2", 0x82, 0x80 | 126, size)
+    else
+        head = string.pack(">BBI8", 0x82, 0x80 | 127, size)
+    end
+    local t = {}
+    for i = 1, size do
+        t[i] = string.char(data:byte(i) ~ key[(i - 1) % 4 + 1])
+    end
+    return head .. string.char(table.unpack(key)) .. table.concat(t)
+end
+
+moon.start(function()
+    moon.async(function()
+        local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET_WS)
+        socket.start(listenfd)
+
+        local fd = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+        test_assert.assert(fd)
+        socket.write(fd, table.concat({
+            "GET / HTTP/1.1",
+            "Host: " .. HOST,
+            "Upgrade: websocket",
+            "Connection: Upgrade",
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==",
+            "Sec-WebSocket-Version: 13",
+        }, "\r\n") .. "\r\n\r\n")
+        test_assert.assert(socket.readline(fd, "\r\n\r\n"))
+        test_assert.wait(function() return server ~= nil end)
+
+        local expect = {}
+        local frames = {}
+        for i, size in ipairs(SIZES) do
+            expect[i] = payload(size, i)
+            frames[i] = masked_frame(expect[i], {i, 0xA5, 0x5A ~ i, 0xFF})
+        end
+        socket.write(fd, table.concat(frames))
+
+        local last = masked_frame(payload(300, 99), {1, 2, 3, 4})
+        socket.write(fd, last:sub(1, 5))
+        moon.co_wait(20)
+        socket.write(fd, last:sub(6))
+        expect[#expect + 1] = payload(300, 99)
+
+        test_assert.wait(function() return #inbox == #expect end)
+        test_assert.equal(#inbox, #expect)
+        for i = 1, #expect do
+            test_assert.equal(inbox[i], expect[i])
+        end
+
+        for _, size in ipairs({125, 126, 65535, 65536}) do
+            socket.write(server, payload(size, 0))
+            local b1, b2 = string.unpack(">BB", socket.read(fd, 2))
+            test_assert.equal(b1, 0x82)
+            local len = b2
+            if size >= 65536 then
+                test_assert.equal(b2, 127)
+                len = string.unpack(">I8", socket.read(fd, 8))
+            elseif size >= 126 then
+                test_assert.equal(b2, 126)
+                len = string.unpack(">I2", socket.read(fd, 2))
+            end
+            test_assert.equal(len, size)
+            test_assert.equal(socket.read(fd, len), payload(size, 0))
+        end
+
+        socket.close(fd)
+        socket.close(listenfd)
+        test_assert.success()
+    end)
+end)
@@ -0,0 +1,76 @@
+local moon = require("moon")
+
+---timer benchmark: add, cancel and fire 1M timers through moon.repeated/moon.remove_timer,
+---then add and cancel 1M timers at once (request timeouts answered in time).
+---Run it against different builds to compare timer engines.
+
+local conf = ...
+
+local count = conf.count or 1000000
+local microsecond = moon.microsecond
+local millsecond = moon.millsecond
+
+local function rss()
+    local f = io.open("/proc/self/status")
+    if not f then
+        return "-"
+    end
+    local s = f:read("a")
+    f:close()
+    return s:match("VmRSS:%s*(%d+ %a+)") or "-"
+end
+
+moon.async(function()
+    print(string.format("timer benchmark: %d timers, precision %s", count, conf.precision or "default"))
+
+    local deadlines = {}
+    local fired = 0
+    local max_lag = 0
+    local total_lag = 0
+    local function on_timer(timerid)
+        local lag = millsecond() - deadlines[timerid]
+        if lag > max_lag then
+            max_lag = lag
+        end
+        total_lag = total_lag + lag
+        fired = fired + 1
+    end
+
+    local ids = {}
+    local t = microsecond()
+    for i = 1, count do
+        local duration = 1000 + i % 1000
+        local timerid = moon.repeated(duration, 1, on_timer)
+        ids[i] = timerid
+        deadlines[timerid] = millsecond() + duration
+    end
+    local add_cost = microsecond() - t
+
+    t = microsecond()
+    for i = 1, count, 2 do
+        moon.remove_timer(ids[i])
+    end
+    local remove_cost = microsecond() - t
+    ids = nil
+
+    local expect = count // 2
+    while fired < expect do
+        moon.co_wait(10)
+    end
+
+    t = microsecond()
+    for _ = 1, count do
+        moon.remove_timer(moon.repeated(5000, 1, on_timer))
+    end
+    local churn_cost = microsecond() - t
+
+    print("add(ns/op)    remove(ns/op)    churn(ns/op)    avg lag(ms)    max lag(ms)    rss")
+    print(string.format("%-13.1f %-16.1f %-15.1f %-14.2f %-14d %s",
+        add_cost * 1000 / count,
+        remove_cost * 1000 / (count // 2),
+        churn_cost * 1000 / count,
+        total_lag / fired,
+        max_lag,
+        rss()))
+    moon.abort()
+end)
@@ -0,0 +1,94 @@
+local moon = require("moon")
+local socket = require("moon.socket")
+
+---websocket receive benchmark: a raw PTYPE_TEXT client writes batches of masked binary frames
+---from 16B to 64KB to a PTYPE_SOCKET_WS listener, the server acks each batch.
+---Reports frames/s and payload MB/s per size, this is the whole receive path. The unmask kernel
+---alone is measured by benchmark/ws_unmask_benchmark.cpp.
+
+local conf = ...
+
+local host = conf.host or "127.0.0.1"
+local port = conf.port or 30015
+local total_bytes = conf.bytes or 64 * 1024 * 1024
+local max_frames = conf.frames or 200000
+local BATCH_BYTES = 256 * 1024
+local KEY = {0x37, 0xfa, 0x21, 0x3d}
+
+local millsecond = moon.millsecond
+
+local function masked_frame(size)
+    local payload = {}
+    for i = 1, size do
+        payload[i] = string.char(((i * 31) & 0xFF) ~ KEY[(i - 1) % 4 + 1])
+    end
+    local head
+    if size < 126 then
+        head = string.pack(">BB", 0x82, 0x80 | size)
+    elseif size < 65536 then
+        head = string.pack(">BBI2", 0x82, 0x80 | 126, size)
+    else
+        head = string.pack(">BBI8", 0x82, 0x80 | 127, size)
+    end
+    return head .. string.char(table.unpack(KEY)) .. table.concat(payload)
+end
+
+local received = 0
+local batch = 1
+local server_fd
+
+socket.wson("accept", function(fd)
+    server_fd = fd
+end)
+
+socket.wson("message", function(fd)
+    received = received + 1
+    if received % batch == 0 then
+        socket.write(fd, "ok")
+    end
+end)
+
+moon.async(function()
+    local listenfd = socket.listen(host, port, moon.PTYPE_SOCKET_WS)
+    socket.start(listenfd)
+
+    local fd = socket.connect(host, port, moon.PTYPE_TEXT)
+    socket.write(fd, table.concat({
+        "GET / HTTP/1.1",
+        "Host: " .. host,
+        "Upgrade: websocket",
+        "Connection: Upgrade",
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==",
+        "Sec-WebSocket-Version: 13",
+    }, "\r\n") .. "\r\n\r\n")
+    assert(socket.readline(fd, "\r\n\r\n"))
+    socket.setnodelay(fd)
+    socket.setnodelay(server_fd)
+
+    print(string.format("websocket benchmark: %d bytes or %d frames per size", total_bytes, max_frames))
+    print(string.format("%8s %10s %10s %14s %10s", "size", "frames", "ms", "frames/s", "MB/s"))
+
+    local size = 16
+    while size <= 65536 do
+        batch = math.max(1, BATCH_BYTES // size)
+        local frames = math.min(max_frames, total_bytes // size)
+        frames = math.max(batch, frames - frames % batch)
+        local data = string.rep(masked_frame(size), batch)
+
+        received = 0
+        local t = millsecond()
+        for _ = 1, frames // batch do
+            socket.write(fd, data)
+            --binary ack frame: 2 bytes header and "ok"
+            assert(socket.read(fd, 4))
+        end
+        t = math.max(1, millsecond() - t)
+        print(string.format("%8d %10d %10d %14.0f %10.1f", size, frames, t, frames * 1000 / t, size * frames / 1024 / 1024 * 1000 / t))
+        size = size * 4
+    end
+
+    socket.close(fd)
+    socket.close(server_fd)
+    socket.close(listenfd)
+    moon.abort()
+end)
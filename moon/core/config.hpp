@@ -5,7 +5,42 @@ namespace moon
 {
     constexpr int32_t WORKER_ID_SHIFT = 24;
     constexpr int64_t UPDATE_INTERVAL = 10; //ms
+    constexpr int32_t TIMER_PRECISION = 10; //default worker timer tick ms
+    constexpr size_t STEAL_BACKLOG = 64; //pending messages after a batch that make a worker give away services
+    constexpr uint32_t SERVICE_BUDGET = 64; //default max messages a service handles per turn, 0 means no limit
+    constexpr int64_t IDLE_GC_BUDGET = 1000; //default microseconds a worker spends on idle gc per idle period(a dispatch turn or server tick with no messages), 0 disables idle gc
     constexpr int32_t BUFFER_HEAD_RESERVED = 10;//max : websocket header  max  len
+    constexpr uint32_t HEADER_INTERN_MAX = 4096;//max interned message headers
+
+    //what a service mailbox does when its depth reaches the high watermark
+    enum class mailbox_policy :uint8_t
+    {
+        none,//unbounded
+        drop_oldest,//drop the oldest request to make room
+        reject,//reject new requests until depth falls to the low watermark
+        throttle,//pause reads of connections owned by the service until depth falls to the low watermark
+    };
+
+    struct mailbox_limit
+    {
+        uint32_t high = 0;//0 means unbounded
+        uint32_t low = 0;
+        mailbox_policy policy = mailbox_policy::none;
+    };
+
+    inline bool to_mailbox_policy(string_view_t s, mailbox_policy& v)
+    {
+        static constexpr string_view_t names[] = { "none"sv, "drop_oldest"sv, "reject"sv, "throttle"sv };
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        {
+            if (names[i] == s)
+            {
+                v = static_cast<mailbox_policy>(i);
+                return true;
+            }
+        }
+        return false;
+    }
 
     DECLARE_UNIQUE_PTR(message);
     DECLARE_SHARED_PTR(buffer);
@@ -22,8 +57,13 @@ namespace moon
     //network
     using message_size_t = uint16_t;
     constexpr message_size_t MAX_NET_MSG_SIZE = 0x7FFF;
-    constexpr size_t WARN_NET_SEND_QUEUE_SIZE = 200;
-    constexpr size_t MAX_NET_SEND_QUEUE_SIZE = 300;
+    constexpr uint32_t MAX_WIDE_NET_MSG_SIZE = 64 * 1024 * 1024; //max frame size with 32 bit or varint length
+    constexpr size_t MAX_NET_SEND_QUEUE_BYTES = 8 * 1024 * 1024; //default per connection limit of unsent bytes
+    constexpr size_t SEND_COALESCE_SIZE = 512; //smaller buffers are copied into connection send arena
+    constexpr size_t SEND_BATCH_BYTES = 64 * 1024; //stop adding buffers to one write after this many bytes
+    constexpr size_t SEND_BATCH_BUFFERS = 64; //max iovecs of one write, asio writes at most 64 per syscall
+    constexpr size_t UDP_MAX_PACKET = 4096; //max datagram size, larger datagrams are truncated on receive
+    constexpr uint8_t MAX_WS_WINDOW_BITS = 15; //permessage-deflate max LZ77 window, 32KB
 
     constexpr  string_view_t STR_LF = "\n"sv;
     constexpr  string_view_t STR_CRLF = "\r\n"sv;
@@ -34,7 +74,7 @@ namespace moon
         pack_size = 1 << 0,
         close = 1 << 1,
         framing = 1 << 2,
-        broadcast = 1 << 3,
+        droppable = 1 << 3,//may be discarded when connection send queue is over limit
         ws_text = 1 << 4,
         ws_binary = 1 << 5,
         buffer_flag_max,
@@ -1,15 +1,41 @@
 #pragma once
 #include "config.hpp"
 #include "common/buffer.hpp"
+#include "common/mpsc_queue.hpp"
+#include "common/intern_table.hpp"
 
 namespace moon
 {
-    class  message final
+    class  message final :public mpsc_queue_hook
     {
+        using header_table_t = intern_table<HEADER_INTERN_MAX>;
+
+        static header_table_t& header_table()
+        {
+            static header_table_t table;
+            return table;
+        }
     public:
+        //process wide, messages sent with the id carry it instead of the string. returns 0 when table is full
+        static uint32_t intern_header(string_view_t header)
+        {
+            return header_table().intern(header);
+        }
+
+        static bool valid_header_id(uint32_t id)
+        {
+            return header_table().valid(id);
+        }
+
         static buffer_ptr_t create_buffer(size_t capacity = 64, uint32_t headreserved = BUFFER_HEAD_RESERVED)
         {
-            return std::make_shared<buffer>(capacity, headreserved);
+            return std::allocate_shared<buffer>(block_pool_allocator<buffer>{}, capacity, headreserved);
+        }
+
+        //take ownership of a buffer created by new, e.g. lua serialize
+        static buffer_ptr_t wrap_buffer(buffer* p)
+        {
+            return buffer_ptr_t(p, std::default_delete<buffer>{}, block_pool_allocator<buffer>{});
         }
 
         static message_ptr_t create(size_t capacity = 64, uint32_t headreserved = BUFFER_HEAD_RESERVED)
@@ -25,7 +51,7 @@ namespace moon
 
         message(size_t capacity = 64, uint32_t headreserved = 0)
         {
-            data_ = std::make_shared<buffer>(capacity, headreserved);
+            data_ = std::allocate_shared<buffer>(block_pool_allocator<buffer>{}, capacity, headreserved);
         }
 
         template<typename Buffer, std::enable_if_t<std::is_same_v<std::decay_t<Buffer>, buffer_ptr_t>, int> = 0>
@@ -43,6 +69,19 @@ namespace moon
 
         message& operator=(const message&) = delete;
 
+        //messages are freed by the receiver's worker, go back to the sender's pool
+        static void* operator new(size_t size)
+        {
+            assert(size == sizeof(message));
+            (void)size;
+            return block_pool<message, sizeof(message)>::allocate();
+        }
+
+        static void operator delete(void* p) noexcept
+        {
+            block_pool<message, sizeof(message)>::deallocate(p);
+        }
+
         void set_sender(uint32_t serviceid)
         {
             sender_ = serviceid;
@@ -63,13 +102,21 @@ namespace moon
             return receiver_;
         }
 
+        //stores the string, see set_header_id for interned headers
         void set_header(string_view_t header)
         {
             if (header.size() != 0)
             {
-                if (!header_)
+                header_id_ = 0;
+                if (header.size() <= HEADER_INLINE)
+                {
+                    memcpy(header_inline_, header.data(), header.size());
+                    header_size_ = static_cast<uint8_t>(header.size());
+                    header_.reset();
+                }
+                else if (!header_ || header_.use_count() > 1)
                 {
-                    header_ = std::make_unique<std::string>(header.data(), header.size());
+                    header_ = std::make_shared<std::string>(header.data(), header.size());
                 }
                 else
                 {
@@ -81,14 +128,36 @@ namespace moon
 
         string_view_t header() const
         {
-            if (nullptr == header_)
+            if (0 != header_id_)
             {
-                return string_view_t{};
+                return header_table().get(header_id_);
             }
-            else
+
+            if (nullptr != header_)
             {
                 return string_view_t{ header_->data(),header_->size() };
             }
+            return string_view_t{ header_inline_, header_size_ };
+        }
+
+        //id from intern_header, no string is stored
+        void set_header_id(uint32_t id)
+        {
+            assert(valid_header_id(id));
+            header_id_ = static_cast<uint16_t>(id);
+            header_size_ = 0;
+            header_.reset();
+        }
+
+        //interned header id, 0 means header is not interned.
+        //a header set as string is looked up here, only receivers that ask pay for it
+        uint32_t header_id() const
+        {
+            if (0 != header_id_)
+            {
+                return header_id_;
+            }
+            return header_table().find(header());
         }
 
         void set_sessionid(int32_t v)
@@ -172,18 +241,53 @@ namespace moon
             return data_ ? data_.get() : nullptr;
         }
 
+        //for changing the payload: a shared payload (see share, buffer views) is copied first,
+        //other holders keep the original
+        buffer* writable_buffer()
+        {
+            if (shared())
+            {
+                auto b = create_buffer(data_->size());
+                b->write_back(data_->data(), 0, data_->size());
+                data_ = std::move(b);
+            }
+            return get_buffer();
+        }
+
+        //broadcast message: receiver is the group id, 0 means all services
         bool broadcast() const
         {
-            return data_?data_->has_flag(buffer_flag::broadcast):false;
+            return broadcast_;
         }
 
         void set_broadcast(bool v)
         {
-            if (!data_)
-            {
-                return;
-            }
-            v ? data_->set_flag(buffer_flag::broadcast) : data_->clear_flag(buffer_flag::broadcast);
+            broadcast_ = v;
+        }
+
+        //payload is still referenced by another envelope, see share.
+        //only holders can add references, so 1 means no one else can see the buffer
+        bool shared() const
+        {
+            return data_ && data_.use_count() > 1;
+        }
+
+        //envelope for one receiver of a broadcast or send_many, payload and header are shared, not copied.
+        //receivers must treat the payload as read only.
+        message_ptr_t share(uint32_t receiver) const
+        {
+            auto m = std::make_unique<message>(data_);
+            m->type_ = type_;
+            m->subtype_ = subtype_;
+            m->broadcast_ = broadcast_;
+            m->sender_ = sender_;
+            m->receiver_ = receiver;
+            m->sessionid_ = sessionid_;
+            m->header_ = header_;
+            m->header_size_ = header_size_;
+            m->header_id_ = header_id_;
+            memcpy(m->header_inline_, header_inline_, header_size_);
+            return m;
         }
 
         void reset()
@@ -193,10 +297,20 @@ namespace moon
             sender_ = 0;
             receiver_ = 0;
             sessionid_ = 0;
+            broadcast_ = false;
+            header_size_ = 0;
+            header_id_ = 0;
 
             if (header_)
             {
-                header_->clear();
+                if (header_.use_count() > 1)
+                {
+                    header_.reset();
+                }
+                else
+                {
+                    header_->clear();
+                }
             }
 
             if (data_)
@@ -205,12 +319,19 @@ namespace moon
             }
         }
     private:
+        //short headers are stored in message, no allocation
+        static constexpr size_t HEADER_INLINE = 22;
+
         uint8_t type_ = 0;
         uint8_t subtype_ = 0;
+        bool broadcast_ = false;
+        uint8_t header_size_ = 0;
+        uint16_t header_id_ = 0;
+        char header_inline_[HEADER_INLINE];
         uint32_t sender_ = 0;
         uint32_t receiver_ = 0;
         int32_t sessionid_ = 0;
-        std::unique_ptr<std::string> header_;
+        std::shared_ptr<std::string> header_;
         buffer_ptr_t data_;
     };
 };
@@ -5,6 +5,7 @@
 #include "handler_alloc.hpp"
 #include "const_buffers_holder.hpp"
 #include "common/string.hpp"
+#include "common/time.hpp"
 
 namespace moon
 {
@@ -89,16 +90,11 @@ namespace moon
             }
 
             queue_.push_back(data);
+            queued_bytes_ += data->size();
 
-            if (queue_.size() >= WARN_NET_SEND_QUEUE_SIZE)
+            if (queued_bytes() >= send_queue_limit_ && !check_send_queue())
             {
-                CONSOLE_DEBUG(logger(), "network send queue too long. size:%zu", queue_.size());
-                if (queue_.size() >= MAX_NET_SEND_QUEUE_SIZE)
-                {
-                    logic_error_ = network_logic_error::send_message_queue_size_max;
-                    close();
-                    return false;
-                }
+                return false;
             }
 
             if (!sending_)
@@ -143,12 +139,71 @@ namespace moon
             return fd_;
         }
 
-        void timeout(time_t now)
+        uint32_t owner() const
+        {
+            return serviceid_;
+        }
+
+        //a paused connection finishes its current read and issues no new one until resumed
+        void pause_read(bool v)
         {
-            if ((0 != timeout_) && (0 != recvtime_) && (now - recvtime_ > timeout_))
+            paused_ = v;
+            if (!v && resume_read_)
             {
-                logic_error_ = network_logic_error::timeout;
-                close();
+                recvtime_ = now();
+                auto f = std::move(resume_read_);
+                resume_read_ = nullptr;
+                f();
+            }
+        }
+
+        //deadline timer fired, close the connection or wait for the remaining time
+        void deadline(timer_id_t id, bool write)
+        {
+            auto& timer = write ? write_timer_ : read_timer_;
+            if (timer != id)
+            {
+                return;
+            }
+            timer = 0;
+
+            if (!socket_.is_open())
+            {
+                return;
+            }
+
+            auto t = now();
+            if (write)
+            {
+                //armed again by next write
+                if (0 == write_timeout_ || !sending_)
+                {
+                    return;
+                }
+                auto elapsed = t - sendtime_;
+                if (elapsed >= write_timeout_)
+                {
+                    logic_error_ = network_logic_error::write_timeout;
+                    close();
+                    return;
+                }
+                timer = add_deadline(write_timeout_ - elapsed, true);
+            }
+            else
+            {
+                if (0 == read_timeout_)
+                {
+                    return;
+                }
+                //paused connection does not read, wait a full period after resume
+                auto elapsed = paused_ ? 0 : t - recvtime_;
+                if (elapsed >= read_timeout_)
+                {
+                    logic_error_ = network_logic_error::timeout;
+                    close();
+                    return;
+                }
+                timer = add_deadline(read_timeout_ - elapsed, false);
             }
         }
 
@@ -169,16 +224,59 @@ namespace moon
             log_ = l;
         }
 
-        void settimeout(uint32_t v)
+        //milliseconds without receiving data, 0 disables
+        void set_read_timeout(uint32_t ms)
+        {
+            read_timeout_ = ms;
+            remove_deadline(read_timer_);
+            if (read_timeout_ > 0)
+            {
+                recvtime_ = now();
+                read_timer_ = add_deadline(read_timeout_, false);
+            }
+        }
+
+        //milliseconds a write may take, 0 disables
+        void set_write_timeout(uint32_t ms)
+        {
+            write_timeout_ = ms;
+            remove_deadline(write_timer_);
+            if (write_timeout_ > 0 && sending_)
+            {
+                write_timer_ = add_deadline(write_timeout_ - std::min<int64_t>(now() - sendtime_, write_timeout_), true);
+            }
+        }
+
+        void set_send_queue(size_t limit, send_queue_policy policy)
         {
-            timeout_ = v;
+            send_queue_limit_ = limit;
+            policy_ = policy;
         }
 
-        static time_t now()
+        //bytes waiting in queue and bytes of the write in progress
+        size_t queued_bytes() const
         {
-            return std::time(nullptr);
+            return queued_bytes_ + sending_bytes_;
+        }
+
+        //steady clock milliseconds
+        static int64_t now()
+        {
+            return time::millisecond();
         }
     protected:
+        //call before issuing a read, true means read is held until pause_read(false)
+        template<typename Handler>
+        bool hold_read(Handler&& h)
+        {
+            if (!paused_)
+            {
+                return false;
+            }
+            resume_read_ = std::forward<Handler>(h);
+            return true;
+        }
+
         virtual void message_framing(const_buffers_holder& holder, buffer_ptr_t&& buf)
         {
             (void)holder;
@@ -191,9 +289,11 @@ namespace moon
             if (queue_.size() == 0)
                 return;
 
-            while ((queue_.size() != 0) && (holder_.size() < 50))
+            //batch by bytes, small buffers are coalesced so many packets cost one iovec
+            while ((queue_.size() != 0) && (holder_.size() < SEND_BATCH_BUFFERS) && (holder_.bytes() < SEND_BATCH_BYTES))
             {
                 auto& msg = queue_.front();
+                queued_bytes_ -= std::min(queued_bytes_, msg->size());
                 if (msg->has_flag(buffer_flag::framing))
                 {
                     message_framing(holder_, std::move(msg));
@@ -209,6 +309,12 @@ namespace moon
                 return;
 
             sending_ = true;
+            sending_bytes_ = holder_.bytes();
+            sendtime_ = now();
+            if (write_timeout_ > 0 && 0 == write_timer_)
+            {
+                write_timer_ = add_deadline(write_timeout_, true);
+            }
             asio::async_write(
                 socket_,
                 holder_.buffers(),
@@ -216,9 +322,16 @@ namespace moon
                     [this, self = shared_from_this()](const asio::error_code& e, std::size_t)
             {
                 sending_ = false;
+                sending_bytes_ = 0;
 
                 if (!e)
                 {
+                    if (congested_ && queued_bytes() <= send_queue_limit_ / 2)
+                    {
+                        congested_ = false;
+                        notify_send_queue("low"sv);
+                    }
+
                     if (holder_.close())
                     {
                         close();
@@ -235,6 +348,84 @@ namespace moon
             }));
         }
 
+        timer_id_t add_deadline(int64_t ms, bool write)
+        {
+            if (nullptr == s_)
+            {
+                return 0;
+            }
+            return s_->add_deadline(fd_, ms, write);
+        }
+
+        void remove_deadline(timer_id_t& id)
+        {
+            if (0 != id && nullptr != s_)
+            {
+                s_->remove_deadline(id);
+            }
+            id = 0;
+        }
+
+        //called when queued bytes reach the limit, false means connection is closed
+        bool check_send_queue()
+        {
+            switch (policy_)
+            {
+            case send_queue_policy::drop:
+            {
+                for (auto iter = queue_.begin(); iter != queue_.end() && queued_bytes() >= send_queue_limit_;)
+                {
+                    if ((*iter)->has_flag(buffer_flag::droppable))
+                    {
+                        queued_bytes_ -= std::min(queued_bytes_, (*iter)->size());
+                        iter = queue_.erase(iter);
+                    }
+                    else
+                    {
+                        ++iter;
+                    }
+                }
+                if (queued_bytes() < send_queue_limit_)
+                {
+                    return true;
+                }
+                break;
+            }
+            case send_queue_policy::notify:
+            {
+                if (!congested_)
+                {
+                    congested_ = true;
+                    notify_send_queue("high"sv);
+                }
+                if (queued_bytes() < send_queue_limit_ * 4)
+                {
+                    return true;
+                }
+                break;
+            }
+            default:
+                break;
+            }
+
+            CONSOLE_DEBUG(logger(), "network send queue too long. bytes:%zu", queued_bytes());
+            logic_error_ = network_logic_error::send_message_queue_size_max;
+            close();
+            return false;
+        }
+
+        void notify_send_queue(string_view_t header)
+        {
+            //send is called by the owner service, do not call back into it
+            asio::post(socket_.get_executor(), [this, self = shared_from_this(), header]() {
+                auto msg = message::create();
+                msg->write_string(std::to_string(queued_bytes()));
+                msg->set_header(header);
+                msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_send_queue));
+                handle_message(std::move(msg));
+            });
+        }
+
         virtual void error(const asio::error_code& e, int lerrcode, const char* lerrmsg = nullptr)
         {
             //error
@@ -290,10 +481,20 @@ namespace moon
         }
     protected:
         bool sending_ = false;
+        bool paused_ = false;
+        bool congested_ = false;
+        send_queue_policy policy_ = send_queue_policy::close;
         network_logic_error logic_error_ = network_logic_error::ok;
         uint32_t fd_ = 0;
-        time_t recvtime_ = 0;
-        uint32_t timeout_ = 0;
+        timer_id_t read_timer_ = 0;
+        timer_id_t write_timer_ = 0;
+        uint32_t read_timeout_ = 0;
+        uint32_t write_timeout_ = 0;
+        int64_t recvtime_ = 0;
+        int64_t sendtime_ = 0;
+        size_t queued_bytes_ = 0;
+        size_t sending_bytes_ = 0;
+        size_t send_queue_limit_ = MAX_NET_SEND_QUEUE_BYTES;
         moon::log* log_ = nullptr;
         uint32_t serviceid_;
         uint8_t type_;
@@ -304,5 +505,6 @@ namespace moon
         handler_allocator wallocator_;
         const_buffers_holder  holder_;
         std::deque<buffer_ptr_t> queue_;
+        std::function<void()> resume_read_;
     };
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+#include "common/timer.hpp"
+
+namespace moon
+{
+    //read or write deadline of a connection
+    struct deadline_context
+    {
+        uint32_t fd = 0;
+        bool write = false;
+    };
+
+    /*
+        Per worker wheel of connection deadlines.
+        Receiving data only stamps the connection, a deadline is checked when its slot expires
+        and added again for the remaining time, so busy connections do not touch the wheel.
+    */
+    class connection_timer :public base_timer<connection_timer, deadline_context>
+    {
+        using timer_handler_t = std::function<void(timer_id_t, const deadline_context&)>;
+
+        friend class base_timer<connection_timer, deadline_context>;
+    public:
+        timer_id_t once(int32_t duration, uint32_t fd, bool write)
+        {
+            return add(duration, 1, deadline_context{ fd, write });
+        }
+
+        void set_on_timer(const timer_handler_t& v)
+        {
+            on_timer_ = v;
+        }
+
+    private:
+        void on_timer(timer_id_t id, deadline_context& ctx, bool)
+        {
+            on_timer_(id, ctx);
+        }
+    private:
+        timer_handler_t on_timer_;
+    };
+}
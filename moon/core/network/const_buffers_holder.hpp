@@ -5,8 +5,21 @@
 
 namespace moon
 {
+    /*
+        Buffers of one async_write.
+        Small buffers and frame headers are copied into a contiguous arena, consecutive copies share one iovec.
+        Large buffers are referenced, one iovec each. Arena offsets are resolved in buffers(),
+        so the arena may grow while the batch is built. Storage is kept between rounds.
+    */
     class const_buffers_holder
     {
+        struct segment
+        {
+            //nullptr means data is in arena at offset
+            const char* data;
+            size_t offset;
+            size_t size;
+        };
     public:
         const_buffers_holder() = default;
 
@@ -17,22 +30,28 @@ namespace moon
             {
                 close_ = true;
             }
-            buffers_.emplace_back(buf->data(), buf->size());
+
+            if (buf->size() <= SEND_COALESCE_SIZE)
+            {
+                append_arena(buf->data(), buf->size());
+                return;
+            }
+
+            segments_.push_back(segment{ buf->data(), 0, buf->size() });
+            bytes_ += buf->size();
             datas_.push_back(std::forward<BufType>(buf));
         }
 
-
         void framing_begin(size_t framing_size)
         {
-            headers_.reserve(framing_size);
+            segments_.reserve(segments_.size() + framing_size * 2);
         }
 
         void push_framing(message_size_t header, const char* data, size_t len)
         {
-            headers_.push_back(header);
-            message_size_t& back = headers_.back();
-            buffers_.emplace_back(reinterpret_cast<const char*>(&back), sizeof(back));
-            buffers_.emplace_back(data, len);
+            append_arena(reinterpret_cast<const char*>(&header), sizeof(header));
+            segments_.push_back(segment{ data, 0, len });
+            bytes_ += len;
         }
 
         template<typename BufType>
@@ -41,38 +60,63 @@ namespace moon
             datas_.push_back(std::forward<BufType>(buf));
         }
 
-        const auto& buffers() const
+        const std::vector<asio::const_buffer>& buffers()
         {
+            buffers_.clear();
+            for (const auto& seg : segments_)
+            {
+                const char* p = (nullptr == seg.data) ? arena_.data() + seg.offset : seg.data;
+                buffers_.emplace_back(p, seg.size);
+            }
             return buffers_;
         }
 
+        //iovec count
         size_t size() const
         {
-            return buffers_.size();
+            return segments_.size();
+        }
+
+        size_t bytes() const
+        {
+            return bytes_;
         }
 
         void clear()
         {
             close_ = false;
+            bytes_ = 0;
+            segments_.clear();
             buffers_.clear();
             datas_.clear();
-            headers_.clear();
+            arena_.clear();
         }
 
         bool close() const
         {
             return close_;
         }
+    private:
+        void append_arena(const char* data, size_t len)
+        {
+            if (!segments_.empty() && nullptr == segments_.back().data)
+            {
+                //previous segment ends at arena tail
+                segments_.back().size += len;
+            }
+            else
+            {
+                segments_.push_back(segment{ nullptr, arena_.size(), len });
+            }
+            arena_.append(data, len);
+            bytes_ += len;
+        }
     private:
         bool close_ = false;
+        size_t bytes_ = 0;
+        std::vector<segment> segments_;
         std::vector<asio::const_buffer> buffers_;
         std::vector<buffer_ptr_t> datas_;
-        std::vector<message_size_t> headers_;
+        std::string arena_;
     };
 }
-
-
-
-
-
-
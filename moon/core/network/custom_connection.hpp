@@ -65,6 +65,11 @@ namespace moon
     protected:
         void read_some()
         {
+            if (hold_read([this] { read_some(); }))
+            {
+                return;
+            }
+
             auto buf = response_->get_buffer();
             buf->check_space(8192);
             socket_.async_read_some(asio::buffer((buf->data() + buf->size()), buf->writeablesize()),
@@ -150,12 +155,25 @@ namespace moon
             default:
                 break;
             }
+            detach_viewed();
+        }
+
+        //a buffer_view of the last response still references the buffer, read into a new one
+        void detach_viewed()
+        {
+            if (response_->shared())
+            {
+                auto m = message::create(std::max<size_t>(8192, response_->size()));
+                m->write_data(response_->bytes());
+                response_ = std::move(m);
+            }
         }
 
         void error(const asio::error_code& e, int logicerr, const char* lerrmsg = nullptr) override
         {
             (void)lerrmsg;
 
+            detach_viewed();
             response_->get_buffer()->clear();
 
             if (e && e != asio::error::eof)
@@ -10,6 +10,7 @@ namespace moon
         static constexpr message_size_t MASK_CONTINUED = 0x8000;
         static constexpr message_size_t MASK_SIZE = 0x7FFF;
         static constexpr message_size_t MAX_MSG_FRAME_SIZE = MAX_NET_MSG_SIZE - sizeof(message_size_t);
+        static constexpr size_t READ_BUFFER_SIZE = 8192;
 
         using base_connection_t = base_connection;
 
@@ -17,7 +18,7 @@ namespace moon
         explicit moon_connection(Args&&... args)
             :base_connection(std::forward<Args>(args)...)
             , flag_(frame_enable_flag::none)
-            , header_(0)
+            , recv_buf_(message::create_buffer(READ_BUFFER_SIZE))
         {
         }
 
@@ -28,11 +29,16 @@ namespace moon
             m->write_data(addr_);
             m->set_subtype(static_cast<uint8_t>(accepted ? socket_data_type::socket_accept : socket_data_type::socket_connect));
             handle_message(std::move(m));
-            read_header();
+            read_some();
         }
 
         bool send(const buffer_ptr_t & data) override
         {
+            if (length_ != frame_length::u16)
+            {
+                return send_wide(data);
+            }
+
             if (!data->has_flag(buffer_flag::pack_size))
             {
                 if (data->size() > MAX_MSG_FRAME_SIZE)
@@ -62,7 +68,53 @@ namespace moon
         {
             flag_ = v;
         }
+
+        void set_frame_length(frame_length v)
+        {
+            length_ = v;
+        }
     protected:
+        //32 bit or varint length, a message is always one frame
+        bool send_wide(const buffer_ptr_t & data)
+        {
+            if (!data->has_flag(buffer_flag::pack_size))
+            {
+                if (data->size() > MAX_WIDE_NET_MSG_SIZE)
+                {
+                    error(asio::error_code(), int(network_logic_error::send_message_size_max));
+                    base_connection_t::close();
+                    return false;
+                }
+
+                uint8_t header[5];
+                size_t n = 0;
+                uint32_t size = static_cast<uint32_t>(data->size());
+                if (length_ == frame_length::u32)
+                {
+                    host2net(size);
+                    memcpy(header, &size, sizeof(size));
+                    n = sizeof(size);
+                }
+                else
+                {
+                    do
+                    {
+                        header[n] = static_cast<uint8_t>(size & 0x7F);
+                        size >>= 7;
+                        if (size != 0)
+                        {
+                            header[n] |= 0x80;
+                        }
+                        ++n;
+                    } while (size != 0);
+                }
+                [[maybe_unused]]  bool res = data->write_front(header, 0, n);
+                MOON_ASSERT(res, "tcp::send write front failed");
+                data->set_flag(buffer_flag::pack_size);
+            }
+            return base_connection_t::send(data);
+        }
+
         void message_framing(const_buffers_holder& holder, buffer_ptr_t&& buf) override
         {
             size_t n = buf->size();
@@ -87,9 +139,16 @@ namespace moon
             holder.framing_end(std::forward<buffer_ptr_t>(buf));
         }
 
-        void read_header()
+        //one read takes as many bytes as the socket has, then every complete frame in it is handled
+        void read_some()
         {
-            asio::async_read(socket_, asio::buffer(&header_, sizeof(header_)),
+            if (hold_read([this] { read_some(); }))
+            {
+                return;
+            }
+
+            recv_buf_->check_space(std::max(READ_BUFFER_SIZE, need_));
+            socket_.async_read_some(asio::buffer(recv_buf_->data() + recv_buf_->size(), recv_buf_->writeablesize()),
                 make_custom_alloc_handler(rallocator_,
                     [this, self = shared_from_this()](const asio::error_code& e, std::size_t bytes_transferred)
             {
@@ -101,49 +160,165 @@ namespace moon
 
                 if (bytes_transferred == 0)
                 {
-                    read_header();
+                    read_some();
                     return;
                 }
 
                 recvtime_ = now();
-                net2host(header_);
+                recv_buf_->offset_writepos(static_cast<int>(bytes_transferred));
+                if (!parse_frames())
+                {
+                    return;
+                }
+                read_some();
+            }));
+        }
 
-                bool enable = (static_cast<int>(flag_)&static_cast<int>(frame_enable_flag::receive)) != 0;
-                bool continued = false;
-                if (enable)
+        //false means caller must not read: connection closed or a large frame read is pending
+        bool parse_frames()
+        {
+            need_ = 0;
+            size_t header_size = 0;
+            size_t header = 0;
+            bool continued = false;
+            while (read_length(header_size, header, continued))
+            {
+                if (!socket_.is_open())
                 {
-                    //check is continued message
-                    continued = ((header_ & MASK_CONTINUED) != 0);
-                    if (continued)
-                    {
-                        header_ &= MASK_SIZE;
-                    }
+                    return false;
                 }
 
-                if (header_ > MAX_NET_MSG_SIZE)
+                if (header > max_frame_size())
                 {
                     error(asio::error_code(), int(network_logic_error::read_message_size_max));
                     base_connection_t::close();
-                    return;
+                    return false;
                 }
-                read_body(header_, continued);
-            }));
+
+                size_t frame_size = header_size + header;
+                if (recv_buf_->size() < frame_size)
+                {
+                    if (header > READ_BUFFER_SIZE && !continued && nullptr == buf_)
+                    {
+                        //large frame: body goes straight into its own buffer, allocated once
+                        read_large(header_size, header);
+                        return false;
+                    }
+                    //wait for the rest, make sure it fits in one read
+                    need_ = frame_size - recv_buf_->size();
+                    break;
+                }
+
+                const char* body = recv_buf_->data() + header_size;
+                if (continued || nullptr != buf_)
+                {
+                    if (nullptr == buf_)
+                    {
+                        buf_ = message::create_buffer(5 * header);
+                    }
+                    buf_->write_back(body, 0, header);
+                    if (!continued)
+                    {
+                        emit(std::move(buf_));
+                    }
+                }
+                else if (header != 0)
+                {
+                    //buffer object comes from pool, small frames fit in its inline storage
+                    auto buf = message::create_buffer(header);
+                    buf->write_back(body, 0, header);
+                    emit(std::move(buf));
+                }
+                recv_buf_->seek(static_cast<int>(frame_size));
+            }
+            return socket_.is_open();
         }
 
-        void read_body(message_size_t size, bool continued)
+        //false when more bytes are needed
+        bool read_length(size_t& header_size, size_t& len, bool& continued) const
         {
-            if (nullptr == buf_)
+            auto p = reinterpret_cast<const uint8_t*>(recv_buf_->data());
+            size_t n = recv_buf_->size();
+            continued = false;
+            switch (length_)
             {
-                buf_ = message::create_buffer(continued ? 5 * size : size);
+            case frame_length::u32:
+            {
+                uint32_t v = 0;
+                if (n < sizeof(v))
+                {
+                    return false;
+                }
+                memcpy(&v, p, sizeof(v));
+                net2host(v);
+                header_size = sizeof(v);
+                len = v;
+                return true;
             }
-            else
+            case frame_length::varint:
             {
-                buf_->check_space(size);
+                size_t v = 0;
+                for (size_t i = 0; i < n && i < 5; ++i)
+                {
+                    v |= static_cast<size_t>(p[i] & 0x7F) << (7 * i);
+                    if ((p[i] & 0x80) == 0)
+                    {
+                        header_size = i + 1;
+                        len = v;
+                        return true;
+                    }
+                }
+                if (n >= 5)
+                {
+                    //malformed, treat as too large
+                    header_size = 5;
+                    len = std::numeric_limits<size_t>::max();
+                    return true;
+                }
+                return false;
             }
+            default:
+            {
+                message_size_t v = 0;
+                if (n < sizeof(v))
+                {
+                    return false;
+                }
+                memcpy(&v, p, sizeof(v));
+                net2host(v);
+                if ((static_cast<int>(flag_)&static_cast<int>(frame_enable_flag::receive)) != 0)
+                {
+                    //check is continued message
+                    continued = ((v & MASK_CONTINUED) != 0);
+                    if (continued)
+                    {
+                        v &= MASK_SIZE;
+                    }
+                }
+                header_size = sizeof(v);
+                len = v;
+                return true;
+            }
+            }
+        }
 
-            asio::async_read(socket_, asio::buffer((buf_->data() + buf_->size()), size),
+        size_t max_frame_size() const
+        {
+            return (length_ == frame_length::u16) ? MAX_NET_MSG_SIZE : MAX_WIDE_NET_MSG_SIZE;
+        }
+
+        //move received part of the frame into a buffer of full size, read the rest into it
+        void read_large(size_t header_size, size_t len)
+        {
+            buf_ = message::create_buffer(len);
+            recv_buf_->seek(static_cast<int>(header_size));
+            size_t received = recv_buf_->size();
+            buf_->write_back(recv_buf_->data(), 0, received);
+            recv_buf_->clear();
+
+            asio::async_read(socket_, asio::buffer(buf_->data() + buf_->size(), len - received),
                 make_custom_alloc_handler(rallocator_,
-                    [this, self = shared_from_this(), continued](const asio::error_code& e, std::size_t bytes_transferred)
+                    [this, self = shared_from_this()](const asio::error_code& e, std::size_t bytes_transferred)
             {
                 if (e)
                 {
@@ -151,27 +326,30 @@ namespace moon
                     return;
                 }
 
-                if (bytes_transferred == 0)
-                {
-                    read_header();
-                    return;
-                }
-
+                recvtime_ = now();
                 buf_->offset_writepos(static_cast<int>(bytes_transferred));
-                if (!continued)
+                emit(std::move(buf_));
+                if (socket_.is_open())
                 {
-                    auto m = message::create(std::move(buf_));
-                    m->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
-                    handle_message(std::move(m));
+                    read_some();
                 }
-
-                read_header();
             }));
         }
 
+        void emit(buffer_ptr_t&& buf)
+        {
+            auto m = message::create(std::move(buf));
+            m->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
+            handle_message(std::move(m));
+        }
+
     protected:
         frame_enable_flag flag_;
-        message_size_t header_;
+        frame_length length_ = frame_length::u16;
+        //bytes missing for the frame at recv_buf_ head
+        size_t need_ = 0;
+        buffer_ptr_t recv_buf_;
+        //continued frames are joined here
         buffer_ptr_t buf_;
     };
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "network/moon_connection.hpp"
 #include "network/custom_connection.hpp"
 #include "network/ws_connection.hpp"
+#include "network/udp_socket.hpp"
 
 using namespace moon;
 
@@ -17,14 +18,19 @@ socket::socket(router * r, worker* w, asio::io_context & ioctx)
     , timer_(ioctx)
 {
     response_ = message::create();
-    timeout();
+    deadline_.set_on_timer([this](timer_id_t id, const deadline_context& ctx) {
+        if (auto iter = connections_.find(ctx.fd); iter != connections_.end())
+        {
+            iter->second->deadline(id, ctx.write);
+        }
+    });
 }
 
-uint32_t socket::listen(const std::string & ip, uint16_t port, uint32_t owner, uint8_t type)
+uint32_t socket::listen(const std::string & ip, uint16_t port, uint32_t owner, uint8_t type, const connection_options& opt)
 {
     try
     {
-        auto ctx = std::make_shared<socket::acceptor_context>(type, owner, ioc_);
+        auto ctx = std::make_shared<socket::acceptor_context>(type, owner, opt, ioc_);
         asio::ip::tcp::resolver resolver(ioc_);
         asio::ip::tcp::resolver::query query(ip, std::to_string(port));
         auto iter = resolver.resolve(query);
@@ -32,6 +38,22 @@ uint32_t socket::listen(const std::string & ip, uint16_t port, uint32_t owner, u
         ctx->acceptor.open(endpoint.protocol());
 #if TARGET_PLATFORM != PLATFORM_WINDOWS
         ctx->acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#endif
+        if (opt.reuseport)
+        {
+#ifdef SO_REUSEPORT
+            ctx->acceptor.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#else
+            //binding once would leave the other workers' acceptors failing or the load on one worker
+            CONSOLE_ERROR(router_->logger(), "%s:%d SO_REUSEPORT is not supported on this platform", ip.data(), port);
+            return 0;
+#endif
+        }
+#ifndef MOON_WS_DEFLATE
+        if (opt.deflate.enable)
+        {
+            CONSOLE_WARN(router_->logger(), "%s:%d permessage-deflate is not built in, listen without it", ip.data(), port);
+        }
 #endif
         ctx->acceptor.bind(endpoint);
         ctx->acceptor.listen(std::numeric_limits<int>::max());
@@ -39,6 +61,7 @@ uint32_t socket::listen(const std::string & ip, uint16_t port, uint32_t owner, u
         auto id = uuid();
         ctx->fd = id;
         acceptors_.emplace(id, ctx);
+        router_->pin_service(owner);
         return id;
     }
     catch (asio::system_error& e)
@@ -64,8 +87,8 @@ void socket::accept(int fd, int32_t sessionid, uint32_t owner)
         return;
     }
 
-    worker* w = router_->get_worker(router_->worker_id(owner));
-    auto c = w->socket().make_connection(owner, ctx->type);
+    worker* w = router_->pin_service(owner);
+    auto c = w->socket().make_connection(owner, ctx->type, ctx->options);
 
     ctx->acceptor.async_accept(c->socket(), [this, ctx, c, w, sessionid, owner](const asio::error_code& e)
     {
@@ -100,7 +123,7 @@ void socket::accept(int fd, int32_t sessionid, uint32_t owner)
     });
 }
 
-int socket::connect(const std::string& host, uint16_t port, uint32_t serviceid, uint32_t owner, uint8_t type, int32_t sessionid, int32_t timeout)
+int socket::connect(const std::string& host, uint16_t port, uint32_t serviceid, uint32_t owner, uint8_t type, int32_t sessionid, int32_t timeout, const connection_options& opt)
 {
     try
     {
@@ -108,8 +131,14 @@ int socket::connect(const std::string& host, uint16_t port, uint32_t serviceid,
         asio::ip::tcp::resolver::query query(host, std::to_string(port));
         asio::ip::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
 
-        worker* w = router_->get_worker(router_->worker_id(owner));
-        auto c = w->socket().make_connection(owner, type);
+        //connect response is delivered by this worker
+        router_->pin_service(serviceid);
+        worker* w = router_->pin_service(owner);
+        auto c = w->socket().make_connection(owner, type, opt);
+        if (type == PTYPE_SOCKET_WS)
+        {
+            std::static_pointer_cast<ws_connection>(c)->set_client(host + ":" + std::to_string(port), opt.ws_path);
+        }
 
         if (0 == sessionid)
         {
@@ -175,6 +204,40 @@ int socket::connect(const std::string& host, uint16_t port, uint32_t serviceid,
     return 0;
 }
 
+uint32_t socket::udp(const std::string& ip, uint16_t port, uint32_t owner, const udp_options& opt)
+{
+    try
+    {
+        asio::ip::udp::resolver resolver(ioc_);
+        asio::ip::udp::endpoint endpoint = *resolver.resolve(ip, std::to_string(port)).begin();
+        auto s = std::make_shared<udp_socket>(owner, opt, this, ioc_);
+        s->socket().open(endpoint.protocol());
+        s->socket().bind(endpoint);
+
+        auto id = uuid();
+        s->fd(id);
+        udps_.emplace(id, s);
+        router_->pin_service(owner);
+        s->start();
+        return id;
+    }
+    catch (asio::system_error& e)
+    {
+        CONSOLE_ERROR(router_->logger(), "udp %s:%d %s(%d)", ip.data(), port, e.what(), e.code().value());
+        return 0;
+    }
+}
+
+bool socket::sendto(uint32_t fd, const std::string& addr, const buffer_ptr_t& data)
+{
+    auto iter = udps_.find(fd);
+    if (iter == udps_.end())
+    {
+        return false;
+    }
+    return iter->second->send_to(addr, data);
+}
+
 void socket::read(uint32_t fd, uint32_t owner, size_t n, read_delim delim, int32_t sessionid)
 {
     do
@@ -216,9 +279,65 @@ bool socket::write_with_flag(uint32_t fd, const buffer_ptr_t & data, int flag)
 
 bool socket::write_message(uint32_t fd, message * m)
 {
+    if (m->shared())
+    {
+        //payload is shared by other receivers, connection writes frame header into the buffer
+        auto buf = message::create_buffer(m->size());
+        buf->write_back(m->data(), 0, m->size());
+        return write(fd, buf);
+    }
     return write(fd, *m);
 }
 
+size_t socket::broadcast_ws(const std::vector<uint32_t>& fds, const buffer_ptr_t& data, bool text)
+{
+    //frames indexed by window bits, 0 is the uncompressed one
+    buffer_ptr_t frames[MAX_WS_WINDOW_BITS + 1];
+    size_t n = 0;
+    for (auto fd : fds)
+    {
+        auto iter = connections_.find(fd);
+        if (iter == connections_.end())
+        {
+            continue;
+        }
+        auto c = std::dynamic_pointer_cast<ws_connection>(iter->second);
+        if (nullptr == c)
+        {
+            continue;
+        }
+        if (c->client())
+        {
+            //client frames are masked, each one is made alone
+            if (c->send(data, text))
+            {
+                ++n;
+            }
+            continue;
+        }
+        auto bits = c->deflate_bits(data->size());
+        auto& frame = frames[bits];
+        if (nullptr == frame)
+        {
+            frame = ws_connection::make_frame(data, text, bits);
+            if (nullptr == frame)
+            {
+                //compression failed, fall back to plain frame
+                if (nullptr == frames[0])
+                {
+                    frames[0] = ws_connection::make_frame(data, text, 0);
+                }
+                frame = frames[0];
+            }
+        }
+        if (c->send_frame(frame, frame != frames[0]))
+        {
+            ++n;
+        }
+    }
+    return n;
+}
+
 bool socket::close(uint32_t fd,bool remove)
 {
     if (auto iter = connections_.find(fd); iter != connections_.end())
@@ -226,6 +345,14 @@ bool socket::close(uint32_t fd,bool remove)
         iter->second->close();
         if (remove)
         {
+            if (auto it = owner_fds_.find(iter->second->owner()); it != owner_fds_.end())
+            {
+                it->second.erase(fd);
+                if (it->second.empty())
+                {
+                    owner_fds_.erase(it);
+                }
+            }
             connections_.erase(iter);
             unlock_fd(fd);
         }
@@ -246,14 +373,37 @@ bool socket::close(uint32_t fd,bool remove)
         }
         return true;
     }
+
+    if (auto iter = udps_.find(fd); iter != udps_.end())
+    {
+        iter->second->close();
+        udps_.erase(iter);
+        unlock_fd(fd);
+        return true;
+    }
     return false;
 }
 
 bool socket::settimeout(uint32_t fd, int v)
+{
+    return set_read_timeout(fd, static_cast<uint32_t>(std::max(v, 0)) * 1000);
+}
+
+bool socket::set_read_timeout(uint32_t fd, uint32_t ms)
 {
     if (auto iter = connections_.find(fd); iter != connections_.end())
     {
-        iter->second->settimeout(v);
+        iter->second->set_read_timeout(ms);
+        return true;
+    }
+    return false;
+}
+
+bool socket::set_write_timeout(uint32_t fd, uint32_t ms)
+{
+    if (auto iter = connections_.find(fd); iter != connections_.end())
+    {
+        iter->second->set_write_timeout(ms);
         return true;
     }
     return false;
@@ -269,6 +419,15 @@ bool socket::setnodelay(uint32_t fd)
     return false;
 }
 
+size_t socket::queued_bytes(uint32_t fd) const
+{
+    if (auto iter = connections_.find(fd); iter != connections_.end())
+    {
+        return iter->second->queued_bytes();
+    }
+    return 0;
+}
+
 bool socket::set_enable_frame(uint32_t fd, std::string flag)
 {
     moon::lower(flag);
@@ -326,14 +485,16 @@ uint32_t socket::uuid()
     return res;
 }
 
-connection_ptr_t socket::make_connection(uint32_t serviceid, uint8_t type)
+connection_ptr_t socket::make_connection(uint32_t serviceid, uint8_t type, const connection_options& opt)
 {
     connection_ptr_t connection;
     switch (type)
     {
     case PTYPE_SOCKET:
     {
-        connection = std::make_shared<moon_connection>(serviceid, type, this, ioc_);
+        auto c = std::make_shared<moon_connection>(serviceid, type, this, ioc_);
+        c->set_frame_length(opt.length);
+        connection = std::move(c);
         break;
     }
     case PTYPE_TEXT:
@@ -343,13 +504,17 @@ connection_ptr_t socket::make_connection(uint32_t serviceid, uint8_t type)
     }
     case PTYPE_SOCKET_WS:
     {
-        connection = std::make_shared<ws_connection>(serviceid, type, this, ioc_);
+        auto c = std::make_shared<ws_connection>(serviceid, type, this, ioc_);
+        c->set_deflate(opt.deflate);
+        c->set_fragment(opt.ws_fragment);
+        connection = std::move(c);
         break;
     }
     default:
         break;
     }
     connection->logger(router_->logger());
+    connection->set_send_queue(opt.send_queue_limit, opt.policy);
     return connection;
 }
 
@@ -385,29 +550,68 @@ void socket::add_connection(const connection_ptr_t & c, bool accepted)
 {
     asio::dispatch(ioc_, [c, accepted, this]() mutable {
         connections_.emplace(c->fd(), c);
+        owner_fds_[c->owner()].emplace(c->fd());
         c->start(accepted);
     });
 }
 
+void socket::pause_read(uint32_t owner, bool v)
+{
+    auto iter = owner_fds_.find(owner);
+    if (iter == owner_fds_.end())
+    {
+        return;
+    }
+    for (auto fd : iter->second)
+    {
+        if (auto c = connections_.find(fd); c != connections_.end())
+        {
+            c->second->pause_read(v);
+        }
+    }
+}
+
 service * socket::find_service(uint32_t serviceid)
 {
     return worker_->find_service(serviceid);;
 }
 
-void socket::timeout()
+timer_id_t socket::add_deadline(uint32_t fd, int64_t ms, bool write)
+{
+    auto id = deadline_.once(static_cast<int32_t>(std::min<int64_t>(ms, std::numeric_limits<int32_t>::max())), fd, write);
+    arm_deadline();
+    return id;
+}
+
+void socket::remove_deadline(timer_id_t id)
+{
+    deadline_.remove(id);
+}
+
+void socket::arm_deadline()
 {
-    timer_.expires_from_now(std::chrono::seconds(10));
+    auto wait = deadline_.wait_time();
+    if (wait < 0)
+    {
+        return;
+    }
+
+    auto expiry = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait);
+    if (timer_armed_ && timer_.expiry() <= expiry)
+    {
+        return;
+    }
+
+    //re-arm cancels the previous wait
+    timer_armed_ = true;
+    timer_.expires_at(expiry);
     timer_.async_wait([this](const asio::error_code & e) {
         if (e)
         {
             return;
         }
-
-        auto now = base_connection::now();
-        for (auto& connection : connections_)
-        {
-            connection.second->timeout(now);
-        }
-        timeout();
+        timer_armed_ = false;
+        deadline_.update();
+        arm_deadline();
     });
 }
@@ -4,6 +4,7 @@
 #include "common/utils.hpp"
 #include "asio.hpp"
 #include "service.hpp"
+#include "connection_timer.hpp"
 
 namespace moon
 {
@@ -13,7 +14,8 @@ namespace moon
         socket_accept = 2,
         socket_recv = 3,
         socket_close = 4,
-        socket_error = 5
+        socket_error = 5,
+        socket_send_queue = 6,//send queue crossed the limit(header "high") or drained below half(header "low")
     };
 
     enum class network_logic_error :std::uint8_t
@@ -22,7 +24,8 @@ namespace moon
         read_message_size_max = 1, // read message size too long
         send_message_size_max = 2, // send message size too long
         timeout = 3, //socket read time out
-        send_message_queue_size_max = 4, // send message queue size too long
+        send_message_queue_size_max = 4, // unsent bytes over send queue limit
+        write_timeout = 5, //socket write time out
     };
 
     inline const char* logic_errmsg(int logic_errcode)
@@ -32,7 +35,8 @@ namespace moon
             "read message size too long",
             "send message size too long",
             "timeout",
-            "send message queue size too long"
+            "send message queue size too long",
+            "write timeout"
         };
         if (logic_errcode >= static_cast<int>(array_szie(errmsg)))
         {
@@ -57,20 +61,79 @@ namespace moon
         both = 3,
     };
 
+    //length prefix of PTYPE_SOCKET frames
+    enum class frame_length :std::uint8_t
+    {
+        u16,//2 bytes big endian, default wire format, larger messages need frame flag
+        u32,//4 bytes big endian
+        varint,//base 128, low 7 bits first, at most 5 bytes
+    };
+
+    //what a connection does when its unsent bytes reach the limit
+    enum class send_queue_policy :std::uint8_t
+    {
+        close,//close the connection
+        drop,//discard queued buffers flagged droppable, oldest first, close if still over limit
+        notify,//tell the owner with socket_send_queue, keep queueing, close at 4 times the limit
+    };
+
+    //websocket permessage-deflate, needs build with MOON_WS_DEFLATE(zlib)
+    struct ws_deflate_options
+    {
+        bool enable = false;
+        //server_max_window_bits, 9-15, a client offering less is answered without compression
+        uint8_t window_bits = 15;
+        //false: server_no_context_takeover, each message is compressed alone
+        bool context_takeover = true;
+        //smaller messages are sent uncompressed
+        uint32_t threshold = 256;
+    };
+
+    //options a listener gives to accepted connections, also used by connect
+    struct connection_options
+    {
+        frame_length length = frame_length::u16;
+        size_t send_queue_limit = MAX_NET_SEND_QUEUE_BYTES;
+        send_queue_policy policy = send_queue_policy::close;
+        ws_deflate_options deflate;
+        //websocket: outgoing messages larger than this are sent as fragments, 0 means never
+        uint32_t ws_fragment = 0;
+        //connect only: websocket request target
+        std::string ws_path = "/";
+        //listen only: SO_REUSEPORT, services on different workers listen on the same port,
+        //kernel spreads connections, each is handled by the worker that accepted it
+        bool reuseport = false;
+    };
+
+    struct udp_options
+    {
+        //reliable ordered delivery per peer, see udp_socket
+        bool arq = false;
+        //percent of outgoing datagrams dropped on purpose, for testing
+        uint32_t loss = 0;
+        //arq only: ms without traffic before a peer with nothing unacked is forgotten
+        uint32_t peer_timeout = 60000;
+        //arq only: datagrams from more peers than this are dropped, sendto to a new peer fails
+        uint32_t max_peers = 1024;
+    };
+
     class router;
     class worker;
     class service;
     class base_connection;
+    class udp_socket;
 
     using connection_ptr_t = std::shared_ptr<base_connection>;
+    using udp_socket_ptr_t = std::shared_ptr<udp_socket>;
 
     class socket
     {
         struct acceptor_context
         {
-            acceptor_context(uint8_t t, uint32_t o, asio::io_context& ioc)
+            acceptor_context(uint8_t t, uint32_t o, const connection_options& opt, asio::io_context& ioc)
                 :type(t)
                 , owner(o)
+                , options(opt)
                 , acceptor(ioc)
             {
 
@@ -78,6 +141,7 @@ namespace moon
 
             uint8_t type;
             uint32_t owner;
+            connection_options options;
             uint32_t fd = 0;
             asio::ip::tcp::acceptor acceptor;
         };
@@ -85,6 +149,7 @@ namespace moon
         using acceptor_context_ptr_t = std::shared_ptr<acceptor_context>;
     public:
         friend class base_connection;
+        friend class udp_socket;
 
         static constexpr size_t max_socket_num = 0xFFFF;
 
@@ -94,11 +159,15 @@ namespace moon
 
         socket& operator =(const socket&) = delete;
 
-        uint32_t listen(const std::string& ip, uint16_t port, uint32_t owner, uint8_t type);
+        uint32_t listen(const std::string& ip, uint16_t port, uint32_t owner, uint8_t type, const connection_options& opt = connection_options{});
 
         void accept(int fd, int32_t sessionid, uint32_t owner);
 
-        int connect(const std::string& host, uint16_t port, uint32_t serviceid, uint32_t owner, uint8_t type, int32_t sessionid, int32_t timeout = 0);
+        int connect(const std::string& host, uint16_t port, uint32_t serviceid, uint32_t owner, uint8_t type, int32_t sessionid, int32_t timeout = 0, const connection_options& opt = connection_options{});
+
+        uint32_t udp(const std::string& ip, uint16_t port, uint32_t owner, const udp_options& opt = udp_options{});
+
+        bool sendto(uint32_t fd, const std::string& addr, const buffer_ptr_t& data);
 
         void read(uint32_t fd, uint32_t owner, size_t n, read_delim delim, int32_t sessionid);
 
@@ -108,17 +177,32 @@ namespace moon
 
         bool write_message(uint32_t fd, message * msg);
 
+        //websocket frame built once per negotiated compression parameters and shared by all connections,
+        //only connections of this worker are written, returns the number written
+        size_t broadcast_ws(const std::vector<uint32_t>& fds, const buffer_ptr_t& data, bool text);
+
         bool close(uint32_t fd, bool remove = false);
 
+        //read timeout in seconds
         bool settimeout(uint32_t fd, int v);
 
+        bool set_read_timeout(uint32_t fd, uint32_t ms);
+
+        bool set_write_timeout(uint32_t fd, uint32_t ms);
+
         bool setnodelay(uint32_t fd);
 
+        //unsent bytes of the connection, 0 if fd is not a connection of this worker
+        size_t queued_bytes(uint32_t fd) const;
+
         bool set_enable_frame(uint32_t fd, std::string flag);
+
+        //pause or resume reads of all connections owned by the service
+        void pause_read(uint32_t owner, bool v);
     private:
         uint32_t uuid();
 
-        connection_ptr_t make_connection(uint32_t serviceid, uint8_t type);
+        connection_ptr_t make_connection(uint32_t serviceid, uint8_t type, const connection_options& opt);
 
         void response(uint32_t sender, uint32_t receiver, string_view_t data, string_view_t header, int32_t sessionid, uint8_t type);
 
@@ -133,17 +217,26 @@ namespace moon
 
         service* find_service(uint32_t serviceid);
 
-        void timeout();
+        timer_id_t add_deadline(uint32_t fd, int64_t ms, bool write);
+
+        void remove_deadline(timer_id_t id);
+
+        void arm_deadline();
     private:
         std::atomic<uint32_t> uuid_ = 0;
         router* router_;
         worker* worker_;
         asio::io_context& ioc_;
+        bool timer_armed_ = false;
         asio::steady_timer timer_;
+        connection_timer deadline_;
         message_ptr_t  response_;
         mutable rwlock lock_;
         std::unordered_map<uint32_t, acceptor_context_ptr_t> acceptors_;
         std::unordered_map<uint32_t, connection_ptr_t> connections_;
+        //connection fds of each owner service, pause_read touches only these
+        std::unordered_map<uint32_t, std::unordered_set<uint32_t>> owner_fds_;
+        std::unordered_map<uint32_t, udp_socket_ptr_t> udps_;
         std::unordered_set<uint32_t> fd_watcher_;
     };
 
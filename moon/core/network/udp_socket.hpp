@@ -0,0 +1,629 @@
+#pragma once
+#include <map>
+#include <random>
+#include "config.hpp"
+#include "asio.hpp"
+#include "message.hpp"
+#include "common/time.hpp"
+#include "common/byte_convert.hpp"
+#if TARGET_PLATFORM == PLATFORM_LINUX
+#include <sys/socket.h>
+#endif
+
+namespace moon
+{
+    /*
+        Datagram socket owned by one service.
+        Received datagrams are delivered as PTYPE_SOCKET socket_recv messages, message header is peer address "ip:port".
+        Linux receives and sends in batches with recvmmsg/sendmmsg, other platforms one datagram per call.
+
+        With arq enabled every peer gets a reliable ordered channel. Datagram is [cmd:1][session:4][seq:4][una:4][payload],
+        integers big endian, una is the oldest sequence the sender has not seen acked. Each data packet is acked, unacked packets are resent with growing timeout, receiver
+        delivers in sequence order. A peer that does not ack after ARQ_MAX_RETRY resends is reported with socket_error
+        and forgotten.
+        Sender picks a random session when it starts talking to a peer, sequences start at 0 in each session.
+        Receiver starts over at una when the session changes, so a restarted sender is not taken for old duplicates
+        and a restarted receiver does not wait for sequences its previous instance acked.
+        Peers idle for peer_timeout with nothing unacked are forgotten, at most max_peers are kept.
+    */
+    class udp_socket : public std::enable_shared_from_this<udp_socket>
+    {
+    public:
+        using endpoint_t = asio::ip::udp::endpoint;
+
+        static constexpr size_t BATCH = 16;
+        static constexpr uint8_t CMD_DATA = 1;
+        static constexpr uint8_t CMD_ACK = 2;
+        static constexpr size_t ARQ_HEAD_SIZE = 13;
+        static constexpr uint32_t ARQ_WINDOW = 256;//max sequences in flight per peer, more wait in queue
+        static constexpr int64_t ARQ_RTO = 30;//ms, grows 1.5x on each resend
+        static constexpr int64_t ARQ_RTO_MAX = 500;//ms
+        static constexpr uint32_t ARQ_MAX_RETRY = 20;
+        static constexpr int64_t ARQ_TICK = 10;//ms
+
+        udp_socket(uint32_t owner, const udp_options& opt, moon::socket* s, asio::io_context& ioc)
+            : arq_(opt.arq)
+            , loss_(opt.loss)
+            , peer_timeout_(opt.peer_timeout)
+            , max_peers_(opt.max_peers)
+            , owner_(owner)
+            , s_(s)
+            , socket_(ioc)
+            , tick_(ioc)
+            , expire_(ioc)
+            , recv_data_(new char[BATCH * UDP_MAX_PACKET])
+        {
+        }
+
+        udp_socket(const udp_socket&) = delete;
+
+        udp_socket& operator=(const udp_socket&) = delete;
+
+        asio::ip::udp::socket& socket()
+        {
+            return socket_;
+        }
+
+        void fd(uint32_t v)
+        {
+            fd_ = v;
+        }
+
+        uint32_t fd() const
+        {
+            return fd_;
+        }
+
+        void start()
+        {
+            asio::error_code ec;
+            socket_.non_blocking(true, ec);
+            read();
+        }
+
+        void close()
+        {
+            asio::error_code ignore_ec;
+            tick_.cancel(ignore_ec);
+            expire_.cancel(ignore_ec);
+            socket_.close(ignore_ec);
+            peers_.clear();
+            out_.clear();
+        }
+
+        bool send_to(const std::string& addr, const buffer_ptr_t& data)
+        {
+            if (!socket_.is_open() || nullptr == data || data->size() + ARQ_HEAD_SIZE > UDP_MAX_PACKET)
+            {
+                return false;
+            }
+
+            endpoint_t ep;
+            if (!to_endpoint(addr, ep))
+            {
+                return false;
+            }
+
+            if (!arq_)
+            {
+                push_out(ep, data);
+                return true;
+            }
+
+            peer* p = get_peer(addr, ep);
+            if (nullptr == p)
+            {
+                return false;
+            }
+            if (p->send_seq - p->send_una >= ARQ_WINDOW)
+            {
+                p->waiting.push_back(data);
+            }
+            else
+            {
+                send_data(*p, data);
+            }
+            return true;
+        }
+    private:
+        struct packet
+        {
+            buffer_ptr_t data;
+            int64_t resend_time;
+            int64_t rto;
+            uint32_t retry;
+        };
+
+        struct peer
+        {
+            endpoint_t ep;
+            int64_t last_active = 0;
+            uint32_t send_session = 0;
+            //session of received data, data of the session before it is stale
+            uint32_t recv_session = 0;
+            uint32_t prev_recv_session = 0;
+            //next sequence to send
+            uint32_t send_seq = 0;
+            //oldest sequence not acked
+            uint32_t send_una = 0;
+            //next sequence to deliver
+            uint32_t recv_seq = 0;
+            std::map<uint32_t, packet> unacked;
+            std::deque<buffer_ptr_t> waiting;
+            std::map<uint32_t, buffer_ptr_t> reorder;
+        };
+
+        static bool to_endpoint(const std::string& addr, endpoint_t& ep)
+        {
+            auto pos = addr.rfind(':');
+            if (pos == std::string::npos)
+            {
+                return false;
+            }
+            asio::error_code ec;
+            auto address = asio::ip::make_address(addr.substr(0, pos), ec);
+            if (ec)
+            {
+                return false;
+            }
+            ep = endpoint_t(address, static_cast<uint16_t>(std::strtoul(addr.data() + pos + 1, nullptr, 10)));
+            return true;
+        }
+
+        static std::string to_string(const endpoint_t& ep)
+        {
+            asio::error_code ec;
+            auto addr = ep.address().to_string(ec);
+            addr.append(":");
+            addr.append(std::to_string(ep.port()));
+            return addr;
+        }
+
+        //nullptr when max_peers is reached
+        peer* get_peer(const std::string& addr, const endpoint_t& ep)
+        {
+            int64_t now = time::millisecond();
+            auto iter = peers_.find(addr);
+            if (iter == peers_.end())
+            {
+                if (peers_.size() >= max_peers_)
+                {
+                    expire(now);
+                    if (peers_.size() >= max_peers_)
+                    {
+                        return nullptr;
+                    }
+                }
+                iter = peers_.try_emplace(addr).first;
+                iter->second.ep = ep;
+                iter->second.send_session = static_cast<uint32_t>(rng_());
+                arm_expire();
+            }
+            iter->second.last_active = now;
+            return &iter->second;
+        }
+
+        void expire(int64_t now)
+        {
+            for (auto iter = peers_.begin(); iter != peers_.end();)
+            {
+                auto& p = iter->second;
+                if (p.unacked.empty() && now - p.last_active >= static_cast<int64_t>(peer_timeout_))
+                {
+                    iter = peers_.erase(iter);
+                    continue;
+                }
+                ++iter;
+            }
+        }
+
+        void arm_expire()
+        {
+            if (expire_armed_)
+            {
+                return;
+            }
+            expire_armed_ = true;
+            expire_.expires_after(std::chrono::milliseconds(std::max<int64_t>(peer_timeout_ / 2, ARQ_TICK)));
+            expire_.async_wait([this, self = shared_from_this()](const asio::error_code& e) {
+                expire_armed_ = false;
+                if (e || !socket_.is_open())
+                {
+                    return;
+                }
+                expire(time::millisecond());
+                if (!peers_.empty())
+                {
+                    arm_expire();
+                }
+            });
+        }
+
+        void send_data(peer& p, const buffer_ptr_t& data)
+        {
+            uint32_t seq = p.send_seq++;
+            auto buf = make_packet(CMD_DATA, p.send_session, seq, p.send_una, data->data(), data->size());
+            int64_t now = time::millisecond();
+            p.unacked.emplace(seq, packet{ buf, now + ARQ_RTO, ARQ_RTO, 0 });
+            push_out(p.ep, buf);
+            arm_tick();
+        }
+
+        static buffer_ptr_t make_packet(uint8_t cmd, uint32_t session, uint32_t seq, uint32_t una, const char* data, size_t size)
+        {
+            auto buf = message::create_buffer(ARQ_HEAD_SIZE + size);
+            buf->write_back(&cmd, 0, 1);
+            host2net(session);
+            buf->write_back(&session, 0, 1);
+            host2net(seq);
+            buf->write_back(&seq, 0, 1);
+            host2net(una);
+            buf->write_back(&una, 0, 1);
+            buf->write_back(data, 0, size);
+            return buf;
+        }
+
+        void push_out(const endpoint_t& ep, const buffer_ptr_t& data)
+        {
+            out_.emplace_back(ep, data);
+            if (!flush_posted_)
+            {
+                //datagrams queued in this event go out together
+                flush_posted_ = true;
+                asio::post(socket_.get_executor(), [this, self = shared_from_this()]() {
+                    flush_posted_ = false;
+                    flush();
+                });
+            }
+        }
+
+        bool lost()
+        {
+            return loss_ != 0 && (rng_() % 100) < loss_;
+        }
+
+        void flush()
+        {
+            if (!socket_.is_open())
+            {
+                out_.clear();
+                return;
+            }
+
+#if TARGET_PLATFORM == PLATFORM_LINUX
+            size_t i = 0;
+            while (i < out_.size())
+            {
+                mmsghdr msgs[BATCH];
+                iovec iovs[BATCH];
+                unsigned n = 0;
+                for (; i < out_.size() && n < BATCH; ++i)
+                {
+                    if (lost())
+                    {
+                        continue;
+                    }
+                    auto& v = out_[i];
+                    iovs[n].iov_base = const_cast<char*>(v.second->data());
+                    iovs[n].iov_len = v.second->size();
+                    memset(&msgs[n], 0, sizeof(mmsghdr));
+                    msgs[n].msg_hdr.msg_name = v.first.data();
+                    msgs[n].msg_hdr.msg_namelen = static_cast<socklen_t>(v.first.size());
+                    msgs[n].msg_hdr.msg_iov = &iovs[n];
+                    msgs[n].msg_hdr.msg_iovlen = 1;
+                    ++n;
+                }
+                if (n > 0)
+                {
+                    //datagrams the kernel can not take now are dropped, arq resends them
+                    ::sendmmsg(socket_.native_handle(), msgs, n, MSG_DONTWAIT);
+                }
+            }
+#else
+            for (auto& v : out_)
+            {
+                if (lost())
+                {
+                    continue;
+                }
+                asio::error_code ec;
+                socket_.send_to(asio::buffer(v.second->data(), v.second->size()), v.first, 0, ec);
+            }
+#endif
+            out_.clear();
+        }
+
+        void read()
+        {
+#if TARGET_PLATFORM == PLATFORM_LINUX
+            socket_.async_wait(asio::ip::udp::socket::wait_read, [this, self = shared_from_this()](const asio::error_code& e) {
+                if (e)
+                {
+                    return;
+                }
+
+                mmsghdr msgs[BATCH];
+                iovec iovs[BATCH];
+                sockaddr_storage addrs[BATCH];
+                int n = 0;
+                //a few batches per wakeup, then let other events run
+                for (int round = 0; round < 4 && socket_.is_open(); ++round)
+                {
+                    for (size_t i = 0; i < BATCH; ++i)
+                    {
+                        iovs[i].iov_base = recv_data_.get() + i * UDP_MAX_PACKET;
+                        iovs[i].iov_len = UDP_MAX_PACKET;
+                        memset(&msgs[i], 0, sizeof(mmsghdr));
+                        msgs[i].msg_hdr.msg_name = &addrs[i];
+                        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+                        msgs[i].msg_hdr.msg_iov = &iovs[i];
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                    }
+
+                    n = ::recvmmsg(socket_.native_handle(), msgs, BATCH, MSG_DONTWAIT, nullptr);
+                    if (n <= 0)
+                    {
+                        break;
+                    }
+
+                    for (int i = 0; i < n && socket_.is_open(); ++i)
+                    {
+                        endpoint_t ep;
+                        memcpy(ep.data(), &addrs[i], msgs[i].msg_hdr.msg_namelen);
+                        ep.resize(msgs[i].msg_hdr.msg_namelen);
+                        handle_datagram(ep, static_cast<const char*>(iovs[i].iov_base), msgs[i].msg_len);
+                    }
+
+                    if (n < static_cast<int>(BATCH))
+                    {
+                        break;
+                    }
+                }
+
+                if (socket_.is_open())
+                {
+                    read();
+                }
+            });
+#else
+            socket_.async_receive_from(asio::buffer(recv_data_.get(), UDP_MAX_PACKET), sender_,
+                [this, self = shared_from_this()](const asio::error_code& e, std::size_t bytes_transferred) {
+                if (e == asio::error::operation_aborted || !socket_.is_open())
+                {
+                    return;
+                }
+
+                if (!e)
+                {
+                    handle_datagram(sender_, recv_data_.get(), bytes_transferred);
+                }
+                read();
+            });
+#endif
+        }
+
+        void handle_datagram(const endpoint_t& ep, const char* data, size_t size)
+        {
+            if (!arq_)
+            {
+                emit(to_string(ep), data, size, socket_data_type::socket_recv);
+                return;
+            }
+
+            if (size < ARQ_HEAD_SIZE)
+            {
+                return;
+            }
+
+            uint8_t cmd = static_cast<uint8_t>(data[0]);
+            uint32_t session = 0;
+            memcpy(&session, data + 1, sizeof(session));
+            net2host(session);
+            uint32_t seq = 0;
+            memcpy(&seq, data + 5, sizeof(seq));
+            net2host(seq);
+            uint32_t una = 0;
+            memcpy(&una, data + 9, sizeof(una));
+            net2host(una);
+
+            auto addr = to_string(ep);
+            if (cmd == CMD_ACK)
+            {
+                auto iter = peers_.find(addr);
+                //ack of an earlier session, this side forgot the peer since
+                if (iter == peers_.end() || iter->second.send_session != session)
+                {
+                    return;
+                }
+                auto& p = iter->second;
+                p.last_active = time::millisecond();
+                p.unacked.erase(seq);
+                while (p.send_una != p.send_seq && p.unacked.find(p.send_una) == p.unacked.end())
+                {
+                    ++p.send_una;
+                }
+                while (!p.waiting.empty() && p.send_seq - p.send_una < ARQ_WINDOW)
+                {
+                    auto buf = std::move(p.waiting.front());
+                    p.waiting.pop_front();
+                    send_data(p, buf);
+                }
+                return;
+            }
+
+            if (cmd != CMD_DATA)
+            {
+                return;
+            }
+
+            peer* pp = get_peer(addr, ep);
+            if (nullptr == pp)
+            {
+                return;
+            }
+            auto& p = *pp;
+            if (session != p.recv_session)
+            {
+                //late datagram of the replaced session
+                if (session == p.prev_recv_session)
+                {
+                    return;
+                }
+                //sender restarted or forgot us, or this side restarted
+                p.prev_recv_session = p.recv_session;
+                p.recv_session = session;
+                p.recv_seq = una;
+                p.reorder.clear();
+            }
+
+            int32_t diff = static_cast<int32_t>(seq - p.recv_seq);
+            if (diff >= static_cast<int32_t>(ARQ_WINDOW))
+            {
+                return;
+            }
+
+            //ack every copy, the previous ack may be lost
+            push_out(ep, make_packet(CMD_ACK, session, seq, 0, nullptr, 0));
+            if (diff < 0)
+            {
+                return;
+            }
+
+            if (diff > 0)
+            {
+                if (p.reorder.find(seq) == p.reorder.end())
+                {
+                    auto buf = message::create_buffer(size - ARQ_HEAD_SIZE);
+                    buf->write_back(data + ARQ_HEAD_SIZE, 0, size - ARQ_HEAD_SIZE);
+                    p.reorder.emplace(seq, std::move(buf));
+                }
+                return;
+            }
+
+            ++p.recv_seq;
+            emit(addr, data + ARQ_HEAD_SIZE, size - ARQ_HEAD_SIZE, socket_data_type::socket_recv);
+            buffer_ptr_t buf;
+            //service handles the message immediately and may close the socket or change peers_, find the peer again
+            while (socket_.is_open())
+            {
+                auto iter = peers_.find(addr);
+                if (iter == peers_.end())
+                {
+                    return;
+                }
+                auto& q = iter->second;
+                auto it = q.reorder.find(q.recv_seq);
+                if (it == q.reorder.end())
+                {
+                    return;
+                }
+                ++q.recv_seq;
+                buf = std::move(it->second);
+                q.reorder.erase(it);
+                emit(addr, buf->data(), buf->size(), socket_data_type::socket_recv);
+            }
+        }
+
+        void arm_tick()
+        {
+            if (tick_armed_)
+            {
+                return;
+            }
+            tick_armed_ = true;
+            tick_.expires_after(std::chrono::milliseconds(ARQ_TICK));
+            tick_.async_wait([this, self = shared_from_this()](const asio::error_code& e) {
+                tick_armed_ = false;
+                if (e || !socket_.is_open())
+                {
+                    return;
+                }
+                resend();
+            });
+        }
+
+        void resend()
+        {
+            int64_t now = time::millisecond();
+            bool pending = false;
+            std::vector<std::string> failed;
+            for (auto iter = peers_.begin(); iter != peers_.end();)
+            {
+                auto& p = iter->second;
+                bool timeout = false;
+                for (auto& it : p.unacked)
+                {
+                    auto& pkt = it.second;
+                    if (now < pkt.resend_time)
+                    {
+                        continue;
+                    }
+                    if (pkt.retry >= ARQ_MAX_RETRY)
+                    {
+                        timeout = true;
+                        break;
+                    }
+                    ++pkt.retry;
+                    pkt.rto = std::min(pkt.rto * 3 / 2, ARQ_RTO_MAX);
+                    pkt.resend_time = now + pkt.rto;
+                    push_out(p.ep, pkt.data);
+                }
+
+                if (timeout)
+                {
+                    failed.emplace_back(iter->first);
+                    iter = peers_.erase(iter);
+                    continue;
+                }
+                pending = pending || !p.unacked.empty();
+                ++iter;
+            }
+
+            if (pending)
+            {
+                arm_tick();
+            }
+
+            //service handles message immediately, it may send or close, so report after the loop
+            string_view_t errmsg{ "arq timeout" };
+            for (auto& addr : failed)
+            {
+                if (!socket_.is_open())
+                {
+                    break;
+                }
+                emit(addr, errmsg.data(), errmsg.size(), socket_data_type::socket_error);
+            }
+        }
+
+        void emit(const std::string& addr, const char* data, size_t size, socket_data_type subtype)
+        {
+            auto m = message::create(size);
+            m->get_buffer()->write_back(data, 0, size);
+            m->set_header(addr);
+            m->set_sender(fd_);
+            m->set_type(PTYPE_SOCKET);
+            m->set_subtype(static_cast<uint8_t>(subtype));
+            s_->handle_message(owner_, std::move(m));
+        }
+    private:
+        bool arq_;
+        bool flush_posted_ = false;
+        bool tick_armed_ = false;
+        bool expire_armed_ = false;
+        uint32_t loss_;
+        uint32_t peer_timeout_;
+        uint32_t max_peers_;
+        uint32_t fd_ = 0;
+        uint32_t owner_;
+        moon::socket* s_;
+        asio::ip::udp::socket socket_;
+        asio::steady_timer tick_;
+        asio::steady_timer expire_;
+        std::unique_ptr<char[]> recv_data_;
+        endpoint_t sender_;
+        std::minstd_rand rng_{ std::random_device{}() };
+        std::vector<std::pair<endpoint_t, buffer_ptr_t>> out_;
+        std::unordered_map<std::string, peer> peers_;
+    };
+}
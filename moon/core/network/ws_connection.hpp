@@ -1,9 +1,12 @@
 #pragma once
+#include <random>
 #include "base_connection.hpp"
 #include "common/http_util.hpp"
 #include "common/base64.hpp"
 #include "common/byte_convert.hpp"
 #include "common/sha1.hpp"
+#include "ws_deflate.hpp"
+#include "ws_mask.hpp"
 
 namespace moon
 {
@@ -111,11 +114,15 @@ namespace moon
         static constexpr size_t PAYLOAD_MIN_LEN = 125;
         static constexpr size_t PAYLOAD_MID_LEN = 126;
         static constexpr size_t PAYLOAD_MAX_LEN = 127;
+        static constexpr size_t MAX_HEADER_LEN = 14;// 2 + 8 bytes length + 4 bytes masking key
         static constexpr size_t FIN_FRAME_FLAG = 0x80;// 1 0 0 0 0 0 0 0
+        static constexpr size_t RSV1_FRAME_FLAG = 0x40;// 0 1 0 0 0 0 0 0, compressed message
+        static constexpr size_t MASK_FRAME_FLAG = 0x80;// second byte, payload is masked
 
         static constexpr const string_view_t WEBSOCKET = "websocket"sv;
         static constexpr const string_view_t UPGRADE = "upgrade"sv;
         static constexpr const string_view_t WS_MAGICKEY = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"sv;
+        static constexpr const string_view_t PERMESSAGE_DEFLATE = "permessage-deflate"sv;
 
         template <typename... Args>
         explicit ws_connection(Args&&... args)
@@ -126,13 +133,107 @@ namespace moon
         void start(bool accepted) override
         {
             base_connection_t::start(accepted);
+            if (client_)
+            {
+                send_request();
+            }
             read_header();
         }
 
         bool send(const buffer_ptr_t & data) override
         {
-            encode_frame(data);
-            return base_connection_t::send(data);
+            return send(data, data->has_flag(buffer_flag::ws_text));
+        }
+
+        bool send(const buffer_ptr_t& data, bool text)
+        {
+            if (client_ && !handshaked_)
+            {
+                //client may not send frames before server accepts the upgrade
+                if (!socket_.is_open() || nullptr == data || data->size() == 0)
+                {
+                    return false;
+                }
+                pending_.emplace_back(data, text);
+                return true;
+            }
+            return base_connection_t::send(encode_frame(data, text));
+        }
+
+        void set_deflate(const ws_deflate_options& opt)
+        {
+            deflate_opt_ = opt;
+        }
+
+        //outgoing messages larger than size are split into fragments, 0 means never
+        void set_fragment(uint32_t size)
+        {
+            fragment_ = size;
+        }
+
+        //connection made by socket::connect, it sends the upgrade request and masks its frames
+        void set_client(std::string host, std::string path)
+        {
+            client_ = true;
+            host_ = std::move(host);
+            path_ = path.empty() ? std::string{ "/" } : std::move(path);
+        }
+
+        bool client() const
+        {
+            return client_;
+        }
+
+        //window bits a message of this size is compressed with, 0 means uncompressed
+        uint8_t deflate_bits(size_t size) const
+        {
+            return (window_bits_ != 0 && size >= deflate_opt_.threshold) ? window_bits_ : 0;
+        }
+
+        //send a frame made by make_frame, it may be shared with other connections
+        bool send_frame(const buffer_ptr_t& frame, bool deflated)
+        {
+            if (deflated && deflate_takeover_)
+            {
+                //client window now holds bytes our deflater never saw, next message must not refer back
+                reset_deflate_ = true;
+            }
+            return base_connection_t::send(frame);
+        }
+
+        //complete server frame, compressed alone when window_bits is not 0
+        static buffer_ptr_t make_frame(const buffer_ptr_t& data, bool text, uint8_t window_bits)
+        {
+            uint8_t opcode = FIN_FRAME_FLAG | static_cast<uint8_t>(text ? ws::opcode::text : ws::opcode::binary);
+            buffer_ptr_t frame;
+#ifdef MOON_WS_DEFLATE
+            if (window_bits != 0)
+            {
+                static thread_local std::unique_ptr<ws::deflater> deflaters[MAX_WS_WINDOW_BITS + 1];
+                auto& d = deflaters[window_bits];
+                if (nullptr == d)
+                {
+                    d = std::make_unique<ws::deflater>(window_bits);
+                }
+                frame = message::create_buffer(data->size() / 2 + 64);
+                if (!d->compress(data->data(), data->size(), *frame, true))
+                {
+                    return nullptr;
+                }
+                opcode |= RSV1_FRAME_FLAG;
+            }
+#else
+            //never negotiated, deflate_bits always 0
+            (void)window_bits;
+#endif
+            if (nullptr == frame)
+            {
+                frame = message::create_buffer(data->size());
+                frame->write_back(data->data(), 0, data->size());
+            }
+            write_header(*frame, opcode);
+            frame->set_flag(buffer_flag::pack_size);
+            return frame;
         }
 
     protected:
@@ -170,7 +271,7 @@ namespace moon
                 recvtime_ = now();
 
                 size_t num_additional_bytes = sbuf->size() - bytes_transferred;
-                if (handshake(sbuf))
+                if (client_ ? handshake_response(sbuf, bytes_transferred) : handshake(sbuf))
                 {
                     check_recv_buffer(DEFAULT_RECV_BUFFER_SIZE);
                     if (num_additional_bytes > 0)
@@ -184,6 +285,11 @@ namespace moon
                     }
                     read_some();
                 }
+                else if (client_)
+                {
+                    error(asio::error_code(), int(ws::close_code::protocol_error), "websocket handshake failed");
+                    base_connection::close();
+                }
                 else
                 {
                     send_response("HTTP/1.1 400 Bad Request\r\n\r\n", true);
@@ -193,6 +299,11 @@ namespace moon
 
         void read_some()
         {
+            if (hold_read([this] { read_some(); }))
+            {
+                return;
+            }
+
             socket_.async_read_some(asio::buffer(recv_buf_->data() + recv_buf_->size(), recv_buf_->writeablesize()),
                 make_custom_alloc_handler(rallocator_,
                     [this, self = shared_from_this()](const asio::error_code& e, std::size_t bytes_transferred)
@@ -211,7 +322,7 @@ namespace moon
 
                 recvtime_ = now();
                 recv_buf_->offset_writepos(static_cast<int>(bytes_transferred));
- 
+
                 if (!handle_frame())
                 {
                     return;
@@ -270,8 +381,15 @@ namespace moon
             std::string_view protocol;
             moon::try_get_value(header, "Sec-WebSocket-Protocol"sv, protocol);
 
+            std::string extensions;
+            std::string_view offers;
+            if (deflate_opt_.enable && moon::try_get_value(header, "sec-websocket-extensions"sv, offers))
+            {
+                extensions = negotiate_deflate(offers);
+            }
+
             handshaked_ = true;
-            auto answer = upgrade_response(sec_ws_key_, protocol);
+            auto answer = upgrade_response(sec_ws_key_, protocol, extensions);
             send_response(answer);
             auto msg = message::create();
             msg->write_string(addr_);
@@ -280,6 +398,71 @@ namespace moon
             return true;
         }
 
+        void send_request()
+        {
+            uint8_t key[16];
+            for (size_t i = 0; i < sizeof(key); i += sizeof(uint32_t))
+            {
+                auto v = mask_key();
+                memcpy(key + i, &v, sizeof(v));
+            }
+            sec_key_ = base64_encode(key, sizeof(key));
+
+            std::string request;
+            request.append("GET ").append(path_).append(" HTTP/1.1\r\n");
+            request.append("Host: ").append(host_).append(STR_CRLF.data(), STR_CRLF.size());
+            request.append("Upgrade: websocket\r\n");
+            request.append("Connection: Upgrade\r\n");
+            request.append("Sec-WebSocket-Key: ").append(sec_key_).append(STR_CRLF.data(), STR_CRLF.size());
+            request.append("Sec-WebSocket-Version: 13\r\n");
+#ifdef MOON_WS_DEFLATE
+            if (deflate_opt_.enable)
+            {
+                request.append("Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n");
+            }
+#endif
+            request.append(STR_CRLF.data(), STR_CRLF.size());
+            send_response(request);
+        }
+
+        bool handshake_response(const std::shared_ptr<asio::streambuf>& buf, size_t size)
+        {
+            std::string_view version;
+            std::string_view status;
+            http::case_insensitive_multimap_view header;
+            bool ok = http::response_parser::parse(string_view_t{ asio::buffer_cast<const char*>(buf->data()), size }, version, status, header);
+            if (ok)
+            {
+                std::string_view h;
+                std::string_view u;
+                std::string_view accept;
+                std::string_view extensions;
+                ok = (status.substr(0, 3) == "101"sv)
+                    && moon::try_get_value(header, "connection"sv, h) && iequal_string(h, UPGRADE)
+                    && moon::try_get_value(header, "upgrade"sv, u) && iequal_string(u, WEBSOCKET)
+                    && moon::try_get_value(header, "sec-websocket-accept"sv, accept) && accept == accept_key(sec_key_)
+                    && (!moon::try_get_value(header, "sec-websocket-extensions"sv, extensions) || accept_deflate(extensions));
+            }
+            buf->consume(size);
+            if (!ok)
+            {
+                return false;
+            }
+
+            handshaked_ = true;
+            auto msg = message::create();
+            msg->write_string(addr_);
+            msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_connect));
+            handle_message(std::move(msg));
+
+            auto pending = std::move(pending_);
+            for (auto& v : pending)
+            {
+                send(v.first, v.second);
+            }
+            return true;
+        }
+
         void send_response(const std::string& s, bool bclose = false)
         {
             auto buf = message::create_buffer();
@@ -293,22 +476,29 @@ namespace moon
 
         bool handle_frame()
         {
-            auto close_code = decode_frame();
-            if (ws::close_code::none != close_code)
+            //one read may carry many small frames
+            bool more = false;
+            do
             {
-                error(asio::error_code(), int(close_code), std::string(recv_buf_->data(), recv_buf_->size()).data());
-                base_connection::close();
-                return false;
-            }
-            return true;
+                auto close_code = decode_frame(more);
+                if (ws::close_code::none != close_code)
+                {
+                    error(asio::error_code(), int(close_code), std::string(recv_buf_->data(), recv_buf_->size()).data());
+                    base_connection::close();
+                    return false;
+                }
+            } while (more && socket_.is_open());
+            return socket_.is_open();
         }
 
-        ws::close_code decode_frame()
+        //more: a frame was consumed and the buffer still has data
+        ws::close_code decode_frame(bool& more)
         {
+            more = false;
             const uint8_t* tmp = (const uint8_t*)(recv_buf_->data());
             size_t size = recv_buf_->size();
 
-            if (size < 3)
+            if (size < 2)
             {
                 check_recv_buffer(10);
                 return ws::close_code::none;
@@ -326,9 +516,9 @@ namespace moon
                 break;
             }
 
-            fh.mask = (tmp[1] & 0x80) != 0;
-            //server must masked.
-            if (!fh.mask)
+            fh.mask = (tmp[1] & MASK_FRAME_FLAG) != 0;
+            //client frames must be masked, server frames must not
+            if (fh.mask == client_)
             {
                 return ws::close_code::protocol_error;
             }
@@ -355,18 +545,24 @@ namespace moon
             {
             case ws::opcode::text:
             case ws::opcode::binary:
-                if (fh.rsv1 || fh.rsv2 || fh.rsv3)
+                if ((fh.rsv1 && window_bits_ == 0) || fh.rsv2 || fh.rsv3)
                 {
                     // reserved bits not cleared
                     return ws::close_code::protocol_error;
                 }
+                if (nullptr != frag_buf_)
+                {
+                    // new message before the fragmented one ends
+                    return ws::close_code::protocol_error;
+                }
                 break;
             case ws::opcode::incomplete:
+                if (fh.rsv1 || fh.rsv2 || fh.rsv3 || nullptr == frag_buf_)
                 {
-                    //not support continuation frame
+                    // continuation without first fragment, only first fragment carries RSV1
                     return ws::close_code::protocol_error;
-                    break;
                 }
+                break;
             default:
                 if (!fh.fin)
                 {
@@ -424,69 +620,433 @@ namespace moon
                 return ws::close_code::none;
             }
 
+            uint8_t* payload = (uint8_t*)(tmp + need);
+            size_t len = static_cast<size_t>(reallen);
             if (fh.mask)
             {
-                fh.key = *((int32_t*)(tmp + (need - sizeof(fh.key))));
-                // unmask data:
-                uint8_t* d = (uint8_t*)(tmp + need);
-                for (uint64_t i = 0; i < reallen; i++)
-                {
-                    d[i] = d[i] ^ ((uint8_t*)(&fh.key))[i % 4];
-                }
+                memcpy(&fh.key, tmp + (need - sizeof(fh.key)), sizeof(fh.key));
+                ws::unmask(payload, len, (const uint8_t*)&fh.key);
             }
 
-            if (fh.op != ws::opcode::close &&  fh.fin)
+            if (fh.op == ws::opcode::close)
             {
+                //may have error msg
                 recv_buf_->seek(static_cast<int>(need), buffer::Current);
-                message_ptr_t msg = message::create(std::move(recv_buf_));
-                msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
-                handle_message(std::move(msg));
+                return ws::close_code::normal;
             }
 
-            if (fh.op == ws::opcode::close)
+            size_t remain = size - (need + len);
+            more = (remain > 0);
+
+            if (fh.op == ws::opcode::incomplete || !fh.fin)
             {
-                //may have error msg
+                //fragments are joined, the message is delivered with the last one
+                if (fh.op != ws::opcode::incomplete)
+                {
+                    frag_buf_ = message::create_buffer(len);
+                    frag_compressed_ = fh.rsv1;
+                }
+                frag_buf_->write_back(payload, 0, len);
+                recv_buf_->seek(static_cast<int>(need + len), buffer::Current);
+                if (frag_buf_->size() > MAX_WIDE_NET_MSG_SIZE)
+                {
+                    return ws::close_code::too_big;
+                }
+                if (fh.fin)
+                {
+                    auto buf = std::move(frag_buf_);
+                    auto code = deliver(buf, frag_compressed_);
+                    if (ws::close_code::none != code)
+                    {
+                        return code;
+                    }
+                }
+            }
+            else if (fh.rsv1)
+            {
+                auto code = deliver(payload, len, true);
+                recv_buf_->seek(static_cast<int>(need + len), buffer::Current);
+                if (ws::close_code::none != code)
+                {
+                    return code;
+                }
+            }
+            else if (remain == 0)
+            {
+                //the only frame, payload is moved to message without copy
                 recv_buf_->seek(static_cast<int>(need), buffer::Current);
-                return ws::close_code::normal;
+                auto buf = std::move(recv_buf_);
+                deliver(buf, false);
+            }
+            else
+            {
+                deliver(payload, len, false);
+                recv_buf_->seek(static_cast<int>(need + len), buffer::Current);
             }
 
-            check_recv_buffer(DEFAULT_RECV_BUFFER_SIZE);
+            check_recv_buffer(more ? 0 : DEFAULT_RECV_BUFFER_SIZE);
             return ws::close_code::none;
         }
 
-        void encode_frame(const buffer_ptr_t& data)
+        ws::close_code deliver(const uint8_t* data, size_t size, bool compressed)
         {
-            uint8_t opcode = FIN_FRAME_FLAG | static_cast<uint8_t>(ws::opcode::binary);
-            if (data->has_flag(buffer_flag::ws_text))
+            buffer_ptr_t buf;
+#ifdef MOON_WS_DEFLATE
+            if (compressed)
+            {
+                buf = message::create_buffer(size * 2 + 64);
+                if (!inflater_->decompress((const char*)data, size, *buf, MAX_WIDE_NET_MSG_SIZE, !inflate_takeover_))
+                {
+                    return ws::close_code::bad_payload;
+                }
+            }
+#else
+            (void)compressed;
+#endif
+            if (nullptr == buf)
             {
-                opcode = FIN_FRAME_FLAG | static_cast<uint8_t>(ws::opcode::text);
+                buf = message::create_buffer(size);
+                buf->write_back(data, 0, size);
             }
+            message_ptr_t msg = message::create(std::move(buf));
+            msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
+            handle_message(std::move(msg));
+            return ws::close_code::none;
+        }
 
-            uint64_t size = data->size();
+        ws::close_code deliver(buffer_ptr_t& buf, bool compressed)
+        {
+            if (compressed)
+            {
+                return deliver((const uint8_t*)buf->data(), buf->size(), true);
+            }
+            message_ptr_t msg = message::create(std::move(buf));
+            msg->set_subtype(static_cast<uint8_t>(socket_data_type::socket_recv));
+            handle_message(std::move(msg));
+            return ws::close_code::none;
+        }
+
+        buffer_ptr_t encode_frame(const buffer_ptr_t& data, bool text)
+        {
+            //frame made by make_frame
+            if (data->has_flag(buffer_flag::pack_size))
+            {
+                return data;
+            }
+
+            uint8_t opcode = static_cast<uint8_t>(text ? ws::opcode::text : ws::opcode::binary);
+            buffer_ptr_t payload = data;
+            bool compressed = false;
+#ifdef MOON_WS_DEFLATE
+            if (deflate_bits(data->size()) != 0)
+            {
+                auto buf = message::create_buffer(data->size() / 2 + 64);
+                if (deflater_->compress(data->data(), data->size(), *buf, reset_deflate_ || !deflate_takeover_))
+                {
+                    reset_deflate_ = false;
+                    copy_flags(*data, *buf);
+                    payload = std::move(buf);
+                    compressed = true;
+                }
+                else
+                {
+                    //deflater state is unknown, send this one uncompressed and start over
+                    reset_deflate_ = true;
+                }
+            }
+#endif
+            if (compressed)
+            {
+                opcode |= RSV1_FRAME_FLAG;
+            }
+
+            buffer_ptr_t frame;
+            if (!client_ && (0 == fragment_ || payload->size() <= fragment_))
+            {
+                frame = make_header(payload, static_cast<uint8_t>(opcode | FIN_FRAME_FLAG));
+            }
+            else
+            {
+                frame = make_frames(*payload, opcode);
+            }
+            frame->set_flag(buffer_flag::pack_size);
+            return frame;
+        }
+
+        //payload is copied behind the headers: client frames are masked, and a fragmented message needs
+        //a header before every fragment. Only the first fragment carries opcode and RSV1
+        buffer_ptr_t make_frames(const buffer& payload, uint8_t opcode)
+        {
+            size_t size = payload.size();
+            size_t chunk = (0 == fragment_) ? size : fragment_;
+            size_t count = (0 == size) ? 1 : (size + chunk - 1) / chunk;
+            auto frame = message::create_buffer(size + count * MAX_HEADER_LEN);
+            copy_flags(payload, *frame);
+
+            size_t pos = 0;
+            do
+            {
+                size_t n = std::min(chunk, size - pos);
+                uint8_t op = (0 == pos) ? opcode : static_cast<uint8_t>(ws::opcode::incomplete);
+                if (pos + n == size)
+                {
+                    op |= FIN_FRAME_FLAG;
+                }
+                uint8_t head[MAX_HEADER_LEN];
+                size_t len = header_bytes(head, op, n);
+                uint32_t key = 0;
+                if (client_)
+                {
+                    head[1] |= MASK_FRAME_FLAG;
+                    key = mask_key();
+                    memcpy(head + len, &key, sizeof(key));
+                    len += sizeof(key);
+                }
+                frame->write_back(head, 0, len);
+                frame->write_back(payload.data() + pos, 0, n);
+                if (client_)
+                {
+                    ws::unmask((uint8_t*)frame->data() + frame->size() - n, n, (const uint8_t*)&key);
+                }
+                pos += n;
+            } while (pos < size);
+            return frame;
+        }
+
+        static void copy_flags(const buffer& from, buffer& to)
+        {
+            for (auto flag : { buffer_flag::close, buffer_flag::droppable })
+            {
+                if (from.has_flag(flag))
+                {
+                    to.set_flag(flag);
+                }
+            }
+        }
+
+        //frame header without masking key, returns its length
+        static size_t header_bytes(uint8_t* head, uint8_t opcode, uint64_t size)
+        {
+            size_t n = 2;
+            head[0] = opcode;
             if (size <= PAYLOAD_MIN_LEN)
             {
-                data->write_front((uint8_t*)&size, 0, 1);
+                head[1] = static_cast<uint8_t>(size);
             }
             else if (size <= UINT16_MAX)
             {
-                uint8_t tmp = PAYLOAD_MID_LEN;
-                uint16_t n = (uint16_t)size;
-                moon::host2net(n);
-                data->write_front(&n, 0, 1);
-                data->write_front(&tmp, 0, 1);
+                head[1] = PAYLOAD_MID_LEN;
+                uint16_t len = (uint16_t)size;
+                moon::host2net(len);
+                memcpy(head + n, &len, sizeof(len));
+                n += sizeof(len);
             }
             else
             {
-                uint8_t tmp = PAYLOAD_MAX_LEN;
+                head[1] = PAYLOAD_MAX_LEN;
                 moon::host2net(size);
-                data->write_front(&size, 0, 1);
-                data->write_front(&tmp, 0, 1);
+                memcpy(head + n, &size, sizeof(size));
+                n += sizeof(size);
+            }
+            return n;
+        }
+
+        //header is built on stack and written once into the head reserved space, payload is not moved.
+        //false when the buffer has not enough head space
+        static bool write_header(buffer& data, uint8_t opcode)
+        {
+            uint8_t head[MAX_HEADER_LEN];
+            size_t n = header_bytes(head, opcode, data.size());
+            return data.write_front(head, 0, n);
+        }
+
+        static buffer_ptr_t make_header(const buffer_ptr_t& data, uint8_t opcode)
+        {
+            if (write_header(*data, opcode))
+            {
+                return data;
+            }
+            //e.g. buffer made without head reserved space
+            auto frame = message::create_buffer(data->size());
+            frame->write_back(data->data(), 0, data->size());
+            copy_flags(*data, *frame);
+            write_header(*frame, opcode);
+            return frame;
+        }
+
+        static uint32_t mask_key()
+        {
+            static thread_local std::mt19937 gen{ std::random_device{}() };
+            return static_cast<uint32_t>(gen());
+        }
+
+        //accepts the first permessage-deflate offer we support, returns Sec-WebSocket-Extensions of response
+        std::string negotiate_deflate(string_view_t offers)
+        {
+#ifdef MOON_WS_DEFLATE
+            for (auto& offer : moon::split<string_view_t>(offers, ","))
+            {
+                auto params = moon::split<string_view_t>(offer, ";");
+                if (params.empty() || moon::trim_surrounding(params[0]) != PERMESSAGE_DEFLATE)
+                {
+                    continue;
+                }
+
+                bool ok = true;
+                uint8_t bits = std::clamp<uint8_t>(deflate_opt_.window_bits, 9, MAX_WS_WINDOW_BITS);
+                bool server_takeover = deflate_opt_.context_takeover;
+                bool client_takeover = true;
+                for (size_t i = 1; i < params.size() && ok; ++i)
+                {
+                    string_view_t name;
+                    string_view_t value;
+                    parse_param(params[i], name, value);
+                    if (name == "server_no_context_takeover"sv)
+                    {
+                        server_takeover = false;
+                    }
+                    else if (name == "client_no_context_takeover"sv)
+                    {
+                        client_takeover = false;
+                    }
+                    else if (name == "server_max_window_bits"sv)
+                    {
+                        //zlib can not make raw deflate stream with 8 bits window
+                        int v = parse_window_bits(value);
+                        ok = (v != 0);
+                        if (ok)
+                        {
+                            bits = std::min(bits, static_cast<uint8_t>(v));
+                        }
+                    }
+                    else if (name != "client_max_window_bits"sv)
+                    {
+                        ok = false;
+                    }
+                }
+
+                if (!ok)
+                {
+                    continue;
+                }
+
+                enable_deflate(bits, server_takeover, client_takeover);
+
+                std::string res{ PERMESSAGE_DEFLATE };
+                if (!server_takeover)
+                {
+                    res.append("; server_no_context_takeover");
+                }
+                if (!client_takeover)
+                {
+                    res.append("; client_no_context_takeover");
+                }
+                if (bits != MAX_WS_WINDOW_BITS)
+                {
+                    res.append("; server_max_window_bits=");
+                    res.append(std::to_string(bits));
+                }
+                return res;
             }
+#else
+            (void)offers;
+#endif
+            return std::string{};
+        }
 
-            data->write_front(&opcode, 0, 1);
+        //client side, server answered our permessage-deflate offer
+        bool accept_deflate(string_view_t response)
+        {
+#ifdef MOON_WS_DEFLATE
+            auto params = moon::split<string_view_t>(response, ";");
+            if (!deflate_opt_.enable || params.empty() || moon::trim_surrounding(params[0]) != PERMESSAGE_DEFLATE)
+            {
+                return false;
+            }
+
+            uint8_t bits = MAX_WS_WINDOW_BITS;
+            bool client_takeover = true;
+            bool server_takeover = true;
+            for (size_t i = 1; i < params.size(); ++i)
+            {
+                string_view_t name;
+                string_view_t value;
+                parse_param(params[i], name, value);
+                if (name == "server_no_context_takeover"sv)
+                {
+                    server_takeover = false;
+                }
+                else if (name == "client_no_context_takeover"sv)
+                {
+                    client_takeover = false;
+                }
+                else if (name == "client_max_window_bits"sv)
+                {
+                    int v = parse_window_bits(value);
+                    if (0 == v)
+                    {
+                        return false;
+                    }
+                    bits = static_cast<uint8_t>(v);
+                }
+                else if (name != "server_max_window_bits"sv)
+                {
+                    return false;
+                }
+            }
+            enable_deflate(bits, client_takeover, server_takeover);
+            return true;
+#else
+            (void)response;
+            //we never offer it
+            return false;
+#endif
+        }
+
+        static void parse_param(string_view_t param, string_view_t& name, string_view_t& value)
+        {
+            param = moon::trim_surrounding(param);
+            auto pos = param.find('=');
+            name = moon::trim_surrounding(param.substr(0, pos));
+            value = (pos == string_view_t::npos) ? string_view_t{} : moon::trim_surrounding(param.substr(pos + 1));
+        }
+
+        //9-15, 0 means invalid
+        static int parse_window_bits(string_view_t value)
+        {
+            if (value.empty() || value.size() > 2)
+            {
+                return 0;
+            }
+            int v = 0;
+            for (auto c : value)
+            {
+                if (c < '0' || c > '9')
+                {
+                    return 0;
+                }
+                v = v * 10 + (c - '0');
+            }
+            return (v >= 9 && v <= MAX_WS_WINDOW_BITS) ? v : 0;
         }
 
-        std::string upgrade_response(string_view_t seckey, string_view_t wsprotocol)
+        //own deflater window and context takeover of both directions
+        void enable_deflate(uint8_t bits, bool deflate_takeover, bool inflate_takeover)
+        {
+#ifdef MOON_WS_DEFLATE
+            window_bits_ = bits;
+            deflate_takeover_ = deflate_takeover;
+            inflate_takeover_ = inflate_takeover;
+            deflater_ = std::make_unique<ws::deflater>(bits);
+            inflater_ = std::make_unique<ws::inflater>();
+#else
+            (void)bits;
+            (void)deflate_takeover;
+            (void)inflate_takeover;
+#endif
+        }
+
+        static std::string accept_key(string_view_t seckey)
         {
             uint8_t keybuf[60];
             std::memcpy(keybuf, seckey.data(), seckey.size());
@@ -497,26 +1057,56 @@ namespace moon
             sha1::init(ctx);
             sha1::update(ctx, keybuf, sizeof(keybuf));
             sha1::finish(ctx, shakey);
-            std::string sha1str = base64_encode(shakey, sizeof(shakey));
+            return base64_encode(shakey, sizeof(shakey));
+        }
 
+        std::string upgrade_response(string_view_t seckey, string_view_t wsprotocol, string_view_t extensions)
+        {
             std::string response;
             response.append("HTTP/1.1 101 Switching Protocols\r\n");
             response.append("Upgrade: WebSocket\r\n");
             response.append("Connection: Upgrade\r\n");
             response.append("Sec-WebSocket-Accept: ");
-            response.append(sha1str);
-            response.append(STR_DCRLF.data(), STR_DCRLF.size());
+            response.append(accept_key(seckey));
+            response.append(STR_CRLF.data(), STR_CRLF.size());
             if (!wsprotocol.empty())
             {
                 response.append("Sec-WebSocket-Protocol: ");
                 response.append(wsprotocol.data(), wsprotocol.size());
-                response.append(STR_DCRLF.data(), STR_DCRLF.size());
+                response.append(STR_CRLF.data(), STR_CRLF.size());
+            }
+            if (!extensions.empty())
+            {
+                response.append("Sec-WebSocket-Extensions: ");
+                response.append(extensions.data(), extensions.size());
+                response.append(STR_CRLF.data(), STR_CRLF.size());
             }
+            response.append(STR_CRLF.data(), STR_CRLF.size());
             return response;
         }
 
     protected:
         bool handshaked_ = false;
+        bool client_ = false;
+        //negotiated permessage-deflate, window_bits_ 0 means not negotiated
+        uint8_t window_bits_ = 0;
+        bool deflate_takeover_ = true;
+        bool inflate_takeover_ = true;
+        bool reset_deflate_ = false;
+        bool frag_compressed_ = false;
+        uint32_t fragment_ = 0;
+        ws_deflate_options deflate_opt_;
+        std::string host_;
+        std::string path_;
+        std::string sec_key_;
         buffer_ptr_t recv_buf_;
+        //fragments of the message being received
+        buffer_ptr_t frag_buf_;
+        //messages sent before client handshake is done
+        std::vector<std::pair<buffer_ptr_t, bool>> pending_;
+#ifdef MOON_WS_DEFLATE
+        std::unique_ptr<ws::deflater> deflater_;
+        std::unique_ptr<ws::inflater> inflater_;
+#endif
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,149 @@
+#pragma once
+#ifdef MOON_WS_DEFLATE
+#include <zlib.h>
+#include "common/buffer.hpp"
+
+namespace moon
+{
+    namespace ws
+    {
+        //permessage-deflate(RFC 7692) message ends with sync flush, its 4 bytes tail 00 00 ff ff is not sent
+        constexpr uint8_t DEFLATE_TAIL[4] = { 0x00, 0x00, 0xff, 0xff };
+
+        //raw deflate stream of one direction, keeps the sliding window between messages unless reset
+        class deflater
+        {
+        public:
+            explicit deflater(int window_bits)
+            {
+                memset(&zs_, 0, sizeof(zs_));
+                ok_ = (deflateInit2(&zs_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+            }
+
+            deflater(const deflater&) = delete;
+
+            deflater& operator=(const deflater&) = delete;
+
+            ~deflater()
+            {
+                if (ok_)
+                {
+                    deflateEnd(&zs_);
+                }
+            }
+
+            //appends compressed message to out
+            bool compress(const char* data, size_t size, buffer& out, bool reset)
+            {
+                if (!ok_)
+                {
+                    return false;
+                }
+
+                if (reset)
+                {
+                    deflateReset(&zs_);
+                }
+
+                zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                zs_.avail_in = static_cast<uInt>(size);
+                do
+                {
+                    out.check_space(deflateBound(&zs_, zs_.avail_in) + 16);
+                    zs_.next_out = reinterpret_cast<Bytef*>(out.data() + out.size());
+                    zs_.avail_out = static_cast<uInt>(out.writeablesize());
+                    auto avail = zs_.avail_out;
+                    int r = deflate(&zs_, Z_SYNC_FLUSH);
+                    if (r != Z_OK && r != Z_BUF_ERROR)
+                    {
+                        return false;
+                    }
+                    out.offset_writepos(static_cast<int>(avail - zs_.avail_out));
+                } while (zs_.avail_out == 0);
+
+                if (out.size() >= sizeof(DEFLATE_TAIL) && memcmp(out.data() + out.size() - sizeof(DEFLATE_TAIL), DEFLATE_TAIL, sizeof(DEFLATE_TAIL)) == 0)
+                {
+                    out.offset_writepos(-static_cast<int>(sizeof(DEFLATE_TAIL)));
+                }
+                return true;
+            }
+        private:
+            bool ok_ = false;
+            z_stream zs_;
+        };
+
+        class inflater
+        {
+        public:
+            inflater()
+            {
+                memset(&zs_, 0, sizeof(zs_));
+                //peer may use any window size, accept the largest
+                ok_ = (inflateInit2(&zs_, -MAX_WBITS) == Z_OK);
+            }
+
+            inflater(const inflater&) = delete;
+
+            inflater& operator=(const inflater&) = delete;
+
+            ~inflater()
+            {
+                if (ok_)
+                {
+                    inflateEnd(&zs_);
+                }
+            }
+
+            //appends decompressed message to out, false when data is invalid or larger than max_size
+            bool decompress(const char* data, size_t size, buffer& out, size_t max_size, bool reset)
+            {
+                if (!ok_)
+                {
+                    return false;
+                }
+
+                bool res = inflate_some(data, size, out, max_size)
+                    && inflate_some(reinterpret_cast<const char*>(DEFLATE_TAIL), sizeof(DEFLATE_TAIL), out, max_size);
+                if (reset || !res)
+                {
+                    inflateReset(&zs_);
+                }
+                return res;
+            }
+        private:
+            bool inflate_some(const char* data, size_t size, buffer& out, size_t max_size)
+            {
+                zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                zs_.avail_in = static_cast<uInt>(size);
+                while (zs_.avail_in > 0)
+                {
+                    out.check_space(std::max<size_t>(size * 2, 1024));
+                    zs_.next_out = reinterpret_cast<Bytef*>(out.data() + out.size());
+                    zs_.avail_out = static_cast<uInt>(out.writeablesize());
+                    auto avail = zs_.avail_out;
+                    int r = inflate(&zs_, Z_SYNC_FLUSH);
+                    out.offset_writepos(static_cast<int>(avail - zs_.avail_out));
+                    if (out.size() > max_size)
+                    {
+                        return false;
+                    }
+                    if (r == Z_STREAM_END)
+                    {
+                        //peer finished the stream with a final block, start a new one
+                        inflateReset(&zs_);
+                        continue;
+                    }
+                    if (r != Z_OK && !(r == Z_BUF_ERROR && zs_.avail_out == 0))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        private:
+            bool ok_ = false;
+            z_stream zs_;
+        };
+    }
+}
+#endif
@@ -0,0 +1,145 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MOON_WS_MASK_SSE2
+#endif
+//avx2 code is compiled for the function only, used when the cpu has it
+#if defined(__AVX2__) || defined(__GNUC__) || defined(_MSC_VER)
+#define MOON_WS_MASK_AVX2
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MOON_WS_MASK_NEON
+#endif
+
+namespace moon
+{
+    namespace ws
+    {
+        //each step xors a multiple of 4 bytes, so the broadcast key never needs rotating.
+        //a step returns the bytes it did, the next one goes on from there.
+        namespace detail
+        {
+#if defined(MOON_WS_MASK_AVX2)
+#if defined(__GNUC__) && !defined(__AVX2__)
+            __attribute__((target("avx2")))
+#endif
+            inline size_t xor_avx2(uint8_t* data, size_t size, uint32_t k)
+            {
+                const __m256i k32 = _mm256_set1_epi32(static_cast<int>(k));
+                size_t i = 0;
+                for (; i + 32 <= size; i += 32)
+                {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(v, k32));
+                }
+                return i;
+            }
+
+            inline bool has_avx2()
+            {
+#if defined(__AVX2__)
+                return true;
+#elif defined(__GNUC__)
+                static const bool v = __builtin_cpu_supports("avx2");
+                return v;
+#else
+                static const bool v = []() {
+                    int r[4];
+                    __cpuid(r, 0);
+                    if (r[0] < 7)
+                    {
+                        return false;
+                    }
+                    __cpuid(r, 1);
+                    //osxsave, and the os saves ymm registers
+                    if ((r[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+                    {
+                        return false;
+                    }
+                    __cpuidex(r, 7, 0);
+                    return (r[1] & (1 << 5)) != 0;
+                }();
+                return v;
+#endif
+            }
+#endif
+
+#if defined(MOON_WS_MASK_SSE2)
+            inline size_t xor_vec16(uint8_t* data, size_t size, uint32_t k)
+            {
+                const __m128i k16 = _mm_set1_epi32(static_cast<int>(k));
+                size_t i = 0;
+                for (; i + 16 <= size; i += 16)
+                {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(v, k16));
+                }
+                return i;
+            }
+#elif defined(MOON_WS_MASK_NEON)
+            inline size_t xor_vec16(uint8_t* data, size_t size, uint32_t k)
+            {
+                const uint8x16_t k16 = vreinterpretq_u8_u32(vdupq_n_u32(k));
+                size_t i = 0;
+                for (; i + 16 <= size; i += 16)
+                {
+                    vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), k16));
+                }
+                return i;
+            }
+#endif
+
+            inline size_t xor_u64(uint8_t* data, size_t size, uint32_t k)
+            {
+                const uint64_t k8 = (static_cast<uint64_t>(k) << 32) | k;
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8)
+                {
+                    uint64_t v;
+                    memcpy(&v, data + i, sizeof(v));
+                    v ^= k8;
+                    memcpy(data + i, &v, sizeof(v));
+                }
+                return i;
+            }
+
+            inline void xor_bytes(uint8_t* data, size_t size, const uint8_t* key)
+            {
+                for (size_t i = 0; i < size; ++i)
+                {
+                    data[i] ^= key[i & 3];
+                }
+            }
+        }
+
+        //xor data with the 4 bytes masking key, key[i % 4] applies to data[i].
+        //32 bytes per step with avx2 when the cpu has it (checked once at run time), then 16 with sse2/neon,
+        //then 8 byte words and a byte tail.
+        inline void unmask(uint8_t* data, size_t size, const uint8_t* key)
+        {
+            size_t i = 0;
+#ifndef MOON_WS_SCALAR_UNMASK
+            uint32_t k;
+            memcpy(&k, key, sizeof(k));
+#if defined(MOON_WS_MASK_AVX2)
+            if (size >= 64 && detail::has_avx2())
+            {
+                i += detail::xor_avx2(data, size, k);
+            }
+#endif
+#if defined(MOON_WS_MASK_SSE2) || defined(MOON_WS_MASK_NEON)
+            i += detail::xor_vec16(data + i, size - i, k);
+#endif
+            i += detail::xor_u64(data + i, size - i, k);
+#endif
+            detail::xor_bytes(data + i, size - i, key);
+        }
+    }
+}
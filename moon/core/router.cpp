@@ -64,6 +64,8 @@ namespace moon
         s->set_id(serviceid);
         s->logger(logger_);
         s->set_unique(unique);
+        s->stealable(steal_ && !workerid_valid(workerid));
+        s->set_mailbox_limit(mailbox_limit_);
         s->set_server_context(server_, this, wk);
         wk->add_service(std::move(s), config, creatorid, sessionid);
         return true;
@@ -134,14 +136,66 @@ namespace moon
         send_message(std::move(m));
     }
 
+    void router::send_id(uint32_t sender, uint32_t receiver, const buffer_ptr_t& data, uint32_t header_id, int32_t sessionid, uint8_t type) const
+    {
+        MOON_CHECK(message::valid_header_id(header_id), moon::format("header id %u is not interned", header_id).data());
+        sessionid = -sessionid;
+        message_ptr_t m = message::create(data);
+        m->set_sender(sender);
+        m->set_receiver(receiver);
+        m->set_header_id(header_id);
+        m->set_type(type);
+        m->set_sessionid(sessionid);
+        send_message(std::move(m));
+    }
+
+    void router::send_many(uint32_t sender, const std::vector<uint32_t>& receivers, const buffer_ptr_t& buf, string_view_t header, uint8_t type) const
+    {
+        MOON_CHECK(type != PTYPE_UNKNOWN, "invalid message type.");
+        if (receivers.empty())
+        {
+            return;
+        }
+
+        //batch per worker, reused by calls on this thread
+        thread_local std::vector<std::vector<message_ptr_t>> batches;
+        batches.resize(workers_.size());
+        for (auto& v : batches)
+        {
+            v.clear();
+        }
+
+        message_ptr_t first = message::create(buf);
+        first->set_sender(sender);
+        first->set_header(header);
+        first->set_type(type);
+        for (auto receiver : receivers)
+        {
+            int32_t id = worker_id(receiver);
+            MOON_CHECK(workerid_valid(id), moon::format("invalid message receiver serviceid %u", receiver).data());
+            batches[id - 1].emplace_back(first->share(receiver));
+        }
+
+        for (size_t i = 0; i < batches.size(); ++i)
+        {
+            workers_[i]->send(batches[i]);
+        }
+    }
+
     void router::broadcast(uint32_t sender, const buffer_ptr_t& buf, string_view_t header, uint8_t type)
+    {
+        publish(sender, 0, buf, header, type);
+    }
+
+    void router::publish(uint32_t sender, uint32_t group, const buffer_ptr_t& buf, string_view_t header, uint8_t type)
     {
         for (auto& w : workers_)
         {
-            auto m = message::create(std::move(buf));
+            auto m = message::create(buf);
             m->set_broadcast(true);
             m->set_header(header);
             m->set_sender(sender);
+            m->set_receiver(group);
             m->set_type(type);
             w->send(std::move(m));
         }
@@ -250,6 +304,14 @@ namespace moon
         std::unique_lock lk(serviceids_lck_);
         size_t count = serviceids_.erase(serviceid);
         MOON_CHECK(count == 1, "erase failed!");
+        lk.unlock();
+
+        if (steal_)
+        {
+            std::unique_lock slk(sched_lck_);
+            pinned_services_.erase(serviceid);
+            moved_services_.erase(serviceid);
+        }
     }
 
     asio::io_context & router::get_io_context(uint32_t serviceid)
@@ -258,6 +320,66 @@ namespace moon
         return get_worker(workerid)->io_context();
     }
 
+    void router::set_steal(bool v)
+    {
+        steal_ = v;
+    }
+
+    void router::set_budget(uint32_t v)
+    {
+        budget_ = v;
+    }
+
+    void router::set_gc_budget(int64_t v)
+    {
+        gc_budget_ = v;
+    }
+
+    void router::set_mailbox_limit(const mailbox_limit& v)
+    {
+        mailbox_limit_ = v;
+    }
+
+    worker* router::pin_service(uint32_t serviceid)
+    {
+        if (steal_)
+        {
+            std::unique_lock lk(sched_lck_);
+            pinned_services_.emplace(serviceid);
+            if (auto iter = moved_services_.find(serviceid); iter != moved_services_.end())
+            {
+                return get_worker(iter->second);
+            }
+        }
+        return get_worker(worker_id(serviceid));
+    }
+
+    worker* router::idle_worker(uint32_t workerid) const
+    {
+        for (auto& w : workers_)
+        {
+            if (w->id() != workerid && w->shared() && w->try_claim())
+            {
+                return w.get();
+            }
+        }
+        return nullptr;
+    }
+
+    bool router::move_service(service_ptr_t& s, worker* to)
+    {
+        //hold lock until service is in 'to' worker, so pin_service never returns a worker without it
+        std::unique_lock lk(sched_lck_);
+        if (pinned_services_.find(s->id()) != pinned_services_.end())
+        {
+            return false;
+        }
+        moved_services_[s->id()] = to->id();
+        s->set_server_context(server_, this, to);
+        to->adopt(std::move(s));
+        return true;
+    }
+
     void router::set_server(server * sv)
     {
         server_ = sv;
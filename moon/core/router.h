@@ -43,8 +43,17 @@ namespace moon
 
         void send(uint32_t sender, uint32_t receiver, const buffer_ptr_t& buf, string_view_t header, int32_t sessionid, uint8_t type) const;
 
+        //header is an id from message::intern_header
+        void send_id(uint32_t sender, uint32_t receiver, const buffer_ptr_t& buf, uint32_t header_id, int32_t sessionid, uint8_t type) const;
+
+        //receivers are grouped by worker, each worker gets one batch, all messages share buf
+        void send_many(uint32_t sender, const std::vector<uint32_t>& receivers, const buffer_ptr_t& buf, string_view_t header, uint8_t type) const;
+
         void broadcast(uint32_t sender, const buffer_ptr_t& buf, string_view_t header, uint8_t type);
 
+        //send to services subscribed group, one envelope per worker, every receiver shares buf
+        void publish(uint32_t sender, uint32_t group, const buffer_ptr_t& buf, string_view_t header, uint8_t type);
+
         bool register_service(const std::string& type, register_func func);
 
         std::string get_env(const std::string& name) const;
@@ -65,6 +74,44 @@ namespace moon
 
         asio::io_context& get_io_context(uint32_t serviceid);
 
+        void set_steal(bool v);
+
+        void set_budget(uint32_t v);
+
+        uint32_t budget() const
+        {
+            return budget_;
+        }
+
+        void set_gc_budget(int64_t v);
+
+        //microseconds a worker spends on idle gc per turn
+        int64_t gc_budget() const
+        {
+            return gc_budget_;
+        }
+
+        //default mailbox watermarks of new services
+        void set_mailbox_limit(const mailbox_limit& v);
+
+        const mailbox_limit& get_mailbox_limit() const
+        {
+            return mailbox_limit_;
+        }
+
+        bool steal() const
+        {
+            return steal_;
+        }
+
+        //service will never leave its current worker, return the worker
+        worker* pin_service(uint32_t serviceid);
+
+        //claim an idle shared worker, except workerid
+        worker* idle_worker(uint32_t workerid) const;
+
+        bool move_service(service_ptr_t& s, worker* to);
+
         uint32_t worker_id(uint32_t serviceid) const
         {
             return ((serviceid >> WORKER_ID_SHIFT) & 0xFF);
@@ -87,11 +134,18 @@ namespace moon
 
         bool try_add_serviceid(uint32_t serviceid);
     private:
+        bool steal_ = false;
+        uint32_t budget_ = SERVICE_BUDGET;
+        int64_t gc_budget_ = IDLE_GC_BUDGET;
+        mailbox_limit mailbox_limit_;
         std::atomic<uint32_t> next_workerid_;
         std::vector<std::unique_ptr<worker>>& workers_;
         std::unordered_map<std::string, register_func > regservices_;
         mutable rwlock serviceids_lck_;
         std::unordered_set<uint32_t> serviceids_;
+        mutable rwlock sched_lck_;
+        std::unordered_set<uint32_t> pinned_services_;
+        std::unordered_map<uint32_t, uint32_t> moved_services_;
         map_env_t env_;
         map_unique_service_t unique_services_;
         log* logger_;
@@ -54,6 +54,16 @@ namespace moon
             w->start();
         }
 
+        if (event_tick_)
+        {
+            std::unique_lock lk(mutex_);
+            cv_.wait(lk, [this] {
+                return state_.load() != state::ready;
+            });
+        }
+
+        //polling mode, or wait workers exit
+        int64_t interval = std::min<int64_t>(UPDATE_INTERVAL, timer_precision_);
         int64_t previous_tick = time::now();
         int64_t sleep_duration = 0;
         while (true)
@@ -79,9 +89,9 @@ namespace moon
                 break;
             }
 
-            if (diff <= UPDATE_INTERVAL + sleep_duration)
+            if (diff <= interval + sleep_duration)
             {
-                sleep_duration = UPDATE_INTERVAL + sleep_duration - diff;
+                sleep_duration = interval + sleep_duration - diff;
                 thread_sleep(sleep_duration);
             }
             else
@@ -104,6 +114,12 @@ namespace moon
         {
             (*iter)->stop();
         }
+
+        if (event_tick_)
+        {
+            std::unique_lock lk(mutex_);
+            cv_.notify_one();
+        }
     }
 
     log* server::logger()
@@ -139,8 +155,33 @@ namespace moon
 
     int64_t server::now()
     {
+        if (event_tick_)
+        {
+            //main thread does not update now_ in this mode
+            return time::now();
+        }
         return now_;
     }
+
+    void server::set_event_tick(bool v)
+    {
+        event_tick_ = v;
+    }
+
+    bool server::event_tick() const
+    {
+        return event_tick_;
+    }
+
+    void server::set_timer_precision(int32_t v)
+    {
+        timer_precision_ = (v > 0) ? v : TIMER_PRECISION;
+    }
+
+    int32_t server::timer_precision() const
+    {
+        return timer_precision_;
+    }
 }
 
 
@@ -33,12 +33,26 @@ namespace moon
         state get_state();
 
         int64_t now();
+
+        //workers arm timers for their next deadline, main thread blocks until stop
+        void set_event_tick(bool v);
+
+        bool event_tick() const;
+
+        //worker timer tick ms, polling mode also updates workers at this interval when less than UPDATE_INTERVAL
+        void set_timer_precision(int32_t v);
+
+        int32_t timer_precision() const;
     private:
         void wait();
     private:
+        bool event_tick_ = false;
+        int32_t timer_precision_ = TIMER_PRECISION;
         std::atomic<state> state_;
         int64_t now_;
         std::vector<std::unique_ptr<worker>> workers_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
         log default_log_;
         router router_;
     };
@@ -1,6 +1,8 @@
 #pragma once
 #include "config.hpp"
 #include "common/log.hpp"
+#include "common/timer.hpp"
+#include "message.hpp"
 #include "router.h"
 
 namespace moon
@@ -15,6 +17,8 @@ namespace moon
     public:
         friend class router;
 
+        friend class worker;
+
         service() = default;
 
         service(const service&) = delete;
@@ -90,6 +94,23 @@ namespace moon
             ok_ = v;
         }
 
+        const mailbox_limit& get_mailbox_limit() const
+        {
+            return mailbox_limit_;
+        }
+
+        //takes effect on next message, only call from the worker thread that owns the service
+        void set_mailbox_limit(const mailbox_limit& v)
+        {
+            mailbox_limit_ = v;
+        }
+
+        //not pinned by threadid, may be moved to an idle worker when work stealing enabled
+        bool stealable() const
+        {
+            return stealable_;
+        }
+
         template<typename Message>
         void handle_message(Message&& m)
         {
@@ -131,7 +152,12 @@ namespace moon
 
         virtual void dispatch(message* msg) = 0;
 
-        virtual void on_timer(uint32_t, bool) {};
+        virtual void on_timer(timer_id_t, bool) {};
+
+        //one bounded gc step when the worker is idle, returns true while there is more to collect
+        virtual bool gc_step() { return false; }
+
+        virtual size_t memory_use() { return 0; }
 
         virtual void exit()
         {
@@ -152,11 +178,41 @@ namespace moon
         {
             id_ = v;
         }
+
+        void stealable(bool v)
+        {
+            stealable_ = v;
+        }
     protected:
         bool start_ = false;
         bool ok_ = false;
         bool unique_ = false;
+        bool stealable_ = false;
         uint32_t id_ = 0;
+        //messages handled in current worker batch, used by work stealing
+        uint32_t handled_ = 0;
+        //in worker run queue
+        bool queued_ = false;
+        //longest time(microsecond) a message waited in mailbox, reset when queried
+        int64_t max_wait_ = 0;
+        //depth reached high watermark and has not fallen to low watermark yet
+        bool congested_ = false;
+        //requests dropped or rejected by mailbox policy
+        uint64_t dropped_ = 0;
+        //collected by worker idle gc
+        bool idle_gc_ = false;
+        //in worker idle gc queue
+        bool gc_queued_ = false;
+        //time(microsecond) and count of all gc steps, in dispatch or idle
+        int64_t gc_time_ = 0;
+        uint64_t gc_steps_ = 0;
+        //cycles finished by worker idle gc
+        uint64_t gc_cycles_ = 0;
+        mailbox_limit mailbox_limit_;
+        //messages wait here until the service gets its turn, only touched by worker thread
+        std::deque<std::pair<int64_t, message_ptr_t>> mailbox_;
+        //broadcast groups subscribed in current worker
+        std::vector<uint32_t> groups_;
         log* log_ = nullptr;
         server* server_ = nullptr;
         router* router_ = nullptr;
@@ -15,6 +15,7 @@ namespace moon
         , server_(srv)
         , io_ctx_(1)
         , work_(asio::make_work_guard(io_ctx_))
+        , tick_timer_(io_ctx_)
     {
     }
 
@@ -30,10 +31,13 @@ namespace moon
             return server_->now();
         });
 
+        timer_.set_precision(server_->timer_precision());
+
         timer_.set_on_timer([this](timer_id_t timerid, uint32_t serviceid, bool remove) {
             if (auto s = find_service(serviceid); nullptr != s)
             {
                 s->on_timer(timerid, remove);
+                want_gc(s);
             }
             else
             {
@@ -122,6 +126,13 @@ namespace moon
                     check_start();//force service invoke start, ready to handle message
                     router_->response(creatorid, std::string_view{}, std::to_string(serviceid), sessionid);
                 }
+                else if (started_ && server_->event_tick())
+                {
+                    //no update tick in this mode
+                    post([this] {
+                        check_start();
+                    });
+                }
                 return;
             } while (false);
 
@@ -139,6 +150,22 @@ namespace moon
         post([this, serviceid, sender, sessionid, crashed]() {
             if (auto s = find_service(serviceid); nullptr != s)
             {
+                for (auto& it : s->mailbox_)
+                {
+                    dead_letter(it.second);
+                }
+                pending_ -= s->mailbox_.size();
+                s->mailbox_.clear();
+                if (s->congested_)
+                {
+                    congest(s, false);
+                }
+
+                while (!s->groups_.empty())
+                {
+                    unsubscribe(s, s->groups_.back());
+                }
+
                 s->destroy();
                 if (!crashed)
                 {
@@ -164,6 +191,11 @@ namespace moon
                 }
                 router_->broadcast(serviceid, buf, header, PTYPE_SYSTEM);
             }
+            else if (auto iter = moved_.find(serviceid); iter != moved_.end())
+            {
+                iter->second->remove_service(serviceid, sender, sessionid, crashed);
+                moved_.erase(iter);
+            }
             else
             {
                 router_->response(sender, "worker::remove_service "sv, moon::format("service [%X] not found", serviceid), sessionid, PTYPE_ERROR);
@@ -186,31 +218,26 @@ namespace moon
         if (mq_.push_back(std::move(msg)) == 1)
         {
             post([this]() {
-                auto begin_time = server_->now();;
-                size_t count = 0;
-                if (mq_.size() != 0)
-                {
-                    service* ser = nullptr;
-                    swapmq_.clear();
-                    mq_.swap(swapmq_);
-                    count = swapmq_.size();
-                    for (auto& msg : swapmq_)
-                    {
-                        handle_one(ser, std::move(msg));
-                    }
-                }
+                dispatch();
+            });
+        }
+    }
 
-                if (begin_time != 0)
-                {
-                    auto difftime = server_->now() - begin_time;
-                    cpu_time_ += difftime;
-                    if (difftime > 1000)
-                    {
-                        CONSOLE_WARN(router_->logger(), "worker handle cost %" PRId64 "ms queue size %zu", difftime, count);
-                    }
-                }
+    void worker::send(std::vector<message_ptr_t>& msgs)
+    {
+        if (msgs.empty())
+        {
+            return;
+        }
+
+        auto n = msgs.size();
+        if (mq_.push_back(msgs.begin(), msgs.end()) == n)
+        {
+            post([this]() {
+                dispatch();
             });
         }
+        msgs.clear();
     }
 
     uint32_t worker::id() const
@@ -218,13 +245,23 @@ namespace moon
         return workerid_;
     }
 
-    service * worker::find_service(uint32_t serviceid) const
+    service * worker::find_service(uint32_t serviceid)
     {
         auto iter = services_.find(serviceid);
         if (services_.end() != iter)
         {
             return iter->second.get();
         }
+
+        //stolen service may be used before the adopt event is handled
+        if (has_incoming_.load(std::memory_order_acquire))
+        {
+            adopt_incoming();
+            if (iter = services_.find(serviceid); services_.end() != iter)
+            {
+                return iter->second.get();
+            }
+        }
         return nullptr;
     }
 
@@ -250,6 +287,15 @@ namespace moon
     uint32_t worker::make_prefab(const moon::buffer_ptr_t & buf)
     {
         auto iter = prefabs_.emplace(uuid(), buf);
+        if (server_->event_tick() && !prefab_clear_)
+        {
+            //prefab lives until current event is handled
+            prefab_clear_ = true;
+            post([this] {
+                prefab_clear_ = false;
+                prefabs_.clear();
+            });
+        }
         if (iter.second)
         {
             return iter.first->first;
@@ -267,6 +313,24 @@ namespace moon
         CONSOLE_DEBUG(server_->logger(), "send_prepare failed, can not find prepared data. prefabid %u", prefabid);
     }
 
+    bool worker::try_claim()
+    {
+        bool expected = true;
+        return (state_.load(std::memory_order_acquire) == state::ready) && idle_.compare_exchange_strong(expected, false);
+    }
+
+    void worker::adopt(service_ptr_t&& s)
+    {
+        {
+            std::unique_lock lck(incoming_lck_);
+            incoming_.emplace_back(std::move(s));
+            has_incoming_.store(true, std::memory_order_release);
+        }
+        post([this] {
+            adopt_incoming();
+        });
+    }
+
     void worker::shared(bool v)
     {
         shared_ = v;
@@ -285,10 +349,53 @@ namespace moon
     void worker::start()
     {
         post([this] {
+            started_ = true;
             for (auto& it : services_)
             {
                 it.second->start();
             }
+            check_start();
+            if (server_->event_tick())
+            {
+                arm_timer();
+            }
+        });
+    }
+
+    timer_id_t worker::repeat(int32_t duration, int32_t times, uint32_t serviceid)
+    {
+        auto timerid = timer_.repeat(duration, times, serviceid);
+        if (server_->event_tick())
+        {
+            arm_timer();
+        }
+        return timerid;
+    }
+
+    void worker::arm_timer()
+    {
+        auto wait = timer_.wait_time();
+        if (wait < 0)
+        {
+            return;
+        }
+
+        auto expiry = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait);
+        if (timer_armed_ && tick_timer_.expiry() <= expiry)
+        {
+            return;
+        }
+
+        //re-arm cancels the previous wait
+        timer_armed_ = true;
+        tick_timer_.expires_at(expiry);
+        tick_timer_.async_wait([this](const asio::error_code& e) {
+            if (e)
+            {
+                return;
+            }
+            timer_armed_ = false;
+            update();
         });
     }
 
@@ -306,16 +413,143 @@ namespace moon
         });
     }
 
-    void worker::handle_one(service*& ser, message_ptr_t&& msg)
+    void worker::dispatch()
+    {
+        idle_.store(false, std::memory_order_release);
+        auto begin_time = server_->now();
+        if (mq_.size() != 0)
+        {
+            service* ser = nullptr;
+            swapmq_.clear();
+            mq_.swap(swapmq_);
+            auto stamp = time::microsecond();
+            for (auto& msg : swapmq_)
+            {
+                route(ser, std::move(msg), stamp);
+            }
+        }
+
+        //one turn for each runnable service, a turn handles at most 'budget' messages
+        size_t count = 0;
+        if (!runq_.empty())
+        {
+            auto budget = router_->budget();
+            auto now = time::microsecond();
+            for (size_t n = runq_.size(); n > 0; --n)
+            {
+                auto s = find_service(runq_.front());
+                runq_.pop_front();
+                //removed or moved to other worker
+                if (nullptr == s)
+                {
+                    continue;
+                }
+
+                auto& mailbox = s->mailbox_;
+                if (mailbox.empty())
+                {
+                    s->queued_ = false;
+                    continue;
+                }
+
+                if (auto wait = now - mailbox.front().first; wait > s->max_wait_)
+                {
+                    s->max_wait_ = wait;
+                }
+
+                uint32_t k = 0;
+                do
+                {
+                    auto msg = std::move(mailbox.front().second);
+                    mailbox.pop_front();
+                    handle_one(s, std::move(msg));
+                } while (++k != budget && !mailbox.empty());
+                count += k;
+                pending_ -= k;
+
+                if (s->congested_ && mailbox.size() <= s->mailbox_limit_.low)
+                {
+                    congest(s, false);
+                }
+
+                if (mailbox.empty())
+                {
+                    s->queued_ = false;
+                }
+                else
+                {
+                    runq_.push_back(s->id());
+                }
+            }
+        }
+
+        if (begin_time != 0)
+        {
+            auto difftime = server_->now() - begin_time;
+            cpu_time_ += difftime;
+            if (difftime > 1000)
+            {
+                CONSOLE_WARN(router_->logger(), "worker handle cost %" PRId64 "ms handled %zu pending %zu", difftime, count, pending_);
+            }
+        }
+
+        if (router_->steal())
+        {
+            balance();
+            idle_.store(mq_.size() == 0 && runq_.empty(), std::memory_order_release);
+        }
+
+        //handled messages may add or fire timers
+        if (server_->event_tick())
+        {
+            arm_timer();
+        }
+
+        //let io and timer events run before next turn
+        schedule();
+
+        if (runq_.empty())
+        {
+            schedule_gc();
+        }
+    }
+
+    void worker::schedule()
+    {
+        if (!runq_.empty() && !dispatching_)
+        {
+            dispatching_ = true;
+            post([this] {
+                dispatching_ = false;
+                dispatch();
+            });
+        }
+    }
+
+    void worker::route(service*& ser, message_ptr_t&& msg, int64_t stamp)
     {
         if (msg->broadcast())
         {
-            for (auto& it : services_)
+            //every receiver gets its own envelope sharing payload and header, keep order in each mailbox
+            if (msg->receiver() == 0)
             {
-                auto& s = it.second;
-                if (s->ok() && s->id() != msg->sender())
+                for (auto& it : services_)
+                {
+                    auto& s = it.second;
+                    if (s->ok() && s->id() != msg->sender())
+                    {
+                        enqueue(s.get(), msg->share(s->id()), stamp);
+                    }
+                }
+            }
+            else if (auto iter = groups_.find(msg->receiver()); iter != groups_.end())
+            {
+                for (auto s : iter->second)
                 {
-                    s->handle_message(std::forward<message_ptr_t>(msg));
+                    if (s->ok() && s->id() != msg->sender())
+                    {
+                        enqueue(s, msg->share(s->id()), stamp);
+                    }
                 }
             }
             return;
@@ -326,27 +560,198 @@ namespace moon
             ser = find_service(msg->receiver());
             if (nullptr == ser)
             {
-                msg->set_sessionid(-msg->sessionid());
-                router_->response(msg->sender(), "worker::handle_one "sv, moon::format("[%u] attempt send to dead service [%u]: %s.", msg->sender(), msg->receiver(), moon::hex_string({ msg->data(),msg->size() }).data()).data(), msg->sessionid(), PTYPE_ERROR);
+                if (auto iter = moved_.find(msg->receiver()); iter != moved_.end())
+                {
+                    iter->second->send(std::forward<message_ptr_t>(msg));
+                    return;
+                }
+                dead_letter(msg);
                 return;
             }
         }
-        ser->handle_message(std::forward<message_ptr_t>(msg));
+        enqueue(ser, std::forward<message_ptr_t>(msg), stamp);
+    }
+
+    void worker::enqueue(service* s, message_ptr_t&& msg, int64_t stamp)
+    {
+        auto& limit = s->mailbox_limit_;
+        auto& mailbox = s->mailbox_;
+        if (limit.high != 0 && mailbox.size() >= limit.high && !s->congested_)
+        {
+            congest(s, true);
+        }
+
+        //responses and system messages always get in, dropping them would hang coroutines or lose exit events
+        if (s->congested_ && droppable(msg))
+        {
+            switch (limit.policy)
+            {
+            case mailbox_policy::drop_oldest:
+            {
+                if (mailbox.size() >= limit.high)
+                {
+                    auto it = std::find_if(mailbox.begin(), mailbox.end(), [](const auto& v) {
+                        return droppable(v.second);
+                    });
+                    if (it != mailbox.end())
+                    {
+                        reject(s, it->second);
+                        mailbox.erase(it);
+                        --pending_;
+                    }
+                }
+                break;
+            }
+            case mailbox_policy::reject:
+            {
+                reject(s, msg);
+                return;
+            }
+            default:
+                break;
+            }
+        }
+
+        mailbox.emplace_back(stamp, std::forward<message_ptr_t>(msg));
+        ++pending_;
+        if (!s->queued_)
+        {
+            s->queued_ = true;
+            runq_.push_back(s->id());
+        }
+    }
+
+    bool worker::droppable(const message_ptr_t& msg)
+    {
+        return msg->sessionid() <= 0 && msg->type() != PTYPE_SYSTEM;
+    }
+
+    void worker::reject(service* s, const message_ptr_t& msg)
+    {
+        ++s->dropped_;
+        if (msg->sessionid() < 0)
+        {
+            router_->response(msg->sender(), "worker::mailbox "sv, moon::format("service [%X] mailbox full, depth %zu", s->id(), s->mailbox_.size()), -msg->sessionid(), PTYPE_ERROR);
+        }
+    }
+
+    void worker::congest(service* s, bool v)
+    {
+        s->congested_ = v;
+        if (v)
+        {
+            CONSOLE_WARN(router_->logger(), "service [%X] mailbox reached high watermark %u, policy %d", s->id(), s->mailbox_limit_.high, static_cast<int>(s->mailbox_limit_.policy));
+        }
+        else
+        {
+            CONSOLE_DEBUG(router_->logger(), "service [%X] mailbox fell to low watermark %u", s->id(), s->mailbox_limit_.low);
+        }
+
+        if (s->mailbox_limit_.policy == mailbox_policy::throttle)
+        {
+            socket_->pause_read(s->id(), v);
+        }
+    }
+
+    void worker::dead_letter(const message_ptr_t& msg)
+    {
+        msg->set_sessionid(-msg->sessionid());
+        router_->response(msg->sender(), "worker::handle_one "sv, moon::format("[%u] attempt send to dead service [%u]: %s.", msg->sender(), msg->receiver(), moon::hex_string({ msg->data(),msg->size() }).data()).data(), msg->sessionid(), PTYPE_ERROR);
+    }
+
+    void worker::handle_one(service* s, message_ptr_t&& msg)
+    {
+        if (router_->steal() && 0 == s->handled_++)
+        {
+            busy_.push_back(s);
+        }
+        s->handle_message(std::forward<message_ptr_t>(msg));
+        want_gc(s);
         timer_.update();
     }
 
+    void worker::want_gc(service* s)
+    {
+        if (s->idle_gc_ && !s->gc_queued_ && router_->gc_budget() > 0)
+        {
+            s->gc_queued_ = true;
+            gcq_.push_back(s->id());
+        }
+    }
+
+    void worker::schedule_gc()
+    {
+        if (!gcq_.empty() && !gc_scheduled_)
+        {
+            gc_scheduled_ = true;
+            post([this] {
+                idle_gc();
+            });
+        }
+    }
+
+    void worker::idle_gc()
+    {
+        gc_scheduled_ = false;
+        //messages first, dispatch schedules gc again when run queue is empty
+        if (!runq_.empty() || mq_.size() != 0)
+        {
+            return;
+        }
+
+        auto budget = router_->gc_budget();
+        auto begin = time::microsecond();
+        while (!gcq_.empty())
+        {
+            auto s = find_service(gcq_.front());
+            if (nullptr == s)
+            {
+                gcq_.pop_front();
+                continue;
+            }
+
+            bool more = true;
+            while (more && time::microsecond() - begin < budget)
+            {
+                more = s->gc_step();
+            }
+
+            //out of budget, continue with it in the next idle period
+            if (more)
+            {
+                break;
+            }
+            s->gc_queued_ = false;
+            gcq_.pop_front();
+        }
+        //not posted again: the next idle period starts after a dispatch turn or a server tick
+    }
+
     void worker::register_commands()
     {
         {
             auto hander = [this](const std::vector<std::string>& params) {
                 (void)params;
-                auto response = moon::format(R"({"work_time":%lld})", cpu_time_);
+                auto response = moon::format(R"({"work_time":%lld,"steal":%u,"stolen":%u})", cpu_time_, steal_count_, stolen_count_);
                 cpu_time_ = 0;
                 return response;
             };
             commands_.try_emplace("worktime", hander);
         }
 
+        {
+            //pooled allocations made by this worker thread, heap is the part pools could not serve
+            auto hander = [](const std::vector<std::string>& params) {
+                (void)params;
+                auto& m = block_pool_stat_of<message>();
+                auto& b = block_pool_stat_of<buffer>();
+                return moon::format(R"({"message":%llu,"message_heap":%llu,"buffer":%llu,"buffer_heap":%llu})"
+                    , static_cast<unsigned long long>(m.count), static_cast<unsigned long long>(m.heap)
+                    , static_cast<unsigned long long>(b.count), static_cast<unsigned long long>(b.heap));
+            };
+            commands_.try_emplace("alloc", hander);
+        }
+
         {
             auto hander = [this](const std::vector<std::string>& params) {
                 (void)params;
@@ -361,18 +766,80 @@ namespace moon
             };
             commands_.try_emplace("services", hander);
         }
+
+        {
+            auto hander = [this](const std::vector<std::string>& params) {
+                (void)params;
+                std::string content;
+                content.append("[");
+                for (auto& it : services_)
+                {
+                    auto& s = it.second;
+                    if (content.size() > 1)
+                    {
+                        content.append(",");
+                    }
+                    content.append(moon::format(R"({"name":"%s","serviceid":%u,"depth":%zu,"max_wait_us":%lld,"high":%u,"low":%u,"congested":%s,"dropped":%llu})"
+                        , s->name().data(), s->id(), s->mailbox_.size(), s->max_wait_
+                        , s->mailbox_limit_.high, s->mailbox_limit_.low, s->congested_ ? "true" : "false", static_cast<unsigned long long>(s->dropped_)));
+                    s->max_wait_ = 0;
+                }
+                content.append("]");
+                return content;
+            };
+            commands_.try_emplace("mailbox", hander);
+        }
+
+        {
+            //gc_time_us and gc_steps count all collector steps, gc_cycles the cycles finished by idle gc
+            auto hander = [this](const std::vector<std::string>& params) {
+                (void)params;
+                std::string content;
+                content.append("[");
+                for (auto& it : services_)
+                {
+                    auto& s = it.second;
+                    if (content.size() > 1)
+                    {
+                        content.append(",");
+                    }
+                    content.append(moon::format(R"({"name":"%s","serviceid":%u,"idle_gc":%s,"gc_time_us":%lld,"gc_steps":%llu,"gc_cycles":%llu,"memory":%zu})"
+                        , s->name().data(), s->id(), s->idle_gc_ ? "true" : "false", static_cast<long long>(s->gc_time_)
+                        , static_cast<unsigned long long>(s->gc_steps_), static_cast<unsigned long long>(s->gc_cycles_), s->memory_use()));
+                }
+                content.append("]");
+                return content;
+            };
+            commands_.try_emplace("gc", hander);
+        }
     }
 
     void worker::update()
     {
         timer_.update();
 
+        if (router_->steal() && mq_.size() == 0 && runq_.empty())
+        {
+            idle_.store(true, std::memory_order_release);
+        }
+
         check_start();
 
+        //services that only ran timers
+        if (runq_.empty())
+        {
+            schedule_gc();
+        }
+
         if (!prefabs_.empty())
         {
             prefabs_.clear();
         }
+
+        if (server_->event_tick())
+        {
+            arm_timer();
+        }
     }
 
     void worker::check_start()
@@ -390,4 +857,133 @@ namespace moon
             will_start_.clear();
         }
     }
+
+    void worker::balance()
+    {
+        //the busiest service stays, give the next one to an idle worker, at most once per update tick
+        if (busy_.size() > 1 && pending_ >= STEAL_BACKLOG && server_->now() - steal_time_ >= UPDATE_INTERVAL)
+        {
+            steal_time_ = server_->now();
+            std::sort(busy_.begin(), busy_.end(), [](const service* a, const service* b) {
+                return a->handled_ > b->handled_;
+            });
+
+            for (auto s : busy_)
+            {
+                s->handled_ = 0;
+            }
+
+            for (auto it = busy_.begin() + 1; it != busy_.end(); ++it)
+            {
+                auto s = *it;
+                if (!s->stealable() || !s->ok() || !s->is_start() || !s->groups_.empty() || timer_.has_timer(s->id()))
+                {
+                    continue;
+                }
+
+                worker* thief = router_->idle_worker(workerid_);
+                if (nullptr == thief)
+                {
+                    break;
+                }
+
+                auto serviceid = s->id();
+                auto npending = s->mailbox_.size();
+                auto iter = services_.find(serviceid);
+                if (router_->move_service(iter->second, thief))
+                {
+                    //pending mailbox goes with the service
+                    pending_ -= npending;
+                    services_.erase(iter);
+                    moved_.emplace(serviceid, thief);
+                    ++stolen_count_;
+                    if (services_.empty()) shared(true);
+                    CONSOLE_DEBUG(router_->logger(), "service [%X] moved from worker %u to worker %u", serviceid, workerid_, thief->id());
+                }
+                else
+                {
+                    //owns socket, stay here
+                    s->stealable(false);
+                    thief->idle_.store(true, std::memory_order_release);
+                }
+                break;
+            }
+        }
+        else
+        {
+            for (auto s : busy_)
+            {
+                s->handled_ = 0;
+            }
+        }
+        busy_.clear();
+    }
+
+    void worker::adopt_incoming()
+    {
+        std::vector<service_ptr_t> v;
+        {
+            std::unique_lock lck(incoming_lck_);
+            v.swap(incoming_);
+            has_incoming_.store(false, std::memory_order_release);
+        }
+
+        for (auto& s : v)
+        {
+            auto serviceid = s->id();
+            auto res = services_.try_emplace(serviceid, std::move(s));
+            ++steal_count_;
+
+            auto& ser = res.first->second;
+            //pinned after one move: moving it again, back home in particular, would let messages
+            //still forwarded along the old path overtake newer ones
+            ser->stealable(false);
+            ser->gc_queued_ = false;
+            want_gc(ser.get());
+            ser->queued_ = !ser->mailbox_.empty();
+            if (ser->queued_)
+            {
+                pending_ += ser->mailbox_.size();
+                runq_.push_back(serviceid);
+            }
+            if (state_.load(std::memory_order_acquire) != state::ready)
+            {
+                //worker is stopping, service came too late
+                state_.store(state::stopping, std::memory_order_release);
+                res.first->second->exit();
+            }
+        }
+        schedule();
+    }
+
+    bool worker::subscribe(service* s, uint32_t group)
+    {
+        if (0 == group || std::find(s->groups_.begin(), s->groups_.end(), group) != s->groups_.end())
+        {
+            return false;
+        }
+        s->groups_.push_back(group);
+        groups_[group].push_back(s);
+        return true;
+    }
+
+    bool worker::unsubscribe(service* s, uint32_t group)
+    {
+        auto it = std::find(s->groups_.begin(), s->groups_.end(), group);
+        if (it == s->groups_.end())
+        {
+            return false;
+        }
+        s->groups_.erase(it);
+
+        auto iter = groups_.find(group);
+        assert(iter != groups_.end());
+        auto& v = iter->second;
+        v.erase(std::find(v.begin(), v.end(), s));
+        if (v.empty())
+        {
+            groups_.erase(iter);
+        }
+        return true;
+    }
 }
@@ -1,6 +1,7 @@
 #pragma once
 #include "config.hpp"
 #include "common/concurrent_queue.hpp"
+#include "common/mpsc_queue.hpp"
 #include "common/spinlock.hpp"
 #include "worker_timer.hpp"
 #include "network/socket.h"
@@ -12,7 +13,11 @@ namespace moon
 
     class worker
     {
+#ifdef MOON_MPSC_MAILBOX
+        using queue_t = mpsc_queue<message_ptr_t, std::vector>;
+#else
         using queue_t = concurrent_queue<message_ptr_t, moon::spin_lock, std::vector>;
+#endif
 
         using command_hander_t = std::function<std::string(const std::vector<std::string>&)>;
 
@@ -46,6 +51,9 @@ namespace moon
 
         void send(message_ptr_t&& msg);
 
+        //one queue operation and at most one wakeup for all messages, msgs is cleared
+        void send(std::vector<message_ptr_t>& msgs);
+
         void shared(bool v);
 
         bool shared() const;
@@ -55,7 +63,18 @@ namespace moon
         uint32_t make_prefab(const moon::buffer_ptr_t & buf);
 
         void send_prefab(uint32_t sender, uint32_t receiver, uint32_t prefabid, const  moon::string_view_t& header, int32_t sessionid, uint8_t type) const;
+
+        bool try_claim();
+
+        void adopt(service_ptr_t&& s);
+
+        //group 0 is all services, can not subscribe
+        bool subscribe(service* s, uint32_t group);
+
+        bool unsubscribe(service* s, uint32_t group);
     
+        timer_id_t repeat(int32_t duration, int32_t times, uint32_t serviceid);
+
         worker_timer& timer() { return timer_; }
 
         moon::socket& socket() { return *socket_; }
@@ -78,7 +97,31 @@ namespace moon
 
         void post_update();
 
-        void handle_one(service*& ser, message_ptr_t&& msg);
+        void dispatch();
+
+        void schedule();
+
+        void route(service*& ser, message_ptr_t&& msg, int64_t stamp);
+
+        void enqueue(service* s, message_ptr_t&& msg, int64_t stamp);
+
+        void dead_letter(const message_ptr_t& msg);
+
+        //requests can be dropped or rejected by mailbox policy
+        static bool droppable(const message_ptr_t& msg);
+
+        void reject(service* s, const message_ptr_t& msg);
+
+        void congest(service* s, bool v);
+
+        void handle_one(service* s, message_ptr_t&& msg);
+
+        //service may have garbage after it ran
+        void want_gc(service* s);
+
+        void schedule_gc();
+
+        void idle_gc();
 
         void register_commands();
 
@@ -86,10 +129,28 @@ namespace moon
 
         void check_start();
 
-        service* find_service(uint32_t serviceid) const;
+        void arm_timer();
+
+        void balance();
+
+        void adopt_incoming();
+
+        service* find_service(uint32_t serviceid);
     private:
         std::atomic<state> state_ = state::init;
         std::atomic_bool shared_ = true;
+        //mailbox was empty after last batch, can steal services from busy workers
+        std::atomic_bool idle_ = true;
+        std::atomic_bool has_incoming_ = false;
+        bool started_ = false;
+        bool timer_armed_ = false;
+        bool prefab_clear_ = false;
+        bool dispatching_ = false;
+        bool gc_scheduled_ = false;
+        int64_t steal_time_ = 0;
+        size_t pending_ = 0;
+        uint32_t steal_count_ = 0;
+        uint32_t stolen_count_ = 0;
         //to prevent post too many update event
         std::atomic_flag update_state_ = ATOMIC_FLAG_INIT;
         uint32_t uuid_ = 0;
@@ -99,15 +160,27 @@ namespace moon
         server*  server_;
         asio::io_context io_ctx_;
         asio_work_t work_;
+        asio::steady_timer tick_timer_;
         std::thread thread_;
         queue_t mq_;
         queue_t::container_type swapmq_;
+        //services that have messages in mailbox
+        std::deque<uint32_t> runq_;
+        //services waiting for idle gc
+        std::deque<uint32_t> gcq_;
         worker_timer timer_;
         std::unique_ptr<moon::socket> socket_;
         std::vector<uint32_t> will_start_;
         std::unordered_map<uint32_t, service_ptr_t> services_;
         std::unordered_map<std::string, command_hander_t> commands_;
         std::unordered_map<uint32_t, moon::buffer_ptr_t> prefabs_;
+        std::vector<service*> busy_;
+        spin_lock incoming_lck_;
+        std::vector<service_ptr_t> incoming_;
+        //services given away, messages to them are forwarded
+        std::unordered_map<uint32_t, worker*> moved_;
+        //broadcast group subscribers
+        std::unordered_map<uint32_t, std::vector<service*>> groups_;
     };
 };
 
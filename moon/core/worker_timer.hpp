@@ -3,24 +3,12 @@
 
 namespace moon
 {
-    class worker_timer :public base_timer<worker_timer>
+    //timer context is the owner service id
+    class worker_timer :public base_timer<worker_timer, uint32_t>
     {
-        static constexpr int MAX_TIMER_NUM = (1 << 24) - 1;
-
         using timer_handler_t = std::function<void(timer_id_t, uint32_t, bool)>;
 
-        friend class base_timer<worker_timer>;
-
-        struct worker_timer_context:public timer_context
-        {
-            worker_timer_context(int32_t duration, int32_t times, uint32_t sid)
-                :timer_context(duration, times)
-                , serviceid(sid)
-            {
-
-            }
-            uint32_t serviceid;
-        };
+        friend class base_timer<worker_timer, uint32_t>;
     public:
         timer_id_t repeat(int32_t duration, int32_t times, uint32_t serviceid)
         {
@@ -28,41 +16,28 @@ namespace moon
             {
                 return 0;
             }
+            return add(duration, times, serviceid);
+        }
 
-            if (duration < PRECISION)
-            {
-                duration = PRECISION;
-            }
-
-            assert(times < worker_timer_context::times_mask);
-
-            if (uuid_ == 0 || uuid_ == MAX_TIMER_NUM)
-                uuid_ = 1;
-
-            while (timers_.find(uuid_) != timers_.end())
-            {
-                ++uuid_;
-            }
+        using base_timer<worker_timer, uint32_t>::remove;
 
-            if (times <= 0)
+        //a service only removes its own timers
+        bool remove(timer_id_t id, uint32_t serviceid)
+        {
+            auto ctx = context(id);
+            if (nullptr == ctx || *ctx != serviceid)
             {
-                times = (0 | worker_timer_context::infinite);
+                return false;
             }
-
-            timer_id_t id = uuid_;
-            insert_timer(duration, id);
-            timers_.emplace(id, worker_timer_context{ duration,times,serviceid });
-            return id;
+            return remove(id);
         }
 
-        void remove(timer_id_t timerid)
+        //slow path, only used when deciding if a service can leave this worker
+        bool has_timer(uint32_t serviceid) const
         {
-            auto iter = timers_.find(timerid);
-            if (iter != timers_.end())
-            {
-                iter->second.set_flag(worker_timer_context::removed);
-                return;
-            }
+            return any_of([serviceid](uint32_t sid) {
+                return sid == serviceid;
+            });
         }
 
         void set_on_timer(const timer_handler_t& v)
@@ -71,41 +46,15 @@ namespace moon
         }
 
     private:
-        timer_id_t create_timerid()
+        void on_timer(timer_id_t id, uint32_t serviceid, bool last)
         {
-            if (uuid_ == 0 || uuid_ == MAX_TIMER_NUM)
-                uuid_ = 1;
-            while (timers_.find(uuid_) != timers_.end())
-            {
-                ++uuid_;
-            }
-            return uuid_;
-        }
-
-        int32_t on_timer(timer_id_t id)
-        {
-            auto iter = timers_.find(id);
-            if (iter == timers_.end())
-            {
-                return 0;
-            }
-
-            auto&ctx = iter->second;
-            if (!ctx.has_flag(worker_timer_context::removed))
+            on_timer_(id, serviceid, false);
+            if (last)
             {
-                on_timer_(id, ctx.serviceid, false);
-                if (ctx.has_flag(worker_timer_context::infinite) || ctx.times(ctx.times() - 1))
-                {
-                    return ctx.duration();
-                }
+                on_timer_(id, serviceid, true);
             }
-            on_timer_(id, ctx.serviceid, true);
-            timers_.erase(iter);
-            return 0;
         }
     private:
-        uint32_t uuid_ = 0;
-        std::unordered_map<uint32_t, worker_timer_context> timers_;
         timer_handler_t on_timer_;
     };
 }
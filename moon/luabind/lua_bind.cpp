@@ -11,6 +11,7 @@
 #include "server.h"
 #include "worker.h"
 #include "lua_buffer.hpp"
+#include "lua_buffer_view.hpp"
 #include "lua_serialize.hpp"
 #include "services/lua_service.h"
 
@@ -29,13 +30,12 @@ const lua_bind & lua_bind::bind_timer(lua_service* s) const
 {
     lua.set_function("repeated", [s](int32_t duration, int32_t times)
     {
-        auto& timer = s->get_worker()->timer();
-        return timer.repeat(duration, times, s->id());
+        return s->get_worker()->repeat(duration, times, s->id());
     });
     lua.set_function("remove_timer", [s](timer_id_t timerid)
     {
         auto& timer = s->get_worker()->timer();
-        timer.remove(timerid);
+        return timer.remove(timerid, s->id());
     });
     return *this;
 }
@@ -159,6 +159,7 @@ const lua_bind & lua_bind::bind_util() const
     lua.set_function("second", time::second);
     lua.set_function("millsecond", time::millisecond);
     lua.set_function("microsecond", time::microsecond);
+    lua.set_function("intern_header", message::intern_header);
     lua.set_function("time_offset", time::offset);
 
     lua.set_function("sleep", [](int64_t ms) { thread_sleep(ms); });
@@ -181,6 +182,7 @@ const lua_bind & lua_bind::bind_util() const
 
     lua.new_enum<moon::buffer_flag>("buffer_flag", {
         {"close",moon::buffer_flag::close},
+        {"droppable",moon::buffer_flag::droppable},
         {"ws_text",moon::buffer_flag::ws_text} 
     });
     return *this;
@@ -223,6 +225,7 @@ const lua_bind & lua_bind::bind_message() const
     {"end",moon::buffer::seek_origin::End}
     });
 
+    //buffers come from msg:buffer(), which copies a shared payload first, or from seri.pack
     sol::table bt = lua.create_named("buffer");
 
     bt.set_function("write_front", [](void* p, std::string_view s)->bool {
@@ -252,11 +255,18 @@ const lua_bind & lua_bind::bind_message() const
     auto f_data = [](lua_State* L)->int
     {
         auto msg = sol::stack::get<message*>(L, -1);
-        lua_pushlightuserdata(L, (msg->get_buffer()->data()));
+        auto buf = msg->get_buffer();
+        lua_pushlightuserdata(L, (nullptr != buf) ? buf->data() : nullptr);
         lua_pushinteger(L, msg->size());
         return 2;
     };
 
+    auto f_view = [](lua_State* L)->int
+    {
+        auto msg = sol::stack::get<message*>(L, 1);
+        return lua_buffer_view::push(L, *msg);
+    };
+
     lua.new_usertype<message>("message"
         , sol::call_constructor, sol::no_constructor
         , "sender", (&message::sender)
@@ -265,13 +275,15 @@ const lua_bind & lua_bind::bind_message() const
         , "type", (&message::type)
         , "subtype", (&message::subtype)
         , "header", (&message::header)
+        , "header_id", (&message::header_id)
         , "bytes", (&message::bytes)
         , "size", (&message::size)
         , "substr", (&message::substr)
-        , "buffer", [](message* m)->void* {return m->get_buffer();}
+        , "buffer", [](message* m)->void* {return m->writable_buffer();}
         , "redirect", redirect
         , "resend", resend
         , "data", f_data
+        , "view", f_view
         );
     return *this;
 }
@@ -280,23 +292,67 @@ const lua_bind& lua_bind::bind_service(lua_service* s) const
 {
     auto router_ = s->get_router();
     auto server_ = s->get_server();
-    auto worker_ = s->get_worker();
 
     lua.set("null", (void*)(router_));
 
     lua.set_function("name", &lua_service::name, s);
     lua.set_function("id", &lua_service::id, s);
     lua.set_function("set_cb", &lua_service::set_callback, s);
-    lua.set_function("memory_use", &lua_service::memory_use, s);
-    lua.set_function("make_prefab", &worker::make_prefab, worker_);
-    lua.set_function("send_prefab", [worker_, s](uint32_t receiver, uint32_t cacheid, const string_view_t& header, int32_t sessionid, uint8_t type) {
-        worker_->send_prefab(s->id(), receiver, cacheid, header, sessionid, type);
+    //memory_use(true) gives pool details: page/large bytes and each size class in use
+    lua.set_function("memory_use", [s](sol::optional<bool> detail, sol::this_state L) -> sol::object {
+        if (!detail.value_or(false))
+        {
+            return sol::make_object(L, s->memory_use());
+        }
+        sol::state_view lua(L);
+        const moon::size_class_pool& pool = s->memory_pool();
+        sol::table classes = lua.create_table();
+        for (size_t i = 0; i < moon::size_class_pool::CLASS_COUNT; ++i)
+        {
+            auto st = pool.stat(i);
+            if (st.pages > 0)
+            {
+                classes.add(lua.create_table_with("size", st.size, "pages", st.pages, "blocks", st.blocks));
+            }
+        }
+        return lua.create_table_with("total", s->memory_use(), "page_bytes", pool.page_bytes(), "large_bytes", pool.large_bytes(), "classes", classes);
+    });
+    //service may be moved to other worker by work stealing, always use current worker
+    lua.set_function("make_prefab", [s](const moon::buffer_ptr_t& buf) {
+        return s->get_worker()->make_prefab(buf);
+    });
+    lua.set_function("send_prefab", [s](uint32_t receiver, uint32_t cacheid, const string_view_t& header, int32_t sessionid, uint8_t type) {
+        s->get_worker()->send_prefab(s->id(), receiver, cacheid, header, sessionid, type);
+    });
+    lua.set_function("subscribe", [s](uint32_t group) {
+        return s->get_worker()->subscribe(s, group);
+    });
+    lua.set_function("unsubscribe", [s](uint32_t group) {
+        return s->get_worker()->unsubscribe(s, group);
+    });
+    lua.set_function("set_mailbox_limit", [s](uint32_t high, uint32_t low, std::string_view policy) {
+        mailbox_limit v{ high, low, mailbox_policy::none };
+        MOON_CHECK(to_mailbox_policy(policy, v.policy), moon::format("unknown mailbox policy %s", std::string{ policy }.data()));
+        MOON_CHECK(low <= high, "mailbox low watermark must not be greater than high watermark");
+        s->set_mailbox_limit(v);
     });
     lua.set_function("send", &router::send, router_);
+    lua.set_function("send_id", &router::send_id, router_);
     lua.set_function("new_service", &router::new_service, router_);
     lua.set_function("remove_service", &router::remove_service, router_);
     lua.set_function("runcmd", &router::runcmd, router_);
     lua.set_function("broadcast", &router::broadcast, router_);
+    lua.set_function("publish", &router::publish, router_);
+    lua.set_function("send_many", [router_](uint32_t sender, sol::table receivers, const buffer_ptr_t& buf, string_view_t header, uint8_t type) {
+        thread_local std::vector<uint32_t> v;
+        v.clear();
+        auto n = receivers.size();
+        for (size_t i = 1; i <= n; ++i)
+        {
+            v.push_back(receivers.raw_get<uint32_t>(i));
+        }
+        router_->send_many(sender, v, buf, header, type);
+    });
     lua.set_function("workernum", &router::workernum, router_);
     lua.set_function("queryservice", &router::get_unique_service, router_);
     lua.set_function("set_env", &router::set_env, router_);
@@ -307,31 +363,145 @@ const lua_bind& lua_bind::bind_service(lua_service* s) const
     return *this;
 }
 
-const lua_bind & lua_bind::bind_socket(lua_service* s) const
+//listen and connect options table: { frame_length = "u16"|"u32"|"varint", reuseport = bool,
+//send_queue_limit = bytes, send_queue_policy = "close"|"drop"|"notify",
+//deflate = true|{ window_bits = 9-15, context_takeover = bool, threshold = bytes },
+//fragment = bytes, path = websocket request target of connect }
+static connection_options to_connection_options(const sol::optional<sol::table>& t)
 {
-    auto w = s->get_worker();
-    auto& sock = w->socket();
+    connection_options opt;
+    if (!t)
+    {
+        return opt;
+    }
+
+    opt.reuseport = t->get_or("reuseport", false);
+
+    auto length = t->get_or<std::string>("frame_length", "u16");
+    if (length == "u32")
+    {
+        opt.length = frame_length::u32;
+    }
+    else if (length == "varint")
+    {
+        opt.length = frame_length::varint;
+    }
+    else
+    {
+        MOON_CHECK(length == "u16", moon::format("unknown frame_length %s", length.data()));
+    }
+
+    opt.send_queue_limit = t->get_or("send_queue_limit", opt.send_queue_limit);
+    MOON_CHECK(opt.send_queue_limit > 0, "send_queue_limit must be greater than 0");
+
+    auto policy = t->get_or<std::string>("send_queue_policy", "close");
+    if (policy == "drop")
+    {
+        opt.policy = send_queue_policy::drop;
+    }
+    else if (policy == "notify")
+    {
+        opt.policy = send_queue_policy::notify;
+    }
+    else
+    {
+        MOON_CHECK(policy == "close", moon::format("unknown send_queue_policy %s", policy.data()));
+    }
+
+    opt.ws_fragment = t->get_or("fragment", opt.ws_fragment);
+    opt.ws_path = t->get_or<std::string>("path", opt.ws_path);
+
+    sol::object deflate = (*t)["deflate"];
+    if (deflate.is<sol::table>())
+    {
+        sol::table d = deflate.as<sol::table>();
+        opt.deflate.enable = true;
+        auto bits = d.get_or("window_bits", static_cast<int>(opt.deflate.window_bits));
+        MOON_CHECK(bits >= 9 && bits <= MAX_WS_WINDOW_BITS, "deflate window_bits must be in [9,15]");
+        opt.deflate.window_bits = static_cast<uint8_t>(bits);
+        opt.deflate.context_takeover = d.get_or("context_takeover", opt.deflate.context_takeover);
+        opt.deflate.threshold = d.get_or("threshold", opt.deflate.threshold);
+    }
+    else
+    {
+        opt.deflate.enable = deflate.is<bool>() && deflate.as<bool>();
+    }
+    return opt;
+}
 
+const lua_bind & lua_bind::bind_socket(lua_service* s) const
+{
+    //service may be moved to other worker by work stealing, always use current worker's socket
     sol::table tb = lua.create_named("socket");
 
-    tb.set_function("listen", [&sock,s](const std::string& host, uint16_t port, uint8_t type) {
-        return sock.listen(host, port, s->id(), type);
+    tb.set_function("listen", [s](const std::string& host, uint16_t port, uint8_t type, sol::optional<sol::table> opt) {
+        return s->get_worker()->socket().listen(host, port, s->id(), type, to_connection_options(opt));
     });
 
-    tb.set_function("accept", &moon::socket::accept,&sock);
-    tb.set_function("connect", [&sock, s](const std::string& host, uint16_t port, int32_t sessionid, uint32_t owner, uint8_t type, int32_t timeout) {
-        return sock.connect(host, port, s->id(), owner, type, sessionid, timeout);
+    tb.set_function("accept", [s](int fd, int32_t sessionid, uint32_t owner) {
+        s->get_worker()->socket().accept(fd, sessionid, owner);
+    });
+    tb.set_function("connect", [s](const std::string& host, uint16_t port, int32_t sessionid, uint32_t owner, uint8_t type, int32_t timeout, sol::optional<sol::table> opt) {
+        return s->get_worker()->socket().connect(host, port, s->id(), owner, type, sessionid, timeout, to_connection_options(opt));
+    });
+    tb.set_function("udp", [s](const std::string& host, uint16_t port, sol::optional<sol::table> opt) {
+        udp_options o;
+        if (opt)
+        {
+            o.arq = opt->get_or("arq", false);
+            o.loss = opt->get_or("loss", 0u);
+            MOON_CHECK(o.loss <= 100, "udp loss must be in [0,100]");
+            o.peer_timeout = opt->get_or("peer_timeout", o.peer_timeout);
+            o.max_peers = opt->get_or("max_peers", o.max_peers);
+            MOON_CHECK(o.max_peers > 0, "udp max_peers must be greater than 0");
+        }
+        return s->get_worker()->socket().udp(host, port, s->id(), o);
+    });
+    tb.set_function("sendto", [s](uint32_t fd, const std::string& addr, const buffer_ptr_t& data) {
+        return s->get_worker()->socket().sendto(fd, addr, data);
+    });
+    tb.set_function("read", [s](uint32_t fd, uint32_t owner, size_t n, read_delim delim, int32_t sessionid) {
+        s->get_worker()->socket().read(fd, owner, n, delim, sessionid);
+    });
+    tb.set_function("write", [s](uint32_t fd, const buffer_ptr_t& data) {
+        return s->get_worker()->socket().write(fd, data);
+    });
+    tb.set_function("write_with_flag", [s](uint32_t fd, const buffer_ptr_t& data, int flag) {
+        return s->get_worker()->socket().write_with_flag(fd, data, flag);
+    });
+    tb.set_function("write_message", [s](uint32_t fd, message* m) {
+        return s->get_worker()->socket().write_message(fd, m);
+    });
+    tb.set_function("broadcast_ws", [s](sol::table fds, const buffer_ptr_t& data, bool text) {
+        std::vector<uint32_t> v;
+        v.reserve(fds.size());
+        for (size_t i = 1; i <= fds.size(); ++i)
+        {
+            v.push_back(fds.get<uint32_t>(i));
+        }
+        return s->get_worker()->socket().broadcast_ws(v, data, text);
+    });
+    tb.set_function("close", [s](uint32_t fd) {
+        s->get_worker()->socket().close(fd);
+    });
+    tb.set_function("settimeout", [s](uint32_t fd, int v) {
+        return s->get_worker()->socket().settimeout(fd, v);
+    });
+    tb.set_function("set_read_timeout", [s](uint32_t fd, uint32_t ms) {
+        return s->get_worker()->socket().set_read_timeout(fd, ms);
+    });
+    tb.set_function("set_write_timeout", [s](uint32_t fd, uint32_t ms) {
+        return s->get_worker()->socket().set_write_timeout(fd, ms);
+    });
+    tb.set_function("setnodelay", [s](uint32_t fd) {
+        return s->get_worker()->socket().setnodelay(fd);
+    });
+    tb.set_function("queued_bytes", [s](uint32_t fd) {
+        return s->get_worker()->socket().queued_bytes(fd);
     });
-    tb.set_function("read", &moon::socket::read, &sock);
-    tb.set_function("write", &moon::socket::write, &sock);
-    tb.set_function("write_with_flag", &moon::socket::write_with_flag, &sock);
-    tb.set_function("write_message", &moon::socket::write_message, &sock);
-    tb.set_function("close", [&sock](uint32_t fd) {
-        sock.close(fd);
+    tb.set_function("set_enable_frame", [s](uint32_t fd, std::string flag) {
+        return s->get_worker()->socket().set_enable_frame(fd, std::move(flag));
     });
-    tb.set_function("settimeout", &moon::socket::settimeout, &sock);
-    tb.set_function("setnodelay", &moon::socket::setnodelay, &sock);
-    tb.set_function("set_enable_frame", &moon::socket::set_enable_frame, &sock);
     registerlib(lua.lua_state(), "socketcore", tb);
     return *this;
 }
@@ -49,7 +49,7 @@ namespace sol
                 case sol::type::lightuserdata:
                 {
                     moon::buffer* p = static_cast<moon::buffer*>(lua_touserdata(L, index));
-                    return moon::buffer_ptr_t(p);
+                    return moon::message::wrap_buffer(p);
                 }
                 default:
                     break;
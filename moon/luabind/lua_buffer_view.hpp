@@ -0,0 +1,378 @@
+#pragma once
+#include <cstring>
+#include <new>
+#include <string_view>
+#include "lua.hpp"
+#include "config.hpp"
+#include "common/buffer.hpp"
+
+namespace moon
+{
+    /*
+        Read only userdata over message payload memory, nothing is copied until sub/unpack returns strings.
+        The view holds a reference to the buffer, so it stays valid after the message is dispatched;
+        the buffer must not be written (moon.buffer.write_front/write_back) while views of it exist.
+        Positions are 1-based and may be negative, as string library.
+    */
+    class lua_buffer_view
+    {
+    public:
+        static constexpr const char* METANAME = "moon.buffer_view";
+
+        struct view
+        {
+            buffer_ptr_t holder;
+            const char* data;
+            size_t size;
+        };
+
+        static int push(lua_State* L, const buffer_ptr_t& buf)
+        {
+            if (!buf)
+            {
+                return push(L, buf, nullptr, 0);
+            }
+            return push(L, buf, buf->data(), buf->size());
+        }
+
+        static int push(lua_State* L, const buffer_ptr_t& holder, const char* data, size_t size)
+        {
+            auto v = static_cast<view*>(lua_newuserdata(L, sizeof(view)));
+            new (v) view{ holder, data, size };
+            if (luaL_newmetatable(L, METANAME))
+            {
+                luaL_Reg l[] = {
+                    {"size",lsize},
+                    {"byte",byte},
+                    {"sub",sub},
+                    {"slice",slice},
+                    {"find",find},
+                    {"int",read_int},
+                    {"uint",read_uint},
+                    {"float",read_float},
+                    {"double",read_double},
+                    {"unpack",unpack},
+                    {"__len",lsize},
+                    {"__gc",release},
+                    {"__tostring",tostring},
+                    {NULL,NULL}
+                };
+                luaL_setfuncs(L, l, 0);
+                lua_pushvalue(L, -1);
+                lua_setfield(L, -2, "__index");
+            }
+            lua_setmetatable(L, -2);
+            return 1;
+        }
+
+        //nullptr when the value at index is not a view
+        static view* test(lua_State* L, int index)
+        {
+            return static_cast<view*>(luaL_testudata(L, index, METANAME));
+        }
+
+    private:
+        static view* check(lua_State* L, int index = 1)
+        {
+            return static_cast<view*>(luaL_checkudata(L, index, METANAME));
+        }
+
+        //[i, j] as string.sub, returns begin offset and length
+        static size_t range(lua_Integer i, lua_Integer j, size_t size, size_t& len)
+        {
+            lua_Integer l = static_cast<lua_Integer>(size);
+            if (i < 0)
+            {
+                i = (-i > l) ? 1 : l + i + 1;
+            }
+            else if (i == 0)
+            {
+                i = 1;
+            }
+            if (j < 0)
+            {
+                j = (-j > l) ? 0 : l + j + 1;
+            }
+            else if (j > l)
+            {
+                j = l;
+            }
+            len = (i > j) ? 0 : static_cast<size_t>(j - i + 1);
+            return static_cast<size_t>(i - 1);
+        }
+
+        //0-based offset of position at index with n bytes after it, raises error when out of the view
+        static size_t offset(lua_State* L, const view* v, int index, size_t n)
+        {
+            lua_Integer pos = luaL_optinteger(L, index, 1);
+            lua_Integer l = static_cast<lua_Integer>(v->size);
+            if (pos < 0 && -pos <= l)
+            {
+                pos = l + pos + 1;
+            }
+            luaL_argcheck(L, pos > 0 && pos - 1 <= l && n <= v->size - static_cast<size_t>(pos - 1), index, "out of buffer view");
+            return static_cast<size_t>(pos - 1);
+        }
+
+        static uint64_t load(const char* p, size_t n, bool big)
+        {
+            uint64_t r = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                uint8_t c = static_cast<uint8_t>(p[big ? i : n - 1 - i]);
+                r = (r << 8) | c;
+            }
+            return r;
+        }
+
+        static lua_Integer sign_extend(uint64_t v, size_t n)
+        {
+            if (n < sizeof(uint64_t))
+            {
+                uint64_t m = uint64_t{ 1 } << (n * 8 - 1);
+                v = (v ^ m) - m;
+            }
+            return static_cast<lua_Integer>(v);
+        }
+
+        static int release(lua_State* L)
+        {
+            check(L)->~view();
+            return 0;
+        }
+
+        static int lsize(lua_State* L)
+        {
+            lua_pushinteger(L, static_cast<lua_Integer>(check(L)->size));
+            return 1;
+        }
+
+        static int tostring(lua_State* L)
+        {
+            lua_pushfstring(L, "buffer_view: %d bytes", static_cast<int>(check(L)->size));
+            return 1;
+        }
+
+        //view:byte([i [, j]]), as string.byte
+        static int byte(lua_State* L)
+        {
+            view* v = check(L);
+            lua_Integer i = luaL_optinteger(L, 2, 1);
+            size_t len = 0;
+            size_t b = range(i, luaL_optinteger(L, 3, i), v->size, len);
+            if (len == 0)
+            {
+                return 0;
+            }
+            luaL_checkstack(L, static_cast<int>(len), "buffer view byte, too many results");
+            for (size_t k = 0; k < len; ++k)
+            {
+                lua_pushinteger(L, static_cast<uint8_t>(v->data[b + k]));
+            }
+            return static_cast<int>(len);
+        }
+
+        //view:sub([i [, j]]), copies [i, j] to a string
+        static int sub(lua_State* L)
+        {
+            view* v = check(L);
+            size_t len = 0;
+            size_t b = range(luaL_optinteger(L, 2, 1), luaL_optinteger(L, 3, -1), v->size, len);
+            lua_pushlstring(L, len ? v->data + b : "", len);
+            return 1;
+        }
+
+        //view:slice([i [, j]]), view of [i, j] sharing the buffer
+        static int slice(lua_State* L)
+        {
+            view* v = check(L);
+            size_t len = 0;
+            size_t b = range(luaL_optinteger(L, 2, 1), luaL_optinteger(L, 3, -1), v->size, len);
+            return push(L, v->holder, len ? v->data + b : nullptr, len);
+        }
+
+        //view:find(str [, init]), plain search, returns start and end positions or nil
+        static int find(lua_State* L)
+        {
+            view* v = check(L);
+            size_t n = 0;
+            const char* s = luaL_checklstring(L, 2, &n);
+            size_t len = 0;
+            size_t init = range(luaL_optinteger(L, 3, 1), -1, v->size, len);
+            if (init > v->size || n > v->size - init)
+            {
+                lua_pushnil(L);
+                return 1;
+            }
+            std::string_view hay(v->data ? v->data + init : "", v->size - init);
+            size_t pos = hay.find(std::string_view(s, n));
+            if (pos == std::string_view::npos)
+            {
+                lua_pushnil(L);
+                return 1;
+            }
+            lua_pushinteger(L, static_cast<lua_Integer>(init + pos + 1));
+            lua_pushinteger(L, static_cast<lua_Integer>(init + pos + n));
+            return 2;
+        }
+
+        //view:int(pos, n [, bigendian]), n bytes signed integer, n in 1..8
+        static int read_int(lua_State* L)
+        {
+            view* v = check(L);
+            size_t n = static_cast<size_t>(luaL_checkinteger(L, 3));
+            luaL_argcheck(L, n >= 1 && n <= 8, 3, "integer size out of limits [1,8]");
+            size_t off = offset(L, v, 2, n);
+            lua_pushinteger(L, sign_extend(load(v->data + off, n, lua_toboolean(L, 4)), n));
+            return 1;
+        }
+
+        //view:uint(pos, n [, bigendian]), n bytes unsigned integer, n in 1..8
+        static int read_uint(lua_State* L)
+        {
+            view* v = check(L);
+            size_t n = static_cast<size_t>(luaL_checkinteger(L, 3));
+            luaL_argcheck(L, n >= 1 && n <= 8, 3, "integer size out of limits [1,8]");
+            size_t off = offset(L, v, 2, n);
+            lua_pushinteger(L, static_cast<lua_Integer>(load(v->data + off, n, lua_toboolean(L, 4))));
+            return 1;
+        }
+
+        template<typename Float, typename Bits>
+        static Float load_float(const char* p, bool big)
+        {
+            Bits bits = static_cast<Bits>(load(p, sizeof(Bits), big));
+            Float f;
+            memcpy(&f, &bits, sizeof(f));
+            return f;
+        }
+
+        //view:float(pos [, bigendian])
+        static int read_float(lua_State* L)
+        {
+            view* v = check(L);
+            size_t off = offset(L, v, 2, sizeof(float));
+            lua_pushnumber(L, load_float<float, uint32_t>(v->data + off, lua_toboolean(L, 3)));
+            return 1;
+        }
+
+        //view:double(pos [, bigendian])
+        static int read_double(lua_State* L)
+        {
+            view* v = check(L);
+            size_t off = offset(L, v, 2, sizeof(double));
+            lua_pushnumber(L, load_float<double, uint64_t>(v->data + off, lua_toboolean(L, 3)));
+            return 1;
+        }
+
+        static size_t optsize(const char*& fmt, size_t df)
+        {
+            if (*fmt < '0' || *fmt > '9')
+            {
+                return df;
+            }
+            size_t n = 0;
+            while (*fmt >= '0' && *fmt <= '9' && n < 100)
+            {
+                n = n * 10 + static_cast<size_t>(*fmt++ - '0');
+            }
+            return n;
+        }
+
+        /*
+            view:unpack(fmt [, pos]), as string.unpack without alignment('!'),
+            supports < > = b B h H i[n] I[n] l L j J T f d n s[n] z x, integers up to 8 bytes.
+            Returns the values and the position after the last read byte.
+        */
+        static int unpack(lua_State* L)
+        {
+            view* v = check(L);
+            const char* fmt = luaL_checkstring(L, 2);
+            size_t off = offset(L, v, 3, 0);
+            bool big = false;
+            int n = 0;
+            while (*fmt != '\0')
+            {
+                char opt = *fmt++;
+                size_t size = 0;
+                bool is_signed = false;
+                switch (opt)
+                {
+                case ' ':
+                case '=':
+                case '<': big = false; continue;
+                case '>': big = true; continue;
+                case 'b': is_signed = true; size = 1; break;
+                case 'B': size = 1; break;
+                case 'h': is_signed = true; size = 2; break;
+                case 'H': size = 2; break;
+                case 'i': is_signed = true; size = optsize(fmt, 4); break;
+                case 'I': size = optsize(fmt, 4); break;
+                case 'l':
+                case 'j': is_signed = true; size = 8; break;
+                case 'L':
+                case 'J':
+                case 'T': size = 8; break;
+                case 'f': size = sizeof(float); break;
+                case 'd':
+                case 'n': size = sizeof(double); break;
+                case 's': size = optsize(fmt, sizeof(size_t)); break;
+                case 'z': size = 0; break;
+                case 'x': size = 1; break;
+                default:
+                    return luaL_error(L, "invalid format option '%c'", opt);
+                }
+                if (opt != 'z' && (size < 1 || size > 8))
+                {
+                    return luaL_error(L, "integral size (%d) out of limits [1,8]", static_cast<int>(size));
+                }
+                if (size > v->size - off)
+                {
+                    return luaL_argerror(L, 2, "data string too short");
+                }
+                luaL_checkstack(L, 2, "too many results");
+                const char* p = v->data + off;
+                switch (opt)
+                {
+                case 'f':
+                    lua_pushnumber(L, load_float<float, uint32_t>(p, big));
+                    break;
+                case 'd':
+                case 'n':
+                    lua_pushnumber(L, load_float<double, uint64_t>(p, big));
+                    break;
+                case 's':
+                {
+                    uint64_t len = load(p, size, big);
+                    luaL_argcheck(L, len <= v->size - off - size, 2, "data string too short");
+                    lua_pushlstring(L, p + size, static_cast<size_t>(len));
+                    size += static_cast<size_t>(len);
+                    break;
+                }
+                case 'z':
+                {
+                    const void* e = (off < v->size) ? memchr(p, 0, v->size - off) : nullptr;
+                    luaL_argcheck(L, e != nullptr, 2, "unfinished string for format 'z'");
+                    size_t len = static_cast<const char*>(e) - p;
+                    lua_pushlstring(L, p, len);
+                    size = len + 1;
+                    break;
+                }
+                case 'x':
+                    --n;
+                    break;
+                default:
+                {
+                    uint64_t r = load(p, size, big);
+                    lua_pushinteger(L, is_signed ? sign_extend(r, size) : static_cast<lua_Integer>(r));
+                    break;
+                }
+                }
+                off += size;
+                ++n;
+            }
+            lua_pushinteger(L, static_cast<lua_Integer>(off + 1));
+            return n + 1;
+        }
+    };
+}
@@ -1,8 +1,12 @@
 #pragma once
+#include <algorithm>
+#include <limits>
+#include <memory>
 #include "lua.hpp"
 #include "config.hpp"
 #include "common/buffer.hpp"
 #include "common/buffer_view.hpp"
+#include "lua_buffer_view.hpp"
 
 #define TYPE_NIL 0
 #define TYPE_BOOLEAN 1
@@ -21,12 +25,26 @@
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
 #define TYPE_TABLE 6
+#define TYPE_TYPED_ARRAY 7
+// hibits element type, followed by array size(number) and elements without type tags
+#define TYPED_ARRAY_BYTE 1
+// integers 0~255, 1 byte each
+#define TYPED_ARRAY_WORD 2
+// integers 0~65535
+#define TYPED_ARRAY_DWORD 3
+#define TYPED_ARRAY_QWORD 4
+#define TYPED_ARRAY_REAL 5
+#define TYPED_ARRAY_SHORT_STRING 6
+// strings shorter than 256, 1 byte length each
+#define TYPED_ARRAY_STRING 7
+// 4 bytes length each
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
 #define BLOCK_SIZE 128
 #define MAX_DEPTH 32
+#define MIN_TYPED_ARRAY 8
 
 namespace moon
 {
@@ -34,7 +52,41 @@ namespace moon
     {
     public:
         static constexpr int32_t HEAP_BUFFER = 1;
-        
+        //larger scratch buffers are not kept
+        static constexpr size_t MAX_SCRATCH = 1024 * 1024;
+
+        //per thread encode buffer, so the result is allocated once with the exact size.
+        //Taken out while in use: __pairs or __gc called while packing may pack again,
+        //and pack_one deletes it on error.
+        static std::unique_ptr<buffer>& scratch()
+        {
+            static thread_local std::unique_ptr<buffer> b;
+            return b;
+        }
+
+        static buffer* take_scratch()
+        {
+            buffer* b = scratch().release();
+            if (nullptr == b) {
+                b = new buffer(BLOCK_SIZE * 8);
+            }
+            b->clear();
+            b->set_flag(HEAP_BUFFER);
+            return b;
+        }
+
+        static void give_scratch(buffer* b)
+        {
+            b->clear_flag(HEAP_BUFFER);
+            if (b->max_size() > MAX_SCRATCH) {
+                delete b;
+                return;
+            }
+            scratch().reset(b);
+        }
+
+        //typed: write arrays of one element type as TYPE_TYPED_ARRAY, only for peers that can unpack them
+        template<bool Typed>
         static int pack(lua_State* L)
         {
             int n = lua_gettop(L);
@@ -42,17 +94,18 @@ namespace moon
             {
                 return 0;
             }
-            auto buf = new buffer(64, BUFFER_HEAD_RESERVED);
-            buf->set_flag(HEAP_BUFFER);
-
+            buffer* tmp = take_scratch();
             for (int i = 1; i <= n; i++) {
-                pack_one(L, buf, i, 0);
+                pack_one(L, tmp, i, 0, Typed);
             }
-            buf->clear_flag(HEAP_BUFFER);
+            auto buf = new buffer(tmp->size(), BUFFER_HEAD_RESERVED);
+            buf->write_back(tmp->data(), 0, tmp->size());
+            give_scratch(tmp);
             lua_pushlightuserdata(L, buf);
             return 1;
         }
 
+        template<bool Typed>
         static int packstring(lua_State* L)
         {
             int n = lua_gettop(L);
@@ -61,11 +114,12 @@ namespace moon
                 return 0;
             }
 
-            buffer buf;
+            buffer* tmp = take_scratch();
             for (int i = 1; i <= n; i++) {
-                pack_one(L, &buf, i, 0);
+                pack_one(L, tmp, i, 0, Typed);
             }
-            lua_pushlstring(L, buf.data(), buf.size());
+            lua_pushlstring(L, tmp->data(), tmp->size());
+            give_scratch(tmp);
             return 1;
         }
 
@@ -79,6 +133,15 @@ namespace moon
             if (lua_type(L, 1) == LUA_TSTRING) {
                 data = lua_tolstring(L, 1, &len);
             }
+            else if (auto v = lua_buffer_view::test(L, 1); nullptr != v) {
+                data = v->data;
+                len = v->size;
+            }
+            else if (lua_type(L, 2) == LUA_TNUMBER) {
+                //pointer and size, e.g. msg:data()
+                data = static_cast<const char*>(lua_touserdata(L, 1));
+                len = static_cast<size_t>(lua_tointeger(L, 2));
+            }
             else
             {
                 buffer* buf = (buffer*)lua_touserdata(L, 1);
@@ -155,8 +218,10 @@ namespace moon
         static int open(lua_State *L)
         {
             luaL_Reg l[] = {
-                {"pack",pack},
-                {"packs",packstring },
+                {"pack",pack<false>},
+                {"packs",packstring<false>},
+                {"pack_typed",pack<true>},
+                {"packs_typed",packstring<true>},
                 {"unpack",unpack},
                 {"concat",concat },
                 {"concats",concatstring },
@@ -168,6 +233,131 @@ namespace moon
         }
 
     public:
+        /*
+            Element type when the table is exactly the array 1..array_size of one kind, 0 otherwise.
+            One lua_next pass checks both keys and values.
+        */
+        static int typed_array_kind(lua_State *L, int index, int array_size) {
+            if (array_size < MIN_TYPED_ARRAY) {
+                return 0;
+            }
+
+            int type = LUA_TNONE;
+            bool integer = false;
+            lua_Integer min = 0;
+            lua_Integer max = 0;
+            size_t strlen_max = 0;
+            int count = 0;
+            lua_pushnil(L);
+            while (lua_next(L, index) != 0) {
+                bool ok = lua_isinteger(L, -2);
+                if (ok) {
+                    lua_Integer k = lua_tointeger(L, -2);
+                    ok = (k > 0 && k <= array_size);
+                }
+                int vt = lua_type(L, -1);
+                if (ok && type == LUA_TNONE) {
+                    type = vt;
+                    integer = (vt == LUA_TNUMBER) && lua_isinteger(L, -1);
+                }
+                ok = ok && (vt == type) && (vt == LUA_TSTRING || (vt == LUA_TNUMBER && (lua_isinteger(L, -1) != 0) == integer));
+                if (!ok) {
+                    lua_pop(L, 2);
+                    return 0;
+                }
+                if (vt == LUA_TSTRING) {
+                    size_t sz = 0;
+                    lua_tolstring(L, -1, &sz);
+                    strlen_max = std::max(strlen_max, sz);
+                }
+                else if (integer) {
+                    lua_Integer v = lua_tointeger(L, -1);
+                    min = (count == 0) ? v : std::min(min, v);
+                    max = (count == 0) ? v : std::max(max, v);
+                }
+                ++count;
+                lua_pop(L, 1);
+            }
+
+            if (count != array_size) {
+                return 0;
+            }
+
+            if (type == LUA_TSTRING) {
+                if (strlen_max < 0x100) {
+                    return TYPED_ARRAY_SHORT_STRING;
+                }
+                if (strlen_max > std::numeric_limits<uint32_t>::max()) {
+                    return 0;
+                }
+                return TYPED_ARRAY_STRING;
+            }
+            if (!integer) {
+                return TYPED_ARRAY_REAL;
+            }
+            if (min >= 0 && max < 0x100) {
+                return TYPED_ARRAY_BYTE;
+            }
+            if (min >= 0 && max < 0x10000) {
+                return TYPED_ARRAY_WORD;
+            }
+            if (min == (int32_t)min && max == (int32_t)max) {
+                return TYPED_ARRAY_DWORD;
+            }
+            return TYPED_ARRAY_QWORD;
+        }
+
+        static void wb_typed_array(lua_State *L, buffer* buf, int index, int array_size, int kind) {
+            uint8_t n = (uint8_t)COMBINE_TYPE(TYPE_TYPED_ARRAY, kind);
+            buf->write_back(&n);
+            wb_integer(buf, array_size);
+            for (int i = 1; i <= array_size; i++) {
+                lua_rawgeti(L, index, i);
+                switch (kind) {
+                case TYPED_ARRAY_BYTE: {
+                    uint8_t v = (uint8_t)lua_tointeger(L, -1);
+                    buf->write_back(&v);
+                    break;
+                }
+                case TYPED_ARRAY_WORD: {
+                    uint16_t v = (uint16_t)lua_tointeger(L, -1);
+                    buf->write_back(&v);
+                    break;
+                }
+                case TYPED_ARRAY_DWORD: {
+                    int32_t v = (int32_t)lua_tointeger(L, -1);
+                    buf->write_back(&v);
+                    break;
+                }
+                case TYPED_ARRAY_QWORD: {
+                    int64_t v = (int64_t)lua_tointeger(L, -1);
+                    buf->write_back(&v);
+                    break;
+                }
+                case TYPED_ARRAY_REAL: {
+                    double v = (double)lua_tonumber(L, -1);
+                    buf->write_back(&v);
+                    break;
+                }
+                default: {
+                    size_t sz = 0;
+                    const char* str = lua_tolstring(L, -1, &sz);
+                    if (kind == TYPED_ARRAY_SHORT_STRING) {
+                        uint8_t len = (uint8_t)sz;
+                        buf->write_back(&len);
+                    }
+                    else {
+                        uint32_t len = (uint32_t)sz;
+                        buf->write_back(&len);
+                    }
+                    buf->write_back(str, 0, sz);
+                    break;
+                }
+                }
+                lua_pop(L, 1);
+            }
+        }
+
         static void wb_nil(buffer* buf)
         {
             uint8_t n = TYPE_NIL;
@@ -256,7 +446,7 @@ namespace moon
             }
         }
 
-        static void pack_one(lua_State *L, buffer* b, int index, int depth) {
+        static void pack_one(lua_State *L, buffer* b, int index, int depth, bool typed) {
             if (depth > MAX_DEPTH) {
                 if(b->has_flag(HEAP_BUFFER)) delete b;
                 luaL_error(L, "serialize can't pack too depth table");
@@ -294,7 +484,7 @@ namespace moon
                 if (index < 0) {
                     index = lua_gettop(L) + index + 1;
                 }
-                wb_table(L, b, index, depth + 1);
+                wb_table(L, b, index, depth + 1, typed);
                 break;
             }
             default:
@@ -303,7 +493,7 @@ namespace moon
             }
         }
 
-        static int wb_table_array(lua_State *L, buffer* buf, int index, int depth) {
+        static int wb_table_array(lua_State *L, buffer* buf, int index, int depth, bool typed) {
             int array_size = (int)lua_rawlen(L, index);
             if (array_size >= MAX_COOKIE - 1) {
                 uint8_t n = (uint8_t)COMBINE_TYPE(TYPE_TABLE, MAX_COOKIE - 1);
@@ -318,14 +508,14 @@ namespace moon
             int i;
             for (i = 1; i <= array_size; i++) {
                 lua_rawgeti(L, index, i);
-                pack_one(L, buf, -1, depth);
+                pack_one(L, buf, -1, depth, typed);
                 lua_pop(L, 1);
             }
 
             return array_size;
         }
 
-        static void wb_table_hash(lua_State *L, buffer* buf, int index, int depth, int array_size) {
+        static void wb_table_hash(lua_State *L, buffer* buf, int index, int depth, int array_size, bool typed) {
             lua_pushnil(L);
             while (lua_next(L, index) != 0) {
                 if (lua_type(L, -2) == LUA_TNUMBER) {
@@ -337,14 +527,14 @@ namespace moon
                         }
                     }
                 }
-                pack_one(L, buf, -2, depth);
-                pack_one(L, buf, -1, depth);
+                pack_one(L, buf, -2, depth, typed);
+                pack_one(L, buf, -1, depth, typed);
                 lua_pop(L, 1);
             }
             wb_nil(buf);
         }
 
-        static void wb_table_metapairs(lua_State *L, buffer* buf, int index, int depth) {
+        static void wb_table_metapairs(lua_State *L, buffer* buf, int index, int depth, bool typed) {
             uint8_t n = COMBINE_TYPE(TYPE_TABLE, 0);
             buf->write_back(&n, 0, 1);
             lua_pushvalue(L, index);
@@ -359,26 +549,35 @@ namespace moon
                     lua_pop(L, 4);
                     break;
                 }
-                pack_one(L, buf, -2, depth);
-                pack_one(L, buf, -1, depth);
+                pack_one(L, buf, -2, depth, typed);
+                pack_one(L, buf, -1, depth, typed);
                 lua_pop(L, 1);
             }
             wb_nil(buf);
         }
 
-        static void wb_table(lua_State*L, buffer* buf, int index, int depth)
+        static void wb_table(lua_State*L, buffer* buf, int index, int depth, bool typed)
         {
             luaL_checkstack(L, LUA_MINSTACK, NULL);
             if (index < 0) {
                 index = lua_gettop(L) + index + 1;
             }
             if (luaL_getmetafield(L, index, "__pairs") != LUA_TNIL) {
-                wb_table_metapairs(L, buf, index, depth);
+                wb_table_metapairs(L, buf, index, depth, typed);
+                return;
             }
-            else {
-                int array_size = wb_table_array(L, buf, index, depth);
-                wb_table_hash(L, buf, index, depth, array_size);
+
+            if (typed) {
+                int array_size = (int)lua_rawlen(L, index);
+                int kind = typed_array_kind(L, index, array_size);
+                if (kind != 0) {
+                    wb_typed_array(L, buf, index, array_size, kind);
+                    return;
+                }
             }
+
+            int array_size = wb_table_array(L, buf, index, depth, typed);
+            wb_table_hash(L, buf, index, depth, array_size, typed);
         }
 
         static void invalid_stream_line(lua_State *L, buffer_view* buf, int line) {
@@ -451,16 +650,84 @@ namespace moon
             push_value(L, buf, type & 0x7, type >> 3);
         }
 
+        static int get_array_size(lua_State *L, buffer_view* buf) {
+            uint8_t type{};
+            if (!buf->read(&type))
+                invalid_stream(L, buf);
+            int cookie = type >> 3;
+            if ((type & 7) != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
+                invalid_stream(L, buf);
+            }
+            lua_Integer n = get_integer(L, buf, cookie);
+            if (n < 0 || n > std::numeric_limits<int>::max()) {
+                invalid_stream(L, buf);
+            }
+            return (int)n;
+        }
+
+        template<typename T>
+        static T get_element(lua_State *L, buffer_view* buf) {
+            T v{};
+            if (!buf->read(&v))
+                invalid_stream(L, buf);
+            return v;
+        }
+
+        static void unpack_typed_array(lua_State *L, buffer_view* buf, int kind) {
+            int array_size = get_array_size(L, buf);
+            size_t elem = 0;
+            switch (kind) {
+            case TYPED_ARRAY_BYTE: elem = 1; break;
+            case TYPED_ARRAY_WORD: elem = sizeof(uint16_t); break;
+            case TYPED_ARRAY_DWORD: elem = sizeof(int32_t); break;
+            case TYPED_ARRAY_QWORD: elem = sizeof(int64_t); break;
+            case TYPED_ARRAY_REAL: elem = sizeof(double); break;
+            case TYPED_ARRAY_SHORT_STRING: elem = 1; break;
+            case TYPED_ARRAY_STRING: elem = sizeof(uint32_t); break;
+            default: invalid_stream(L, buf); break;
+            }
+            //minimal bytes, also refuses huge size before allocating the table
+            if (buf->size() / elem < static_cast<size_t>(array_size)) {
+                invalid_stream(L, buf);
+            }
+            luaL_checkstack(L, LUA_MINSTACK, NULL);
+            lua_createtable(L, array_size, 0);
+            for (int i = 1; i <= array_size; i++) {
+                switch (kind) {
+                case TYPED_ARRAY_BYTE:
+                    lua_pushinteger(L, get_element<uint8_t>(L, buf));
+                    break;
+                case TYPED_ARRAY_WORD:
+                    lua_pushinteger(L, get_element<uint16_t>(L, buf));
+                    break;
+                case TYPED_ARRAY_DWORD:
+                    lua_pushinteger(L, get_element<int32_t>(L, buf));
+                    break;
+                case TYPED_ARRAY_QWORD:
+                    lua_pushinteger(L, get_element<int64_t>(L, buf));
+                    break;
+                case TYPED_ARRAY_REAL:
+                    lua_pushnumber(L, get_element<double>(L, buf));
+                    break;
+                case TYPED_ARRAY_SHORT_STRING:
+                    get_buffer(L, buf, get_element<uint8_t>(L, buf));
+                    break;
+                default: {
+                    uint32_t len = get_element<uint32_t>(L, buf);
+                    if (len > buf->size()) {
+                        invalid_stream(L, buf);
+                    }
+                    get_buffer(L, buf, (int)len);
+                    break;
+                }
+                }
+                lua_rawseti(L, -2, i);
+            }
+        }
+
         static void unpack_table(lua_State *L, buffer_view* buf, int array_size) {
             if (array_size == MAX_COOKIE - 1) {
-                uint8_t type{};
-                if (!buf->read(&type))
-                    invalid_stream(L, buf);
-                int cookie = type >> 3;
-                if ((type & 7) != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
-                    invalid_stream(L, buf);
-                }
-                array_size = (int)get_integer(L, buf, cookie);
+                array_size = get_array_size(L, buf);
             }
             luaL_checkstack(L, LUA_MINSTACK, NULL);
             lua_createtable(L, array_size, 0);
@@ -525,6 +792,10 @@ namespace moon
                 unpack_table(L, buf, cookie);
                 break;
             }
+            case TYPE_TYPED_ARRAY: {
+                unpack_typed_array(L, buf, cookie);
+                break;
+            }
             default: {
                 invalid_stream(L, buf);
                 break;
@@ -0,0 +1,769 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include <new>
+#include "lua.hpp"
+#include "config.hpp"
+#include "common/rwlock.hpp"
+#include "common/file.hpp"
+#include "rapidjson/document.h"
+#include "rapidjson/error/en.h"
+
+namespace moon
+{
+    /*
+        Process wide read only tables, built once (from json or a lua table) and shared by every lua service.
+        Lua side gets a proxy userdata: reads go to the immutable C++ tree, nothing is copied per VM.
+        A name can be loaded again, proxies already queried keep their old snapshot.
+    */
+    class lua_shared_table
+    {
+    public:
+        static constexpr const char* METANAME = "moon.sharetable";
+        static constexpr int MAX_NESTING = 32;
+
+        struct table;
+
+        using value = std::variant<std::monostate, bool, lua_Integer, lua_Number, std::string, std::unique_ptr<table>>;
+
+        struct table
+        {
+            //keys 1..n
+            std::vector<value> array;
+            //other keys, sorted
+            std::vector<std::pair<lua_Integer, value>> ikeys;
+            std::vector<std::pair<std::string, value>> skeys;
+
+            const value* find(lua_Integer k) const
+            {
+                if (k >= 1 && static_cast<size_t>(k) <= array.size())
+                {
+                    return &array[static_cast<size_t>(k - 1)];
+                }
+                auto it = std::lower_bound(ikeys.begin(), ikeys.end(), k, [](const auto& a, lua_Integer b) { return a.first < b; });
+                return (it != ikeys.end() && it->first == k) ? &it->second : nullptr;
+            }
+
+            const value* find(std::string_view k) const
+            {
+                auto it = std::lower_bound(skeys.begin(), skeys.end(), k, [](const auto& a, std::string_view b) { return a.first < b; });
+                return (it != skeys.end() && it->first == k) ? &it->second : nullptr;
+            }
+
+            //pairs order: array, ikeys, skeys
+            size_t count() const
+            {
+                return array.size() + ikeys.size() + skeys.size();
+            }
+        };
+
+        struct root
+        {
+            table data;
+            size_t memory = 0;
+        };
+
+        using root_ptr = std::shared_ptr<const root>;
+
+        static int open(lua_State* L)
+        {
+            luaL_Reg l[] = {
+                {"loadfile",loadfile},
+                {"loadstring",loadstring},
+                {"loadtable",loadtable},
+                {"query",query},
+                {"remove",remove},
+                {"copy",copy},
+                {"stats",stats},
+                {NULL,NULL},
+            };
+
+            luaL_newlib(L, l);
+            return 1;
+        }
+
+    private:
+        struct proxy
+        {
+            root_ptr holder;
+            const table* t;
+        };
+
+        struct registry
+        {
+            rwlock lock;
+            std::unordered_map<std::string, root_ptr> tables;
+        };
+
+        static registry& instance()
+        {
+            static registry r;
+            return r;
+        }
+
+        static void set(const std::string& name, root_ptr r)
+        {
+            auto& reg = instance();
+            std::unique_lock lck(reg.lock);
+            reg.tables[name] = std::move(r);
+        }
+
+        static root_ptr get(const std::string& name)
+        {
+            auto& reg = instance();
+            std::shared_lock lck(reg.lock);
+            auto it = reg.tables.find(name);
+            return (it != reg.tables.end()) ? it->second : nullptr;
+        }
+
+        static size_t memory_of(const std::string& s)
+        {
+            //heap part only, short strings live in std::string itself
+            return (s.capacity() > 15) ? s.capacity() + 1 : 0;
+        }
+
+        static size_t memory_of(const value& v)
+        {
+            if (auto s = std::get_if<std::string>(&v); s != nullptr)
+            {
+                return memory_of(*s);
+            }
+            if (auto t = std::get_if<std::unique_ptr<table>>(&v); t != nullptr)
+            {
+                return memory_of(**t);
+            }
+            return 0;
+        }
+
+        static size_t memory_of(const table& t)
+        {
+            size_t n = sizeof(table);
+            n += t.array.capacity() * sizeof(value);
+            n += t.ikeys.capacity() * sizeof(t.ikeys[0]);
+            n += t.skeys.capacity() * sizeof(t.skeys[0]);
+            for (auto& v : t.array)
+            {
+                n += memory_of(v);
+            }
+            for (auto& v : t.ikeys)
+            {
+                n += memory_of(v.second);
+            }
+            for (auto& v : t.skeys)
+            {
+                n += memory_of(v.first) + memory_of(v.second);
+            }
+            return n;
+        }
+
+        template<typename Pairs>
+        static bool sort_keys(Pairs& keys)
+        {
+            std::sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            return std::adjacent_find(keys.begin(), keys.end(), [](const auto& a, const auto& b) { return a.first == b.first; }) == keys.end();
+        }
+
+        static bool from_json(const rapidjson::Value& jv, value& v, int depth, std::string& err)
+        {
+            switch (jv.GetType())
+            {
+            case rapidjson::kNullType:
+                break;
+            case rapidjson::kFalseType:
+            case rapidjson::kTrueType:
+                v = jv.GetBool();
+                break;
+            case rapidjson::kNumberType:
+                if (jv.IsInt64())
+                {
+                    v = static_cast<lua_Integer>(jv.GetInt64());
+                }
+                else
+                {
+                    v = static_cast<lua_Number>(jv.GetDouble());
+                }
+                break;
+            case rapidjson::kStringType:
+                v = std::string(jv.GetString(), jv.GetStringLength());
+                break;
+            case rapidjson::kObjectType:
+            case rapidjson::kArrayType:
+            {
+                auto t = std::make_unique<table>();
+                if (!from_json(jv, *t, depth + 1, err))
+                {
+                    return false;
+                }
+                v = std::move(t);
+                break;
+            }
+            }
+            return true;
+        }
+
+        static bool from_json(const rapidjson::Value& jv, table& t, int depth, std::string& err)
+        {
+            if (depth > MAX_NESTING)
+            {
+                err = "sharetable: json nested too deep";
+                return false;
+            }
+            if (jv.IsArray())
+            {
+                t.array.resize(jv.Size());
+                for (rapidjson::SizeType i = 0; i < jv.Size(); ++i)
+                {
+                    if (!from_json(jv[i], t.array[i], depth, err))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            t.skeys.reserve(jv.MemberCount());
+            for (auto it = jv.MemberBegin(); it != jv.MemberEnd(); ++it)
+            {
+                if (it->value.IsNull())
+                {
+                    continue;
+                }
+                auto& kv = t.skeys.emplace_back(std::piecewise_construct, std::forward_as_tuple(it->name.GetString(), it->name.GetStringLength()), std::forward_as_tuple());
+                if (!from_json(it->value, kv.second, depth, err))
+                {
+                    return false;
+                }
+            }
+            if (!sort_keys(t.skeys))
+            {
+                err = "sharetable: json object has duplicate key";
+                return false;
+            }
+            return true;
+        }
+
+        static root_ptr from_json(std::string_view data, std::string& err)
+        {
+            rapidjson::Document doc;
+            doc.Parse(data.data(), data.size());
+            if (doc.HasParseError())
+            {
+                err = "sharetable: json ";
+                err.append(rapidjson::GetParseError_En(doc.GetParseError()));
+                err.append(" at offset ");
+                err.append(std::to_string(doc.GetErrorOffset()));
+                return nullptr;
+            }
+            if (!doc.IsObject() && !doc.IsArray())
+            {
+                err = "sharetable: json root must be object or array";
+                return nullptr;
+            }
+            auto r = std::make_shared<root>();
+            if (!from_json(doc, r->data, 1, err))
+            {
+                return nullptr;
+            }
+            r->memory = memory_of(r->data);
+            return r;
+        }
+
+        //only raw api that does not raise errors, C++ objects here must be destroyed normally
+        static bool from_lua(lua_State* L, int index, table& t, int depth, std::string& err)
+        {
+            if (depth > MAX_NESTING)
+            {
+                err = "sharetable: table nested too deep (or has cycle)";
+                return false;
+            }
+            if (!lua_checkstack(L, 4))
+            {
+                err = "sharetable: stack overflow";
+                return false;
+            }
+            index = lua_absindex(L, index);
+            t.array.resize(lua_rawlen(L, index));
+            lua_pushnil(L);
+            while (lua_next(L, index) != 0)
+            {
+                value* v = nullptr;
+                int kt = lua_type(L, -2);
+                if (kt == LUA_TNUMBER)
+                {
+                    int isnum = 0;
+                    lua_Integer k = lua_tointegerx(L, -2, &isnum);
+                    if (!isnum)
+                    {
+                        err = "sharetable: float key is not supported";
+                        lua_pop(L, 2);
+                        return false;
+                    }
+                    if (k >= 1 && static_cast<size_t>(k) <= t.array.size())
+                    {
+                        v = &t.array[static_cast<size_t>(k - 1)];
+                    }
+                    else
+                    {
+                        v = &t.ikeys.emplace_back(std::piecewise_construct, std::forward_as_tuple(k), std::forward_as_tuple()).second;
+                    }
+                }
+                else if (kt == LUA_TSTRING)
+                {
+                    size_t len = 0;
+                    const char* s = lua_tolstring(L, -2, &len);
+                    v = &t.skeys.emplace_back(std::piecewise_construct, std::forward_as_tuple(s, len), std::forward_as_tuple()).second;
+                }
+                else
+                {
+                    err = "sharetable: key must be integer or string, got ";
+                    err.append(lua_typename(L, kt));
+                    lua_pop(L, 2);
+                    return false;
+                }
+
+                bool ok = true;
+                switch (lua_type(L, -1))
+                {
+                case LUA_TBOOLEAN:
+                    *v = static_cast<bool>(lua_toboolean(L, -1));
+                    break;
+                case LUA_TNUMBER:
+                    if (lua_isinteger(L, -1))
+                    {
+                        *v = lua_tointeger(L, -1);
+                    }
+                    else
+                    {
+                        *v = lua_tonumber(L, -1);
+                    }
+                    break;
+                case LUA_TSTRING:
+                {
+                    size_t len = 0;
+                    const char* s = lua_tolstring(L, -1, &len);
+                    *v = std::string(s, len);
+                    break;
+                }
+                case LUA_TTABLE:
+                {
+                    auto child = std::make_unique<table>();
+                    ok = from_lua(L, -1, *child, depth + 1, err);
+                    *v = std::move(child);
+                    break;
+                }
+                default:
+                    err = "sharetable: unsupported value type ";
+                    err.append(luaL_typename(L, -1));
+                    ok = false;
+                    break;
+                }
+                lua_pop(L, 1);
+                if (!ok)
+                {
+                    lua_pop(L, 1);
+                    return false;
+                }
+            }
+            sort_keys(t.ikeys);
+            sort_keys(t.skeys);
+            return true;
+        }
+
+        static int push_result(lua_State* L, root_ptr r, const std::string& name, std::string& err)
+        {
+            if (nullptr == r)
+            {
+                lua_pushboolean(L, 0);
+                lua_pushlstring(L, err.data(), err.size());
+                return 2;
+            }
+            set(name, std::move(r));
+            lua_pushboolean(L, 1);
+            return 1;
+        }
+
+        //sharetable.loadfile(name, path)
+        static int loadfile(lua_State* L)
+        {
+            size_t len = 0;
+            const char* name = luaL_checklstring(L, 1, &len);
+            const char* path = luaL_checkstring(L, 2);
+            int n = 0;
+            {
+                std::string err;
+                std::string content = moon::file::read_all(path, std::ios::binary | std::ios::in);
+                root_ptr r;
+                if (content.empty())
+                {
+                    err = "sharetable: can not read file ";
+                    err.append(path);
+                }
+                else
+                {
+                    r = from_json(content, err);
+                }
+                n = push_result(L, std::move(r), std::string{ name, len }, err);
+            }
+            return n;
+        }
+
+        //sharetable.loadstring(name, json)
+        static int loadstring(lua_State* L)
+        {
+            size_t len = 0;
+            const char* name = luaL_checklstring(L, 1, &len);
+            size_t size = 0;
+            const char* data = luaL_checklstring(L, 2, &size);
+            int n = 0;
+            {
+                std::string err;
+                root_ptr r = from_json(std::string_view{ data, size }, err);
+                n = push_result(L, std::move(r), std::string{ name, len }, err);
+            }
+            return n;
+        }
+
+        //sharetable.loadtable(name, t), t must only have integer/string keys and no functions/userdata
+        static int loadtable(lua_State* L)
+        {
+            size_t len = 0;
+            const char* name = luaL_checklstring(L, 1, &len);
+            luaL_checktype(L, 2, LUA_TTABLE);
+            int n = 0;
+            {
+                std::string err;
+                auto r = std::make_shared<root>();
+                if (from_lua(L, 2, r->data, 1, err))
+                {
+                    r->memory = memory_of(r->data);
+                }
+                else
+                {
+                    r.reset();
+                }
+                n = push_result(L, std::move(r), std::string{ name, len }, err);
+            }
+            return n;
+        }
+
+        //sharetable.query(name), proxy or nil
+        static int query(lua_State* L)
+        {
+            size_t len = 0;
+            const char* name = luaL_checklstring(L, 1, &len);
+            root_ptr r = get(std::string{ name, len });
+            if (nullptr == r)
+            {
+                return 0;
+            }
+            const table* t = &r->data;
+            return push_proxy(L, std::move(r), t);
+        }
+
+        static int remove(lua_State* L)
+        {
+            size_t len = 0;
+            const char* name = luaL_checklstring(L, 1, &len);
+            bool found = false;
+            {
+                auto& reg = instance();
+                std::unique_lock lck(reg.lock);
+                found = reg.tables.erase(std::string{ name, len }) > 0;
+            }
+            lua_pushboolean(L, found);
+            return 1;
+        }
+
+        static int stats(lua_State* L)
+        {
+            size_t count = 0;
+            size_t memory = 0;
+            {
+                auto& reg = instance();
+                std::shared_lock lck(reg.lock);
+                count = reg.tables.size();
+                for (auto& it : reg.tables)
+                {
+                    memory += it.second->memory;
+                }
+            }
+            lua_createtable(L, 0, 2);
+            lua_pushinteger(L, static_cast<lua_Integer>(count));
+            lua_setfield(L, -2, "count");
+            lua_pushinteger(L, static_cast<lua_Integer>(memory));
+            lua_setfield(L, -2, "memory");
+            return 1;
+        }
+
+        static int push_proxy(lua_State* L, root_ptr holder, const table* t)
+        {
+            auto p = static_cast<proxy*>(lua_newuserdata(L, sizeof(proxy)));
+            new (p) proxy{ std::move(holder), t };
+            if (luaL_newmetatable(L, METANAME))
+            {
+                luaL_Reg l[] = {
+                    {"__index",index},
+                    {"__newindex",newindex},
+                    {"__len",len},
+                    {"__pairs",pairs},
+                    {"__gc",release},
+                    {"__tostring",tostring},
+                    {NULL,NULL}
+                };
+                luaL_setfuncs(L, l, 0);
+            }
+            lua_setmetatable(L, -2);
+            return 1;
+        }
+
+        static proxy* check(lua_State* L, int index = 1)
+        {
+            return static_cast<proxy*>(luaL_checkudata(L, index, METANAME));
+        }
+
+        //child tables share the owner's proxy cache(uservalue), so t.a == t.a
+        static void push_value(lua_State* L, int owner, const value& v)
+        {
+            switch (v.index())
+            {
+            case 0:
+                lua_pushnil(L);
+                break;
+            case 1:
+                lua_pushboolean(L, std::get<bool>(v));
+                break;
+            case 2:
+                lua_pushinteger(L, std::get<lua_Integer>(v));
+                break;
+            case 3:
+                lua_pushnumber(L, std::get<lua_Number>(v));
+                break;
+            case 4:
+            {
+                auto& s = std::get<std::string>(v);
+                lua_pushlstring(L, s.data(), s.size());
+                break;
+            }
+            case 5:
+            {
+                const table* t = std::get<std::unique_ptr<table>>(v).get();
+                if (lua_getuservalue(L, owner) != LUA_TTABLE)
+                {
+                    lua_pop(L, 1);
+                    lua_createtable(L, 0, 4);
+                    lua_pushvalue(L, -1);
+                    lua_setuservalue(L, owner);
+                }
+                if (lua_rawgetp(L, -1, t) == LUA_TNIL)
+                {
+                    lua_pop(L, 1);
+                    push_proxy(L, check(L, owner)->holder, t);
+                    lua_pushvalue(L, -1);
+                    lua_rawsetp(L, -3, t);
+                }
+                lua_remove(L, -2);
+                break;
+            }
+            }
+        }
+
+        static const value* find(lua_State* L, const table* t, int index)
+        {
+            switch (lua_type(L, index))
+            {
+            case LUA_TNUMBER:
+            {
+                int isnum = 0;
+                lua_Integer k = lua_tointegerx(L, index, &isnum);
+                return isnum ? t->find(k) : nullptr;
+            }
+            case LUA_TSTRING:
+            {
+                size_t len = 0;
+                const char* s = lua_tolstring(L, index, &len);
+                return t->find(std::string_view{ s, len });
+            }
+            default:
+                return nullptr;
+            }
+        }
+
+        static int index(lua_State* L)
+        {
+            proxy* p = check(L);
+            const value* v = find(L, p->t, 2);
+            if (nullptr == v)
+            {
+                return 0;
+            }
+            push_value(L, 1, *v);
+            return 1;
+        }
+
+        static int newindex(lua_State* L)
+        {
+            return luaL_error(L, "sharetable is read only");
+        }
+
+        static int len(lua_State* L)
+        {
+            lua_pushinteger(L, static_cast<lua_Integer>(check(L)->t->array.size()));
+            return 1;
+        }
+
+        //position of key in pairs order, count() when not found
+        static size_t position(lua_State* L, const table* t, int index)
+        {
+            size_t asize = t->array.size();
+            switch (lua_type(L, index))
+            {
+            case LUA_TNUMBER:
+            {
+                int isnum = 0;
+                lua_Integer k = lua_tointegerx(L, index, &isnum);
+                if (!isnum)
+                {
+                    break;
+                }
+                if (k >= 1 && static_cast<size_t>(k) <= asize)
+                {
+                    return static_cast<size_t>(k - 1);
+                }
+                auto it = std::lower_bound(t->ikeys.begin(), t->ikeys.end(), k, [](const auto& a, lua_Integer b) { return a.first < b; });
+                if (it != t->ikeys.end() && it->first == k)
+                {
+                    return asize + (it - t->ikeys.begin());
+                }
+                break;
+            }
+            case LUA_TSTRING:
+            {
+                size_t len = 0;
+                const char* s = lua_tolstring(L, index, &len);
+                std::string_view k{ s, len };
+                auto it = std::lower_bound(t->skeys.begin(), t->skeys.end(), k, [](const auto& a, std::string_view b) { return a.first < b; });
+                if (it != t->skeys.end() && it->first == k)
+                {
+                    return asize + t->ikeys.size() + (it - t->skeys.begin());
+                }
+                break;
+            }
+            default:
+                break;
+            }
+            return t->count();
+        }
+
+        static int next(lua_State* L)
+        {
+            proxy* p = check(L);
+            const table* t = p->t;
+            size_t pos = 0;
+            if (!lua_isnoneornil(L, 2))
+            {
+                pos = position(L, t, 2);
+                luaL_argcheck(L, pos < t->count(), 2, "invalid key to 'next'");
+                ++pos;
+            }
+            size_t asize = t->array.size();
+            //skip holes(json null)
+            while (pos < asize && t->array[pos].index() == 0)
+            {
+                ++pos;
+            }
+            if (pos < asize)
+            {
+                lua_pushinteger(L, static_cast<lua_Integer>(pos + 1));
+                push_value(L, 1, t->array[pos]);
+                return 2;
+            }
+            pos -= asize;
+            if (pos < t->ikeys.size())
+            {
+                lua_pushinteger(L, t->ikeys[pos].first);
+                push_value(L, 1, t->ikeys[pos].second);
+                return 2;
+            }
+            pos -= t->ikeys.size();
+            if (pos < t->skeys.size())
+            {
+                auto& kv = t->skeys[pos];
+                lua_pushlstring(L, kv.first.data(), kv.first.size());
+                push_value(L, 1, kv.second);
+                return 2;
+            }
+            return 0;
+        }
+
+        static int pairs(lua_State* L)
+        {
+            check(L);
+            lua_pushcfunction(L, next);
+            lua_pushvalue(L, 1);
+            lua_pushnil(L);
+            return 3;
+        }
+
+        static int release(lua_State* L)
+        {
+            check(L)->~proxy();
+            return 0;
+        }
+
+        static int tostring(lua_State* L)
+        {
+            lua_pushfstring(L, "sharetable: %p", static_cast<const void*>(check(L)->t));
+            return 1;
+        }
+
+        static void push_copy(lua_State* L, const value& v)
+        {
+            if (auto t = std::get_if<std::unique_ptr<table>>(&v); t != nullptr)
+            {
+                push_copy(L, **t);
+                return;
+            }
+            push_value(L, 0, v);
+        }
+
+        static void push_copy(lua_State* L, const table& t)
+        {
+            luaL_checkstack(L, 4, "sharetable copy");
+            lua_createtable(L, static_cast<int>(t.array.size()), static_cast<int>(t.ikeys.size() + t.skeys.size()));
+            for (size_t i = 0; i < t.array.size(); ++i)
+            {
+                if (t.array[i].index() != 0)
+                {
+                    push_copy(L, t.array[i]);
+                    lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+                }
+            }
+            for (auto& kv : t.ikeys)
+            {
+                push_copy(L, kv.second);
+                lua_rawseti(L, -2, kv.first);
+            }
+            for (auto& kv : t.skeys)
+            {
+                lua_pushlstring(L, kv.first.data(), kv.first.size());
+                push_copy(L, kv.second);
+                lua_rawset(L, -3);
+            }
+        }
+
+        //sharetable.copy(proxy), deep copy to a plain lua table
+        static int copy(lua_State* L)
+        {
+            push_copy(L, *check(L)->t);
+            return 1;
+        }
+    };
+}
@@ -198,8 +198,14 @@ int main(int argc, char*argv[])
                 router_->set_env("OUTER_HOST", c->outer_host);
                 router_->set_env("CONFIG", scfg.config());
 
+                server_->set_event_tick(c->event_tick);
+                server_->set_timer_precision(c->timer_precision);
                 server_->init(static_cast<uint8_t>(c->thread), c->log);
                 server_->logger()->set_level(c->loglevel);
+                router_->set_steal(c->steal);
+                router_->set_budget(c->budget);
+                router_->set_gc_budget(c->gc_budget);
+                router_->set_mailbox_limit(c->mailbox);
 
                 if (!c->startup.empty())
                 {
@@ -24,6 +24,12 @@ namespace moon
     {
         int32_t sid = 0;
         int32_t thread = 0;
+        bool steal = false;
+        bool event_tick = false;
+        int32_t timer_precision = TIMER_PRECISION;
+        uint32_t budget = SERVICE_BUDGET;
+        int64_t gc_budget = IDLE_GC_BUDGET;
+        mailbox_limit mailbox;
         std::string loglevel;
         std::string name;
         std::string outer_host;
@@ -105,6 +111,16 @@ namespace moon
                     scfg.outer_host = rapidjson::get_value<std::string>(&c, "outer_host", "*");
                     scfg.inner_host = rapidjson::get_value<std::string>(&c, "inner_host", "127.0.0.1");
                     scfg.thread = rapidjson::get_value<int32_t>(&c, "thread", std::thread::hardware_concurrency());
+                    scfg.steal = rapidjson::get_value<bool>(&c, "steal", false);
+                    scfg.event_tick = rapidjson::get_value<bool>(&c, "event_tick", false);
+                    scfg.timer_precision = rapidjson::get_value<int32_t>(&c, "timer_precision", TIMER_PRECISION);
+                    scfg.budget = static_cast<uint32_t>(rapidjson::get_value<int32_t>(&c, "budget", SERVICE_BUDGET));
+                    scfg.gc_budget = rapidjson::get_value<int64_t>(&c, "gc_budget", IDLE_GC_BUDGET);
+                    scfg.mailbox.high = static_cast<uint32_t>(rapidjson::get_value<int32_t>(&c, "mailbox_high", 0));
+                    scfg.mailbox.low = static_cast<uint32_t>(rapidjson::get_value<int32_t>(&c, "mailbox_low", scfg.mailbox.high / 2));
+                    auto policy = rapidjson::get_value<std::string>(&c, "mailbox_policy", "none");
+                    MOON_CHECK(to_mailbox_policy(policy, scfg.mailbox.policy), moon::format("Server config format error: unknown mailbox_policy %s", policy.data()));
+                    MOON_CHECK(scfg.mailbox.low <= scfg.mailbox.high, "Server config format error: mailbox_low must not be greater than mailbox_high");
                     scfg.startup = rapidjson::get_value<std::string>(&c, "startup");
                     scfg.log = rapidjson::get_value<std::string>(&c, "log");
                     scfg.loglevel = rapidjson::get_value<std::string>(&c, "loglevel", "DEBUG");
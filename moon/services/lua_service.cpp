@@ -3,8 +3,10 @@
 #include "server.h"
 #include "worker.h"
 #include "common/hash.hpp"
+#include "common/time.hpp"
 #include "rapidjson/document.h"
 #include "luabind/lua_serialize.hpp"
+#include "luabind/lua_shared_table.hpp"
 #include "service_config.hpp"
 #include "server_config.hpp"
 
@@ -35,18 +37,36 @@ void * lua_service::lalloc(void * ud, void *ptr, size_t osize, size_t nsize) {
 
     if (nsize == 0)
     {
-        free(ptr);
+        l->pool_.deallocate(ptr, osize);
         return NULL;
     }
     else
     {
-        return realloc(ptr, nsize);
+        return l->pool_.reallocate(ptr, osize, nsize);
+    }
+}
+
+void lua_service::gchook(void* ud, int what)
+{
+    auto l = static_cast<lua_service*>(ud);
+    if (what == LUA_GCHOOKBEGIN)
+    {
+        if (l->gc_depth_++ == 0)
+        {
+            l->gc_begin_ = moon::time::microsecond();
+        }
+    }
+    else if (--l->gc_depth_ == 0)
+    {
+        l->gc_time_ += moon::time::microsecond() - l->gc_begin_;
+        ++l->gc_steps_;
     }
 }
 
 lua_service::lua_service()
     :lua_(sol::default_at_panic, lalloc, this)
 {
+    lua_setgchook(lua_.lua_state(), gchook, this);
 }
 
 lua_service::~lua_service()
@@ -63,6 +83,26 @@ bool lua_service::init(string_view_t config)
         MOON_CHECK(!luafile.empty(), "lua service init failed: config does not provide lua file.");
         mem_limit = static_cast<size_t>(conf.get_value<int64_t>("memlimit"));
 
+        //lua 5.3 collector is incremental only. idle: also step it when the worker has nothing to do
+        auto gcmode = conf.get_value<std::string>("gcmode");
+        if (gcmode == "idle")
+        {
+            idle_gc_ = true;
+        }
+        else
+        {
+            MOON_CHECK(gcmode.empty() || gcmode == "incremental", moon::format("lua service init failed: unsupported gcmode %s.", gcmode.data()));
+        }
+        if (auto v = conf.get_value<int32_t>("gcpause"); v > 0)
+        {
+            lua_gc(lua_.lua_state(), LUA_GCSETPAUSE, v);
+        }
+        if (auto v = conf.get_value<int32_t>("gcstepmul"); v > 0)
+        {
+            lua_gc(lua_.lua_state(), LUA_GCSETSTEPMUL, v);
+        }
+        gc_stepsize_ = conf.get_value<int32_t>("gcstepsize");
+
         lua_.open_libraries();
         sol::table module = lua_.create_table();
         lua_bind lua_bind(module);
@@ -78,6 +118,7 @@ bool lua_service::init(string_view_t config)
         lua_bind::registerlib(lua_.lua_state(), "codecache", luaopen_cache);
         lua_bind::registerlib(lua_.lua_state(), "moon_core", module);
         lua_bind::registerlib(lua_.lua_state(), "seri", lua_serialize::open);
+        lua_bind::registerlib(lua_.lua_state(), "sharetable", lua_shared_table::open);
         sol::object json = lua_.require("json", luaopen_rapidjson, false);
 
         moon::server_config_manger& server_config = moon::server_config_manger::instance();
@@ -137,6 +178,7 @@ bool lua_service::init(string_view_t config)
         }
 
         logger()->logstring(true, moon::LogLevel::Info, moon::format("[WORKER %u] new service [%s:%X]", worker_->id(), name().data(), id()), id());
+        set_gc_trigger();
         ok_ = true;
     }
     catch (std::exception& e)
@@ -198,7 +240,7 @@ void lua_service::dispatch(message* msg)
     }
 }
 
-void lua_service::on_timer(uint32_t timerid, bool remove)
+void lua_service::on_timer(timer_id_t timerid, bool remove)
 {
     if (!ok()) return;
     try
@@ -216,6 +258,57 @@ void lua_service::on_timer(uint32_t timerid, bool remove)
     }
 }
 
+static int gc_step_call(lua_State* L)
+{
+    lua_pushboolean(L, lua_gc(L, LUA_GCSTEP, static_cast<int>(lua_tointeger(L, 1))));
+    return 1;
+}
+
+bool lua_service::gc_step()
+{
+    lua_State* L = lua_.lua_state();
+    //stopped by collectgarbage("stop")
+    if (!ok() || !lua_gc(L, LUA_GCISRUNNING, 0))
+    {
+        return false;
+    }
+
+    if (!gc_cycling_ && mem < gc_trigger_)
+    {
+        return false;
+    }
+
+    //__gc metamethods may raise errors, time and count are taken by gchook
+    lua_pushcfunction(L, gc_step_call);
+    lua_pushinteger(L, gc_stepsize_);
+    int r = lua_pcall(L, 1, 1, 0);
+    bool done = (r != LUA_OK) || lua_toboolean(L, -1);
+    if (r != LUA_OK)
+    {
+        CONSOLE_ERROR(logger(), "%s gc step:\n%s", name().data(), lua_tostring(L, -1));
+    }
+    lua_pop(L, 1);
+
+    if (done)
+    {
+        ++gc_cycles_;
+        gc_cycling_ = false;
+        set_gc_trigger();
+        return false;
+    }
+    gc_cycling_ = true;
+    return true;
+}
+
+void lua_service::set_gc_trigger()
+{
+    //halfway from live memory to where the collector starts a cycle by itself(pause)
+    lua_State* L = lua_.lua_state();
+    int pause = lua_gc(L, LUA_GCSETPAUSE, 0);
+    lua_gc(L, LUA_GCSETPAUSE, pause);
+    gc_trigger_ = mem + ((pause > 100) ? mem / 100 * static_cast<size_t>(pause - 100) / 2 : 0);
+}
+
 void lua_service::exit()
 {
     if (!ok()) return;
@@ -289,6 +382,11 @@ size_t lua_service::memory_use()
     return  mem;
 }
 
+const moon::size_class_pool& lua_service::memory_pool() const
+{
+    return pool_;
+}
+
 void lua_service::set_callback(char c, sol_function_t f)
 {
     switch (c)
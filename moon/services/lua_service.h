@@ -2,6 +2,7 @@
 #include "common/log.hpp"
 #include "luabind/lua_bind.h"
 #include "common/buffer.hpp"
+#include "common/size_class_pool.hpp"
 #include "service.hpp"
 
 class lua_service :public moon::service
@@ -27,7 +28,9 @@ public:
 
     ~lua_service();
 
-    size_t memory_use();
+    size_t memory_use() override;
+
+    const moon::size_class_pool& memory_pool() const;
 
     void set_callback(char c, sol_function_t f);
 private:
@@ -41,20 +44,37 @@ private:
 
     void dispatch(moon::message* msg) override;
 
-    void on_timer(uint32_t timerid, bool remove) override;
+    void on_timer(moon::timer_id_t timerid, bool remove) override;
+
+    bool gc_step() override;
+
+    void set_gc_trigger();
 
     void error(const std::string& msg, bool initialized = true);
 
     static void* lalloc(void * ud, void *ptr, size_t osize, size_t nsize);
+
+    static void gchook(void* ud, int what);
 public:
     size_t mem = 0;
     size_t mem_limit = 0;
     size_t mem_report = 8 * 1024 * 1024;
 private:
+    //one pool per VM, not per worker: services are moved between workers by work stealing.
+    //declared before lua_, lua_close frees into it
+    moon::size_class_pool pool_;
     sol::state lua_;
     sol_function_t start_;
     sol_function_t dispatch_;
     sol_function_t exit_;
     sol_function_t destroy_;
     sol_function_t on_timer_;
+    //idle gc: LUA_GCSTEP size(KB), 0 is the smallest step
+    int gc_stepsize_ = 0;
+    //idle gc starts a cycle when memory reaches it, stops after the cycle finished
+    size_t gc_trigger_ = 0;
+    bool gc_cycling_ = false;
+    //gchook calls nest when a finalizer runs out of memory, only the outer one is timed
+    int gc_depth_ = 0;
+    int64_t gc_begin_ = 0;
 };
\ No newline at end of file
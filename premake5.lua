@@ -1,3 +1,13 @@
+newoption {
+    trigger = "mpsc-mailbox",
+    description = "Use lock-free mpsc queue as worker mailbox instead of spin_lock + vector swap"
+}
+
+newoption {
+    trigger = "ws-deflate",
+    description = "Support websocket permessage-deflate, needs zlib"
+}
+
 workspace "Server"
     configurations { "Debug", "Release" }
 
@@ -95,6 +105,21 @@ project "moon"
         linkoptions {"-Wl,-rpath,./"}
     filter "configurations:Debug"
         targetsuffix "-d"
+    filter "options:mpsc-mailbox"
+        defines {"MOON_MPSC_MAILBOX"}
+    filter "options:ws-deflate"
+        defines {"MOON_WS_DEFLATE"}
+        links{"z"}
+
+-- websocket unmask 吞吐测试: bin/Release/ws_unmask_benchmark
+project "ws_unmask_benchmark"
+    objdir "obj/ws_unmask_benchmark/%{cfg.platform}_%{cfg.buildcfg}"
+    location "build/ws_unmask_benchmark"
+    kind "ConsoleApp"
+    language "C++"
+    targetdir "bin/%{cfg.buildcfg}"
+    includedirs {"./"}
+    files {"./benchmark/**.cpp"}
 
 
 --[[
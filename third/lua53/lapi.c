@@ -1159,6 +1159,15 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 
 
 
+LUA_API void lua_setgchook (lua_State *L, lua_GCHook f, void *ud) {
+  lua_lock(L);
+  G(L)->gchook = f;
+  G(L)->gchookud = ud;
+  lua_unlock(L);
+}
+
+
+
 /*
 ** miscellaneous functions
 */
@@ -1048,6 +1048,10 @@ LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
 struct codecache {
 	struct spinlock lock;
 	lua_State *L;
+	size_t hit;
+	size_t miss;
+	size_t files;
+	size_t memory;
 };
 
 static struct codecache CC;
@@ -1059,6 +1063,8 @@ clearcache() {
 	SPIN_LOCK(&CC)
 		lua_close(CC.L);
 		CC.L = luaL_newstate();
+		CC.files = 0;
+		CC.memory = 0;
 	SPIN_UNLOCK(&CC)
 }
 
@@ -1078,13 +1084,17 @@ load(const char *key) {
     lua_rawget(L, LUA_REGISTRYINDEX);
     const void * result = lua_touserdata(L, -1);
     lua_pop(L, 1);
+    if (result)
+      ++CC.hit;
+    else
+      ++CC.miss;
   SPIN_UNLOCK(&CC)
 
   return result;
 }
 
 static const void *
-save(const char *key, const void * proto) {
+save(const char *key, const void * proto, size_t memory) {
   lua_State *L;
   const void * result = NULL;
 
@@ -1102,6 +1112,8 @@ save(const char *key, const void * proto) {
         lua_pop(L,1);
         lua_pushlightuserdata(L, (void *)proto);
         lua_rawset(L, LUA_REGISTRYINDEX);
+        ++CC.files;
+        CC.memory += memory;
       } else {
         lua_pop(L,2);
       }
@@ -1180,7 +1192,8 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
     return err;
   }
   proto = lua_topointer(eL, -1);
-  const void * oldv = save(filename, proto);
+  size_t memory = (size_t)lua_gc(eL, LUA_GCCOUNT, 0) * 1024 + (size_t)lua_gc(eL, LUA_GCCOUNTB, 0);
+  const void * oldv = save(filename, proto, memory);
   if (oldv) {
     lua_close(eL);
     lua_clonefunction(L, oldv);
@@ -1199,9 +1212,32 @@ cache_clear(lua_State *L) {
 	return 0;
 }
 
+/* hit/miss count loads while cache is on, files/memory are the cached protos and their states */
+static int
+cache_stats(lua_State *L) {
+	size_t hit, miss, files, memory;
+	SPIN_LOCK(&CC)
+		hit = CC.hit;
+		miss = CC.miss;
+		files = CC.files;
+		memory = CC.memory;
+	SPIN_UNLOCK(&CC)
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, (lua_Integer)hit);
+	lua_setfield(L, -2, "hit");
+	lua_pushinteger(L, (lua_Integer)miss);
+	lua_setfield(L, -2, "miss");
+	lua_pushinteger(L, (lua_Integer)files);
+	lua_setfield(L, -2, "files");
+	lua_pushinteger(L, (lua_Integer)memory);
+	lua_setfield(L, -2, "memory");
+	return 1;
+}
+
 LUAMOD_API int luaopen_cache(lua_State *L) {
 	luaL_Reg l[] = {
 		{ "clear", cache_clear },
+		{ "stats", cache_stats },
 		{ "mode", cache_mode },
 		{ NULL, NULL },
 	};
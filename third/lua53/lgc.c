@@ -1134,16 +1134,34 @@ static l_mem getdebt (global_State *g) {
   }
 }
 
+#define callgchook(g,what)  \
+  { if ((g)->gchook) (g)->gchook((g)->gchookud, what); }
+
+
 /*
-** performs a basic GC step when collector is running
+** Runs 'f' between the BEGIN and END calls of the gc hook. A finalizer
+** error raised inside 'f' is caught so that END is always called, then
+** raised again.
 */
-void luaC_step (lua_State *L) {
+static void hookedgc (lua_State *L, Pfunc f, void *ud) {
   global_State *g = G(L);
-  l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
-  if (!g->gcrunning) {  /* not running? */
-    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
+  int status;
+  if (g->gchook == NULL) {
+    f(L, ud);
     return;
   }
+  callgchook(g, LUA_GCHOOKBEGIN);
+  status = luaD_rawrunprotected(L, f, ud);
+  callgchook(g, LUA_GCHOOKEND);
+  if (status != LUA_OK)
+    luaD_throw(L, status);  /* error object is still on the top */
+}
+
+
+static void stepgc (lua_State *L, void *ud) {
+  global_State *g = G(L);
+  l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
+  UNUSED(ud);
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -1159,18 +1177,21 @@ void luaC_step (lua_State *L) {
 
 
 /*
-** Performs a full GC cycle; if 'isemergency', set a flag to avoid
-** some operations which could change the interpreter state in some
-** unexpected ways (running finalizers and shrinking some structures).
-** Before running the collection, check 'keepinvariant'; if it is true,
-** there may be some objects marked as black, so the collector has
-** to sweep all objects to turn them back to white (as white has not
-** changed, nothing will be collected).
+** performs a basic GC step when collector is running
 */
-void luaC_fullgc (lua_State *L, int isemergency) {
+void luaC_step (lua_State *L) {
   global_State *g = G(L);
-  lua_assert(g->gckind == KGC_NORMAL);
-  if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
+  if (!g->gcrunning) {  /* not running? */
+    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
+    return;
+  }
+  hookedgc(L, stepgc, NULL);
+}
+
+
+static void fullgc (lua_State *L, void *ud) {
+  global_State *g = G(L);
+  if (*cast(int *, ud)) g->gckind = KGC_EMERGENCY;  /* set flag */
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
@@ -1185,6 +1206,21 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   setpause(g);
 }
 
+
+/*
+** Performs a full GC cycle; if 'isemergency', set a flag to avoid
+** some operations which could change the interpreter state in some
+** unexpected ways (running finalizers and shrinking some structures).
+** Before running the collection, check 'keepinvariant'; if it is true,
+** there may be some objects marked as black, so the collector has
+** to sweep all objects to turn them back to white (as white has not
+** changed, nothing will be collected).
+*/
+void luaC_fullgc (lua_State *L, int isemergency) {
+  lua_assert(G(L)->gckind == KGC_NORMAL);
+  hookedgc(L, fullgc, &isemergency);
+}
+
 /* }====================================================== */
 
 
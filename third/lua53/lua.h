@@ -313,6 +313,18 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
+/*
+** called before and after each collector step and full collection,
+** 'what' is LUA_GCHOOKBEGIN or LUA_GCHOOKEND. Calls nest when a finalizer
+** runs out of memory.
+*/
+#define LUA_GCHOOKBEGIN		0
+#define LUA_GCHOOKEND		1
+
+typedef void (*lua_GCHook) (void *ud, int what);
+
+LUA_API void (lua_setgchook) (lua_State *L, lua_GCHook f, void *ud);
+
 
 /*
 ** miscellaneous functions